@@ -68,6 +68,15 @@ void ControllerSessionClient::handleRegisterAsControllerResponse(const data::Reg
 		returnCallbackStack(std::move(result_base));
 		return;
 	}
+	if(response.resultCode == data::RegisterAsController::ResponseHeader::ResultCode::Full)
+	{
+		std::cout << "Server cannot register more controllers\n";
+		
+		result->status = CallbackResult::Status::Error;
+		result->value = 3;
+		returnCallbackStack(std::move(result_base));
+		return;
+	}
 }
 
 
@@ -103,70 +103,217 @@ void WozekSessionClient::receiveLookupIdFromNameResponse(const data::LookupIdFor
 	returnCallbackStack(std::move(result_base));
 }
 
+void WozekSessionClient::performBulkLookupIdForNameRequest(const std::vector<std::string>& names)
+{
+	Error err;
+	
+	const char requestId = data::BulkLookupIdForName::request_id;
+	
+	// All names are sent in one write, with the request header in front
+	auto& state = setState<States::BulkLookup>();
+	state.names.resize(1 + sizeof(data::BulkLookupIdForName::Request));
+	for(auto& name : names)
+	{
+		const uint32_t nameLength = name.size();
+		state.names.insert(state.names.end(), reinterpret_cast<const char*>(&nameLength), reinterpret_cast<const char*>(&nameLength) + sizeof(nameLength));
+		state.names.insert(state.names.end(), name.begin(), name.end());
+	}
+	
+	data::BulkLookupIdForName::Request request;
+	request.namesCount = names.size();
+	request.totalLength = state.names.size() - 1 - sizeof(request);
+	state.names[0] = requestId;
+	std::memcpy(state.names.data() + 1, &request, sizeof(request));
+	
+	asio::write(getSocket(), asio::buffer( state.names ), err);
+	if(err) { errorCritical(err); return; }
+	
+	asyncReadObjects<data::BulkLookupIdForName::Response>(
+		&WozekSessionClient::receiveBulkLookupIdForNameResponse,
+		&WozekSessionClient::errorCritical
+	);
+}
+
+void WozekSessionClient::receiveBulkLookupIdForNameResponse(const data::BulkLookupIdForName::Response& response)
+{
+	auto& state = getState<States::BulkLookup>();
+	state.response.resize(response.namesCount * sizeof(data::IdType));
+	
+	asyncRead(
+		asio::buffer(state.response),
+		&WozekSessionClient::finalizeBulkLookupIdForName,
+		&WozekSessionClient::errorCritical
+	);
+}
+
+void WozekSessionClient::finalizeBulkLookupIdForName()
+{
+	auto& state = getState<States::BulkLookup>();
+	
+	auto result = new ValueCallbackResult<std::vector<data::IdType>>;
+	result->value.resize(state.response.size() / sizeof(data::IdType));
+	std::memcpy(result->value.data(), state.response.data(), result->value.size() * sizeof(data::IdType));
+	
+	auto result_base = std::unique_ptr<CallbackResult>(result);
+	resetState();
+	returnCallbackStack(std::move(result_base));
+}
+
 /// File ///
 
+void WozekSessionClient::performUploadFileRequest(const fs::path& sourcePath, const std::string& fileName)
+{
+	Error err;
+	
+	const char requestId = data::FileTransfer::Upload::Code;
+	
+	data::FileTransfer::Upload::Request request = {};
+	std::memcpy(request.fileName, fileName.data(), std::min(fileName.size(), sizeof(request.fileName) - 1));
+	
+	std::error_code fileErr;
+	request.fileSize = fs::file_size(sourcePath, fileErr);
+	if(fileErr)
+	{
+		std::cout << "Cannot read the size of the file to upload: " << sourcePath << '\n';
+		returnCallbackError();
+		return;
+	}
+	
+	asio::write(getSocket(), asio::buffer( &requestId , 1 ), err);
+	if(err) { errorCritical(err); return; }
+	
+	asio::write(getSocket(), asio::buffer( &request , sizeof(request) ), err);
+	if(err) { errorCritical(err); return; }
+	
+	asyncReadObjects<data::FileTransfer::Upload::Response>(
+		[=](const data::FileTransfer::Upload::Response& response){ handleUploadFileResponse(response, sourcePath, request.fileSize); },
+		&WozekSessionClient::errorCritical
+	);
+}
+
+void WozekSessionClient::handleUploadFileResponse(const data::FileTransfer::Upload::Response& response, const fs::path& sourcePath, const size_t fileSize)
+{
+	if(response.code != data::FileTransfer::Upload::Response::AcceptCode)
+	{
+		std::cout << "Upload of " << sourcePath << " refused with code: " << static_cast<int>(response.code) << '\n';
+		returnCallbackError();
+		return;
+	}
+	std::cout << "Uploading " << sourcePath << " (" << fileSize << " bytes)\n";
+	startSegmentedFileSend(sourcePath, fileSize);
+}
+
 void WozekSessionClient::startSegmentedFileSend(const fs::path sourcePath, const size_t fileSize)
 {
 	auto& state = setState<States::SegmentedFileTransfer>();
-	state.bigBuffer.resize(DefaultBigBufferSize);
-	state.fileStream.emplace(getContext(), sourcePath, std::ios::in | std::ios::binary);
+	try
+	{
+		state.sourceFile = std::make_shared<const MappedFile>(sourcePath);
+	}
+	catch(std::exception& e)
+	{
+		std::cout << "Cannot map the file to send: " << e.what() << '\n';
+	}
+	// File could have changed since its size was sent
+	if(!state.sourceFile || state.sourceFile->size() != fileSize)
+	{
+		resetState();
+		returnCallbackCriticalError();
+		return;
+	}
 	state.bytesRemaining = fileSize;
+	state.negotiation.segmentLength = InitialSegmentSize;
+	state.segmentsUntilNegotiation = 0;
+	
+	sendSegmentHeader();
 }
 
 void WozekSessionClient::sendSegmentHeader()
 {
 	auto& state = getState<States::SegmentedFileTransfer>();
 	
-	
+	// Receiver confirms, that the whole file was stored
 	if(state.bytesRemaining == 0)
 	{
-		
+		asyncReadObjects<data::SegmentedFileTransfer::Negotiation>(
+			&WozekSessionClient::handleSegmentFileSendResult,
+			&WozekSessionClient::errorCritical
+		);
 		return;
 	}
 	
-	if(state.fileSegmentLengthLeft == 0)
-	{
-		state.fileStream.value().stream.read(state.bigBuffer.data(), state.bigBuffer.size());
-		state.fileSegmentLengthLeft = DefaultSegmentsInBuffer;
-	}
+	data::SegmentedFileTransfer::Header header;
+	header.startHeader = data::SegmentedFileTransfer::Header::correctStartHeader;
+	header.segmentLength = std::min<size_t>(state.bytesRemaining, state.negotiation.segmentLength);
+	state.fileSegmentLengthLeft = header.segmentLength;
 	
-	if(state.bytesRemaining < DefaultSegmentSize)
+	Error err;
+	asio::write(getSocket(), asio::buffer( &header, sizeof(header) ), err);
+	if(err) { errorCritical(err); return; }
+	
+	// Segments inside of the negotiated window are sent without waiting for the receiver
+	if(state.segmentsUntilNegotiation > 0)
 	{
-		
+		--state.segmentsUntilNegotiation;
+		sendSegmentFileData();
 		return;
 	}
 	
-	data::SegmentedFileTransfer::Header header = {}; // TODO
-	 /*
-	asyncWriteObjects(
-		&WozekSessionClient::handleSegmentFileHeaderResponseCode,
-		&WozekSessionClient::errorCritical,
-		header
+	asyncReadObjects<data::SegmentedFileTransfer::Negotiation>(
+		&WozekSessionClient::handleSegmentNegotiation,
+		&WozekSessionClient::errorCritical
 	);
-	*/
-	
-	// TODO ALL
-	
 }
 
-void WozekSessionClient::handleSegmentFileHeaderResponseCode(const data::SegmentedFileTransfer::Error error)
+void WozekSessionClient::handleSegmentNegotiation(const data::SegmentedFileTransfer::Negotiation& negotiation)
 {
+	if(negotiation.code != data::SegmentedFileTransfer::Good || negotiation.segmentLength == 0)
+	{
+		std::cout << "Segmented file transfer rejected with code: " << negotiation.code << '\n';
+		resetState();
+		returnCallbackError();
+		return;
+	}
+	
+	auto& state = getState<States::SegmentedFileTransfer>();
+	state.negotiation = negotiation;
+	state.segmentsUntilNegotiation = negotiation.window > 0 ? negotiation.window - 1 : 0;
 	
+	sendSegmentFileData();
 }
 
 void WozekSessionClient::sendSegmentFileData()
 {
+	auto& state = getState<States::SegmentedFileTransfer>();
 	
+	// Segment is written straight from the mapping, without copying it into a buffer first
+	const size_t offset = state.sourceFile->size() - state.bytesRemaining;
+	Error err;
+	asio::write(getSocket(), asio::buffer( state.sourceFile->data() + offset, state.fileSegmentLengthLeft ), err);
+	if(err) { errorCritical(err); return; }
+	
+	state.bytesRemaining -= state.fileSegmentLengthLeft;
+	state.fileSegmentLengthLeft = 0;
+	
+	sendSegmentHeader();
 }
 
-void WozekSessionClient::handleSegmentFileDataResponseCode(const data::SegmentedFileTransfer::Error error)
+void WozekSessionClient::handleSegmentFileSendResult(const data::SegmentedFileTransfer::Negotiation& result)
 {
-	
+	if(result.code != data::SegmentedFileTransfer::Good)
+	{
+		std::cout << "Segmented file transfer failed with code: " << result.code << '\n';
+		resetState();
+		returnCallbackError();
+		return;
+	}
+	finalizeSegmentFileSend();
 }
 
 void WozekSessionClient::finalizeSegmentFileSend()
 {
-	
+	resetState();
+	returnCallbackGood();
 }
 
 
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <algorithm>
 #include <type_traits>
+#include <vector>
 #include "GameManager.hpp"
 
 
@@ -37,27 +38,31 @@ public:
 	
 	void performEchoRequest(const std::string& message);
 	void performLookupIdForNameRequest(const std::string& name);
+	void performBulkLookupIdForNameRequest(const std::vector<std::string>& names);
+	void performUploadFileRequest(const fs::path& sourcePath, const std::string& fileName);
 	void sendHeartbeat();
 
 protected:
 	
 	
-	constexpr static size_t DefaultBigBufferSize = 1024 * 1024 * 16;
-	constexpr static size_t DefaultSegmentsInBuffer = 16;
-	constexpr static size_t DefaultSegmentSize = DefaultBigBufferSize / DefaultSegmentsInBuffer;
+	constexpr static size_t InitialSegmentSize = 1024 * 64; // used until the first Negotiation is received
 	void startSegmentedFileSend(const fs::path sourcePath, const size_t fileSize);
 	void sendSegmentHeader();
-	void handleSegmentFileHeaderResponseCode(const data::SegmentedFileTransfer::Error error);
+	void handleSegmentNegotiation(const data::SegmentedFileTransfer::Negotiation& negotiation);
 	void sendSegmentFileData();
-	void handleSegmentFileDataResponseCode(const data::SegmentedFileTransfer::Error error);
+	void handleSegmentFileSendResult(const data::SegmentedFileTransfer::Negotiation& result);
 	void finalizeSegmentFileSend();
 	
+	void handleUploadFileResponse(const data::FileTransfer::Upload::Response& response, const fs::path& sourcePath, const size_t fileSize);
+	
 	
 	void receiveEchoResponsePart();
 	void handleEchoResponsePart(const char c);
 	void finilizeEcho(std::string& receiveedMessage);
 	
 	void receiveLookupIdFromNameResponse(const data::LookupIdForName::Response& response);
+	void receiveBulkLookupIdForNameResponse(const data::BulkLookupIdForName::Response& response);
+	void finalizeBulkLookupIdForName();
 	
 	bool errorCritical(const Error& err) {
 		if(err == asio::error::eof){
@@ -1,4 +1,5 @@
 #include "ClientUDP.hpp"
+#include "HostState.hpp"
 
 #ifdef DLL
 
@@ -59,6 +60,16 @@ void WozekUDPReceiver::handleDatagram()
 			handleEchoResponse();
 			break;
 		}
+		case data::UpdateHostState::Code:
+		{
+			handleHostState();
+			break;
+		}
+		case data::UpdateHostStateDelta::Code:
+		{
+			handleHostStateDelta();
+			break;
+		}
 		default:
 		{
 			std::cout << "Unknown UDP response id: " << static_cast<int>(requestId) << '\n';
@@ -85,6 +96,34 @@ void WozekUDPReceiver::handleEchoResponse()
 	#endif // DLL
 }
 
+void WozekUDPReceiver::handleHostState()
+{
+	hostStateReceiver.receiveUpdate(static_cast<const char*>(buffer.get().data()), bytesTransfered);
+}
+
+void WozekUDPReceiver::handleHostStateDelta()
+{
+	const auto tick = hostStateReceiver.receiveDeltaUpdate(static_cast<const char*>(buffer.get().data()), bytesTransfered);
+	if(tick == 0)
+	{
+		return;
+	}
+	
+	// Complete tick becomes the baseline of following updates, once the server knows it arrived
+	data::UpdateHostStateDelta::Header header;
+	buffer.loadObjectAt(1, header);
+	data::AckHostState::Request request;
+	request.worldId = header.worldId;
+	request.timepoint = tick;
+	
+	asyncWriteObjectsTo(
+		hostStateReceiver.getServerEndpoint(),
+		[]{},
+		&WozekUDPReceiver::errorAbort,
+		char(data::AckHostState::request_id),
+		request
+	);
+}
 
 
 
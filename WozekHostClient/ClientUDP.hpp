@@ -47,12 +47,13 @@ public:
 	}
 };
 
-class WozekUDPReceiver : public BasicHandler<WozekUDPReceiver,ArrayBuffer< 512 >, false>
+// Has to fit the datagrams of the host state, which are hostStateDatagramSize (1200 by default) at most
+class WozekUDPReceiver : public BasicHandler<WozekUDPReceiver,ArrayBuffer< 1<<11 >, false>
 {
 protected:
 	
 	
-	constexpr static auto BufferSize = 512;	
+	constexpr static auto BufferSize = 1 << 11;	
 	
 	virtual void connectionErrorHandler_impl(const Error& err)
 	{
@@ -86,6 +87,14 @@ public:
 	}
 	
 	void handleEchoResponse();
+	void handleHostState();
+	void handleHostStateDelta();
+	
+	bool errorAbort(const Error& err)
+	{
+		std::cout << "Error during handling UDP datagram: " << err << '\n';
+		return true;
+	}
 };
 
 
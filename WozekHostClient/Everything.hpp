@@ -3,5 +3,6 @@
 #include "Imported.hpp"
 #include "ClientTCP.hpp"
 #include "ClientUDP.hpp"
+#include "HostState.hpp"
 
 #include <string>
@@ -31,8 +31,11 @@ public:
 	{
 		data::UpdateHostState::Header res;
 		res.worldId = worldId;
+		res.packetIndex = 0;
+		res.packetsCount = 1;
 		res.timepoint = getTimestamp();
 		res.controllersCount = 0;
+		res.tickRate = 0;
 		
 		return res;
 	}
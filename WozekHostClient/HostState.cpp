@@ -0,0 +1,417 @@
+#include "HostState.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+HostStateReceiver hostStateReceiver;
+
+static double toNanoseconds(const JitterBuffer::Clock::time_point& time)
+{
+	return std::chrono::duration<double, std::nano>(time.time_since_epoch()).count();
+}
+
+static data::Controller::DesiredState mix(const data::Controller::DesiredState& a, const data::Controller::DesiredState& b, const float alpha)
+{
+	data::Controller::DesiredState res;
+	for(size_t i=0; i<3; i++) res.position[i] = a.position[i] + (b.position[i] - a.position[i]) * alpha;
+	for(size_t i=0; i<2; i++) res.orientation[i] = a.orientation[i] + (b.orientation[i] - a.orientation[i]) * alpha;
+	for(size_t i=0; i<2; i++) res.wheelSpeed[i] = a.wheelSpeed[i] + (b.wheelSpeed[i] - a.wheelSpeed[i]) * alpha;
+	return res;
+}
+
+// Sorts both vectors by ids. Packets of a tick are sorted on their own, so they are mostly in order already
+template <typename State>
+static void sortById(std::vector<data::IdType>& ids, std::vector<State>& states)
+{
+	if(std::is_sorted(ids.begin(), ids.end()))
+	{
+		return;
+	}
+	std::vector<size_t> order(ids.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&ids](const size_t a, const size_t b){ return ids[a] < ids[b]; });
+	
+	std::vector<data::IdType> sortedIds(ids.size());
+	std::vector<State> sortedStates(states.size());
+	for(size_t i=0; i<order.size(); i++)
+	{
+		sortedIds[i] = ids[order[i]];
+		sortedStates[i] = states[order[i]];
+	}
+	ids.swap(sortedIds);
+	states.swap(sortedStates);
+}
+
+/// WorldSnapshot ///
+
+const data::Controller::DesiredState* WorldSnapshot::find(const data::IdType id) const
+{
+	const auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if(it == ids.end() || *it != id)
+		return nullptr;
+	return &states[it - ids.begin()];
+}
+
+/// JitterBuffer ///
+
+void JitterBuffer::setSettings(const Settings& newSettings)
+{
+	std::lock_guard lock{mutex};
+	settings = newSettings;
+	settings.capacity = std::max<size_t>(settings.capacity, 2);
+}
+
+void JitterBuffer::setTickRate(const uint32_t newTickRate)
+{
+	std::lock_guard lock{mutex};
+	if(newTickRate == 0 || newTickRate == tickRate)
+	{
+		return;
+	}
+	// Ticks are placed on the timeline by the tick rate
+	tickRate = newTickRate;
+	timelineStarted = false;
+}
+
+void JitterBuffer::push(WorldSnapshot&& snapshot, const Clock::time_point arrival)
+{
+	std::lock_guard lock{mutex};
+	const double period = getPeriod();
+	const double minDelay = std::chrono::duration<double, std::nano>(settings.minDelay).count();
+	const double maxDelay = std::chrono::duration<double, std::nano>(settings.maxDelay).count();
+	
+	// How late the tick arrived, compared to the earliest arrivals
+	const double offset = toNanoseconds(arrival) - snapshot.tick * period;
+	if(!timelineStarted || offset < clockOffset)
+	{
+		clockOffset = offset;
+	}
+	const double lateness = offset - clockOffset;
+	if(!timelineStarted)
+	{
+		timelineStarted = true;
+		jitter = 0;
+		delay = std::clamp(period, minDelay, maxDelay);
+		lastRenderTime = toNanoseconds(arrival);
+	}
+	jitter += (lateness - jitter) * JitterGain;
+	clockOffset += lateness * DriftGain; // follows the drift of the clocks, as the earliest arrivals become later
+	targetDelay = std::clamp(period + settings.jitterMultiplier * jitter, minDelay, maxDelay);
+	
+	const auto it = std::lower_bound(snapshots.begin(), snapshots.end(), snapshot.tick, [](const WorldSnapshot& s, const uint64_t tick){
+		return s.tick < tick;
+	});
+	if(it != snapshots.end() && it->tick == snapshot.tick)
+	{
+		return;
+	}
+	snapshots.insert(it, std::move(snapshot));
+	while(snapshots.size() > settings.capacity)
+	{
+		snapshots.pop_front();
+	}
+}
+
+double JitterBuffer::advanceRenderTick(const Clock::time_point renderTime)
+{
+	const double now = toNanoseconds(renderTime);
+	const double step = std::max(0.0, now - lastRenderTime) * DelayAdjustmentRate;
+	lastRenderTime = std::max(lastRenderTime, now);
+	delay += std::clamp(targetDelay - delay, -step, step);
+	return (now - clockOffset - delay) / getPeriod();
+}
+
+JitterBuffer::Position JitterBuffer::locate(const double renderTick) const
+{
+	Position res;
+	if(snapshots.empty())
+	{
+		return res;
+	}
+	
+	const auto next = std::upper_bound(snapshots.begin(), snapshots.end(), renderTick, [](const double tick, const WorldSnapshot& s){
+		return tick < s.tick;
+	});
+	if(next == snapshots.begin())
+	{
+		// Everything in the buffer is yet to be shown
+		res.base = &snapshots.front();
+		return res;
+	}
+	if(next != snapshots.end())
+	{
+		const auto& previous = *(next - 1);
+		res.base = &previous;
+		res.other = &*next;
+		res.alpha = (renderTick - previous.tick) / (next->tick - previous.tick);
+		return res;
+	}
+	
+	// Next tick is late, so the last two are extrapolated, up to maxExtrapolation past the newest one
+	res.base = &snapshots.back();
+	if(snapshots.size() < 2)
+	{
+		return res;
+	}
+	const double maxTicks = std::chrono::duration<double, std::nano>(settings.maxExtrapolation).count() / getPeriod();
+	const double ahead = std::min(renderTick - res.base->tick, maxTicks);
+	res.other = &snapshots[snapshots.size() - 2];
+	res.alpha = -ahead / (res.base->tick - res.other->tick);
+	return res;
+}
+
+bool JitterBuffer::sample(const data::IdType id, data::Controller::DesiredState& state, const Clock::time_point renderTime)
+{
+	std::lock_guard lock{mutex};
+	const auto position = locate(advanceRenderTick(renderTime));
+	const auto* base = position.base ? position.base->find(id) : nullptr;
+	if(!base)
+	{
+		return false;
+	}
+	const auto* other = position.other ? position.other->find(id) : nullptr;
+	state = other ? mix(*base, *other, position.alpha) : *base;
+	return true;
+}
+
+size_t JitterBuffer::sampleAll(data::IdType* ids, data::Controller::DesiredState* states, const size_t capacity, const Clock::time_point renderTime)
+{
+	std::lock_guard lock{mutex};
+	const auto position = locate(advanceRenderTick(renderTime));
+	if(!position.base)
+	{
+		return 0;
+	}
+	const auto& base = *position.base;
+	const size_t count = std::min(capacity, base.ids.size());
+	for(size_t i=0; i<count; i++)
+	{
+		const auto* other = position.other ? position.other->find(base.ids[i]) : nullptr;
+		ids[i] = base.ids[i];
+		states[i] = other ? mix(base.states[i], *other, position.alpha) : base.states[i];
+	}
+	return count;
+}
+
+JitterBuffer::Clock::duration JitterBuffer::getDelay() const
+{
+	std::lock_guard lock{mutex};
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::nano>(delay));
+}
+
+JitterBuffer::Clock::duration JitterBuffer::getJitter() const
+{
+	std::lock_guard lock{mutex};
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::nano>(jitter));
+}
+
+void JitterBuffer::clear()
+{
+	std::lock_guard lock{mutex};
+	snapshots.clear();
+	timelineStarted = false;
+}
+
+/// HostStateReceiver ///
+
+HostStateReceiver::PendingTick* HostStateReceiver::receivePacket(const uint64_t tick, const uint16_t packetIndex, const uint16_t packetsCount)
+{
+	if(packetIndex >= packetsCount || tick + MaxPendingTicks < newestCompleteTick)
+	{
+		return nullptr;
+	}
+	auto& pendingTick = pending[tick];
+	if(pendingTick.packetsCount == 0)
+	{
+		pendingTick.packetsCount = packetsCount;
+		pendingTick.received.assign(packetsCount, false);
+	}
+	if(pendingTick.packetsCount != packetsCount || pendingTick.received[packetIndex])
+	{
+		return nullptr;
+	}
+	pendingTick.received[packetIndex] = true;
+	pendingTick.receivedCount++;
+	return &pendingTick;
+}
+
+void HostStateReceiver::dropOldTicks()
+{
+	while(!pending.empty() && pending.begin()->first + MaxPendingTicks < newestCompleteTick)
+	{
+		pending.erase(pending.begin());
+	}
+	while(baselines.size() > MaxBaselines)
+	{
+		baselines.erase(baselines.begin());
+	}
+}
+
+void HostStateReceiver::followWorld(const data::IdType packetWorldId, const uint64_t tick, const uint32_t tickRate)
+{
+	if(packetWorldId != worldId || tick + MaxPendingTicks < newestCompleteTick)
+	{
+		reset();
+		worldId = packetWorldId;
+	}
+	jitterBuffer.setTickRate(tickRate);
+}
+
+void HostStateReceiver::reset()
+{
+	pending.clear();
+	baselines.clear();
+	newestCompleteTick = 0;
+	jitterBuffer.clear();
+}
+
+uint64_t HostStateReceiver::receiveUpdate(const char* datagram, const size_t size)
+{
+	using Update = data::UpdateHostState;
+	
+	Update::Header header;
+	if(size < sizeof(Update::Code) + sizeof(header))
+	{
+		return 0;
+	}
+	std::memcpy(&header, datagram + sizeof(Update::Code), sizeof(header));
+	// Count comes from the wire, it is checked by division, so that a huge one cannot overflow the size
+	const size_t dataSize = size - sizeof(Update::Code) - sizeof(header);
+	if(header.controllersCount > dataSize / sizeof(Update::ControllerData) || header.controllersCount * sizeof(Update::ControllerData) != dataSize)
+	{
+		return 0;
+	}
+	
+	std::lock_guard lock{mutex};
+	followWorld(header.worldId, header.timepoint, header.tickRate);
+	auto* pendingTick = receivePacket(header.timepoint, header.packetIndex, header.packetsCount);
+	if(!pendingTick)
+	{
+		return 0;
+	}
+	auto& decoded = pendingTick->decoded;
+	const char* in = datagram + sizeof(Update::Code) + sizeof(header);
+	for(uint64_t i=0; i<header.controllersCount; i++)
+	{
+		Update::ControllerData controller;
+		std::memcpy(&controller, in, sizeof(controller));
+		in += sizeof(controller);
+		decoded.ids.push_back(controller.id);
+		decoded.states.push_back(controller.desiredState);
+	}
+	if(pendingTick->receivedCount < pendingTick->packetsCount)
+	{
+		return 0;
+	}
+	
+	WorldSnapshot snapshot = std::move(decoded);
+	snapshot.tick = header.timepoint;
+	sortById(snapshot.ids, snapshot.states);
+	pending.erase(header.timepoint);
+	newestCompleteTick = std::max(newestCompleteTick, header.timepoint);
+	dropOldTicks();
+	
+	jitterBuffer.push(std::move(snapshot));
+	return header.timepoint;
+}
+
+uint64_t HostStateReceiver::receiveDeltaUpdate(const char* datagram, const size_t size)
+{
+	namespace Update = data::UpdateHostStateDelta;
+	
+	Update::Header header;
+	if(size < sizeof(Update::Code) + sizeof(header))
+	{
+		return 0;
+	}
+	std::memcpy(&header, datagram + sizeof(Update::Code), sizeof(header));
+	// In 64 bits, as rounding a bitsCount close to the maximum up to whole bytes would wrap in 32 bits
+	if(size - sizeof(Update::Code) - sizeof(header) != (uint64_t(header.bitsCount) + 7) / 8)
+	{
+		return 0;
+	}
+	
+	std::lock_guard lock{mutex};
+	followWorld(header.worldId, header.timepoint, header.tickRate);
+	
+	// Without the baseline the packet cannot be decoded. The server moves on to a newer one, once newer ticks are acknowledged
+	const data::codec::Snapshot* baseline = nullptr;
+	if(header.baseline != 0)
+	{
+		const auto it = baselines.find(header.baseline);
+		if(it == baselines.end())
+		{
+			return 0;
+		}
+		baseline = &it->second;
+	}
+	
+	auto* pendingTick = receivePacket(header.timepoint, header.packetIndex, header.packetsCount);
+	if(!pendingTick)
+	{
+		return 0;
+	}
+	std::copy(header.steps, header.steps + 3, pendingTick->steps);
+	
+	auto& quantized = pendingTick->quantized;
+	data::codec::BitReader reader(datagram + sizeof(Update::Code) + sizeof(header), header.bitsCount);
+	const bool valid = data::codec::readEntries(reader, header.controllersCount, baseline, [&quantized](const data::IdType id, const data::codec::QuantizedState& state){
+		quantized.ids.push_back(id);
+		quantized.states.push_back(state);
+	});
+	if(!valid)
+	{
+		pending.erase(header.timepoint);
+		return 0;
+	}
+	if(pendingTick->receivedCount < pendingTick->packetsCount)
+	{
+		return 0;
+	}
+	
+	data::codec::Quantization quantization;
+	quantization.positionStep = pendingTick->steps[0];
+	quantization.orientationStep = pendingTick->steps[1];
+	quantization.wheelSpeedStep = pendingTick->steps[2];
+	
+	auto& complete = baselines[header.timepoint];
+	complete = std::move(quantized);
+	complete.tick = header.timepoint;
+	sortById(complete.ids, complete.states);
+	
+	WorldSnapshot snapshot;
+	snapshot.tick = header.timepoint;
+	snapshot.ids = complete.ids;
+	snapshot.states.reserve(complete.states.size());
+	for(const auto& state : complete.states)
+	{
+		snapshot.states.push_back(data::codec::dequantize(state, quantization));
+	}
+	
+	pending.erase(header.timepoint);
+	newestCompleteTick = std::max(newestCompleteTick, header.timepoint);
+	dropOldTicks();
+	
+	jitterBuffer.push(std::move(snapshot));
+	return header.timepoint;
+}
+
+void HostStateReceiver::setServerEndpoint(const asioudp::endpoint& endpoint)
+{
+	std::lock_guard lock{mutex};
+	serverEndpoint = endpoint;
+}
+
+asioudp::endpoint HostStateReceiver::getServerEndpoint()
+{
+	std::lock_guard lock{mutex};
+	return serverEndpoint;
+}
+
+void HostStateReceiver::clear()
+{
+	std::lock_guard lock{mutex};
+	reset();
+	worldId = 0;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Imported.hpp"
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+
+
+// State of all controllers of the world at a single tick, sorted by id
+struct WorldSnapshot
+{
+	uint64_t tick = 0;
+	std::vector<data::IdType> ids;
+	std::vector<data::Controller::DesiredState> states;
+	
+	// Returns nullptr if there is no such controller
+	const data::Controller::DesiredState* find(const data::IdType id) const;
+};
+
+// Holds recent snapshots of the world, and samples them at render time, somewhat in the past, so that
+// the state shown is interpolated between two snapshots that already arrived, no matter how unevenly they arrive.
+// Snapshots are placed on the local timeline by their tick. The earliest arrivals define when each tick is due,
+// and the render time lags behind by a delay, which follows the measured jitter of arrivals.
+// When the next snapshot is late anyway, the state is extrapolated from the last two, but only for a bounded time
+class JitterBuffer
+{
+public:
+	
+	using Clock = std::chrono::steady_clock;
+	
+	struct Settings
+	{
+		double jitterMultiplier = 3; // delay covers this many mean deviations of arrival times, on top of a single tick
+		Clock::duration minDelay = std::chrono::milliseconds(0);
+		Clock::duration maxDelay = std::chrono::milliseconds(250);
+		Clock::duration maxExtrapolation = std::chrono::milliseconds(100);
+		size_t capacity = 64; // snapshots
+	};
+	
+private:
+	
+	// Fraction of the measured value, that the estimates move by with each arrival
+	static constexpr double JitterGain = 1.0 / 16;
+	static constexpr double DriftGain = 1.0 / 512;
+	
+	// How fast the delay follows its target, relative to the render time passing, so that changes of the delay do not make the state jump
+	static constexpr double DelayAdjustmentRate = 0.1;
+	
+	mutable std::mutex mutex;
+	Settings settings;
+	uint32_t tickRate = 60; // of the world, ticks per second, as sent with its state
+	std::deque<WorldSnapshot> snapshots; // by tick
+	
+	// All in nanoseconds. Tick t is due at clockOffset + t * period, on the steady clock
+	bool timelineStarted = false;
+	double clockOffset = 0;
+	double jitter = 0;
+	double delay = 0;
+	double targetDelay = 0;
+	double lastRenderTime = 0;
+	
+	double getPeriod() const { return 1e9 / tickRate; }
+	
+	// State at a render position is base + (other - base) * alpha, for controllers present in base.
+	// Other is the next snapshot when interpolating, and the one before base when extrapolating past the newest one
+	struct Position
+	{
+		const WorldSnapshot* base = nullptr;
+		const WorldSnapshot* other = nullptr;
+		float alpha = 0;
+	};
+	
+	// Moves the delay towards its target, and returns the render position, in ticks
+	double advanceRenderTick(const Clock::time_point renderTime);
+	Position locate(const double renderTick) const;
+	
+public:
+	
+	void setSettings(const Settings& newSettings);
+	void setTickRate(const uint32_t newTickRate);
+	
+	// Takes a complete snapshot, that arrived at given time. Snapshots may come in any order
+	void push(WorldSnapshot&& snapshot, const Clock::time_point arrival = Clock::now());
+	
+	// Interpolated state of the controller at render time. Returns false if there is no such controller in the buffer
+	bool sample(const data::IdType id, data::Controller::DesiredState& state, const Clock::time_point renderTime = Clock::now());
+	
+	// Interpolated state of every controller present in the buffer at render time, written to ids and states, up to capacity of them.
+	// Returns the number of controllers written
+	size_t sampleAll(data::IdType* ids, data::Controller::DesiredState* states, const size_t capacity, const Clock::time_point renderTime = Clock::now());
+	
+	Clock::duration getDelay() const;
+	Clock::duration getJitter() const;
+	
+	void clear();
+};
+
+// Assembles the state sent by the world every tick, from the packets of UpdateHostState or UpdateHostStateDelta,
+// and passes each complete tick to the jitter buffer. Delta encoded ticks are decoded relative to earlier complete ones,
+// and once complete, they are acknowledged to the server, so that it can use them as baselines
+class HostStateReceiver
+{
+	// Incomplete ticks older than the newest complete one by more than that are dropped.
+	// A tick older by more than that, even when complete, means that the world was started again
+	static constexpr uint64_t MaxPendingTicks = 16;
+	
+	// Complete ticks kept as baselines. The server stops using a baseline after 32 ticks by default
+	static constexpr size_t MaxBaselines = 64;
+	
+	struct PendingTick
+	{
+		uint16_t packetsCount = 0;
+		std::vector<bool> received;
+		size_t receivedCount = 0;
+		data::Vector3f steps = {};
+		
+		// Only one of these is used, depending on the kind of the update
+		data::codec::Snapshot quantized;
+		WorldSnapshot decoded;
+	};
+	
+	std::mutex mutex;
+	std::map<uint64_t, PendingTick> pending;
+	std::map<uint64_t, data::codec::Snapshot> baselines;
+	uint64_t newestCompleteTick = 0;
+	data::IdType worldId = 0;
+	
+	asioudp::endpoint serverEndpoint;
+	
+	JitterBuffer jitterBuffer;
+	
+	// Returns the pending tick for the packet, or nullptr if the packet is too old or was already received
+	PendingTick* receivePacket(const uint64_t tick, const uint16_t packetIndex, const uint16_t packetsCount);
+	void dropOldTicks();
+	
+	// Starts over, when the packet comes from another world than the previous ones, or from the same world started again
+	void followWorld(const data::IdType packetWorldId, const uint64_t tick, const uint32_t tickRate);
+	void reset();
+	
+public:
+	
+	// Both return the tick that has just been completed, or 0 if none was
+	uint64_t receiveUpdate(const char* datagram, const size_t size);
+	uint64_t receiveDeltaUpdate(const char* datagram, const size_t size);
+	
+	// Acknowledgements are sent to the UDP endpoint of the server
+	void setServerEndpoint(const asioudp::endpoint& endpoint);
+	asioudp::endpoint getServerEndpoint();
+	
+	JitterBuffer& getJitterBuffer() { return jitterBuffer; }
+	
+	// Drops everything received, for example when connecting to another server
+	void clear();
+};
+
+extern HostStateReceiver hostStateReceiver;
@@ -4,3 +4,4 @@
 #include "../WozekServer/Datagrams.hpp"
 #include "../WozekServer/segmentedFileTransfer.hpp"
 #include "../WozekServer/states.hpp"
+#include "../WozekServer/stateCodec.hpp"
@@ -12,6 +12,8 @@ namespace test_dll
         public delegate void EchoCallbackDelegate  	(IntPtr data, UInt32 size);
         public delegate void ErrorCallbackDelegate 	();
         public delegate void LookupCallbackDelegate	(Int32 id);
+        public delegate void BulkLookupCallbackDelegate	(IntPtr ids, Int32 count);
+        public delegate void ResultCallbackDelegate	(bool success);
 
         // Available functions: 
 
@@ -83,5 +85,31 @@ namespace test_dll
 		
         [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
 		public static extern void sendTcpLookupIdForName( IntPtr handle, IntPtr name, UInt32 nameLength);
+		
+		// Sends TCP name lookup for many names at once. Names are passed concatenated, with their lengths in a separate array
+		// Callback is executed with the array of ids (0 - name dosen't exist) and its length, or with null and -1 on error
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern void setTcpBulkLookupIdForNameCallback( IntPtr handle, IntPtr callback);
+		
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern void sendTcpBulkLookupIdForName( IntPtr handle, IntPtr names, UInt32[] nameLengths, UInt32 namesCount);
+		
+		// Uploads the file at sourcePath to the server, where it is stored under fileName (letters, digits, '.' and '_' only).
+		// Callback is executed with true once the server has stored the whole file, or with false on error
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern void setTcpUploadFileCallback( IntPtr handle, IntPtr callback);
+		
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern void sendTcpUploadFile( IntPtr handle, string sourcePath, string fileName);
+		
+		// State of the world is sampled at render time, interpolated between received ticks. A state is 7 floats: position (3), orientation (2), wheel speed (2)
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern bool sampleControllerState( IntPtr handle, UInt32 id, float[] state);
+		
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern UInt32 sampleWorldState( IntPtr handle, UInt32[] ids, float[] states, UInt32 capacity);
+		
+        [DllImport("WozekHostClient.dll", CallingConvention = CallingConvention.StdCall)]
+		public static extern float getStateBufferDelay( IntPtr handle);
     }
 }
@@ -36,6 +36,7 @@ public:
 		
 		udpServer.start(0);
 		udpSender.connect(asioudp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 8081));
+		hostStateReceiver.setServerEndpoint(asioudp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 8081));
 	}
 	
 	void start()
@@ -145,6 +146,7 @@ public:
 		}
 		else
 		{
+			hostStateReceiver.setServerEndpoint(endpoint);
 			std::cout << "Setting the endpoint succeded. (" << endpoint << ")\n";
 		}
 		
@@ -50,6 +50,8 @@ EXPORT bool connectToServer(Handle* handle, const char* address, const char* por
 	{
 		return false;
 	}
+	hostStateReceiver.clear();
+	hostStateReceiver.setServerEndpoint(endpoint);
 	
 	if(!handle->udpServer.start(0))
 	{
@@ -144,6 +146,61 @@ EXPORT void sendTcpLookupIdForName( Handle* handle, const char* name, const uint
 	handle->tcpConnection.performLookupIdForNameRequest(name);
 }
 
+EXPORT void setTcpBulkLookupIdForNameCallback( Handle* handle, Handle::BulkLookupCallback callback )
+{
+	handle->tcpBulkLookupIdForNameCallback = callback;
+}
+EXPORT void sendTcpBulkLookupIdForName( Handle* handle, const char* names, const uint32_t* nameLengths, const uint32_t namesCount)
+{
+	std::vector<std::string> v;
+	v.reserve(namesCount);
+	for(uint32_t i=0; i<namesCount; i++)
+	{
+		v.emplace_back(names, nameLengths[i]);
+		names += nameLengths[i];
+	}
+	
+	handle->tcpConnection.pushCallbackStack([handle](CallbackResult::Ptr result){
+		if (result->status != CallbackResult::Status::Good) {
+			handle->tcpBulkLookupIdForNameCallback(nullptr, -1);
+		} else {
+			auto valueResult = dynamic_cast< ValueCallbackResult<std::vector<uint32_t>>* >(result.get());
+			handle->tcpBulkLookupIdForNameCallback(valueResult->value.data(), valueResult->value.size());
+		}
+	});
+	handle->tcpConnection.performBulkLookupIdForNameRequest(v);
+}
+
+EXPORT void setTcpUploadFileCallback( Handle* handle, Handle::ResultCallback callback )
+{
+	handle->tcpUploadFileCallback = callback;
+}
+EXPORT void sendTcpUploadFile( Handle* handle, const char* sourcePath, const char* fileName)
+{
+	handle->tcpConnection.pushCallbackStack([handle](CallbackResult::Ptr result){
+		handle->tcpUploadFileCallback(result->status == CallbackResult::Status::Good);
+	});
+	handle->tcpConnection.performUploadFileRequest(sourcePath, fileName);
+}
+
+EXPORT bool sampleControllerState( Handle* handle, const data::IdType id, float* state)
+{
+	data::Controller::DesiredState sampled;
+	if(!hostStateReceiver.getJitterBuffer().sample(id, sampled))
+	{
+		return false;
+	}
+	std::memcpy(state, &sampled, sizeof(sampled));
+	return true;
+}
+EXPORT uint32_t sampleWorldState( Handle* handle, data::IdType* ids, float* states, const uint32_t capacity)
+{
+	return hostStateReceiver.getJitterBuffer().sampleAll(ids, reinterpret_cast<data::Controller::DesiredState*>(states), capacity);
+}
+EXPORT float getStateBufferDelay( Handle* handle)
+{
+	return std::chrono::duration<float, std::milli>(hostStateReceiver.getJitterBuffer().getDelay()).count();
+}
 
 
 /*
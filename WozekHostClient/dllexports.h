@@ -4,6 +4,7 @@
 #include "Imported.hpp"
 #include "ClientTCP.hpp"
 #include "ClientUDP.hpp"
+#include "HostState.hpp"
 
 #define EXPORT extern "C" __declspec(dllexport) __stdcall
 
@@ -11,6 +12,8 @@
 static __stdcall void NOOP_echo   (const char*, const uint32_t) {}
 static __stdcall void NOOP_error  () {}
 static __stdcall void NOOP_lookup (const int32_t) {}
+static __stdcall void NOOP_bulkLookup (const uint32_t*, const int32_t) {}
+static __stdcall void NOOP_result (const bool) {}
 
 struct Handle
 {
@@ -23,17 +26,22 @@ struct Handle
 	using EchoCallback   = decltype(&NOOP_echo);
 	using ErrorCallback  = decltype(&NOOP_error);
 	using LookupCallback = decltype(&NOOP_lookup);
+	using BulkLookupCallback = decltype(&NOOP_bulkLookup);
+	using ResultCallback = decltype(&NOOP_result);
 	
 	EchoCallback  	tcpEchoCallback;
 	EchoCallback  	udpEchoCallback;
 	ErrorCallback 	udpUpdateStateErrorCallback;
 	LookupCallback 	tcpLookupIdForNameCallback;
+	BulkLookupCallback tcpBulkLookupIdForNameCallback;
+	ResultCallback tcpUploadFileCallback;
 	
 	asio::executor_work_guard<asio::io_context::executor_type> work;
 	
 	Handle()
 		: ioContext(), tcpConnection(this->ioContext), udpServer(this->ioContext), udpSender(this->ioContext, udpServer.getSocket()),
 			tcpEchoCallback(&NOOP_echo), udpEchoCallback(&NOOP_echo), udpUpdateStateErrorCallback(&NOOP_error), tcpLookupIdForNameCallback(&NOOP_lookup),
+			tcpBulkLookupIdForNameCallback(&NOOP_bulkLookup), tcpUploadFileCallback(&NOOP_result),
 			work(ioContext.get_executor())
 	{
 		AsioAsync::setGlobalAsioContext(ioContext);
@@ -86,6 +94,27 @@ static_assert(std::is_same_v<  data::RotationType, uint8_t   >);
 EXPORT void setTcpLookupIdForNameCallback( Handle* handle, Handle::LookupCallback callback);
 EXPORT void sendTcpLookupIdForName( Handle* handle, const char* name, const uint32_t nameLength);
 
+// Sends TCP name lookup for many names at once. Names are passed concatenated, with their lengths in a separate array
+// Callback is executed with the array of ids (0 - name dosen't exist) and its length, or with null and -1 on error
+EXPORT void setTcpBulkLookupIdForNameCallback( Handle* handle, Handle::BulkLookupCallback callback);
+EXPORT void sendTcpBulkLookupIdForName( Handle* handle, const char* names, const uint32_t* nameLengths, const uint32_t namesCount);
+
+// Uploads the file at sourcePath to the server, where it is stored under fileName (letters, digits, '.' and '_' only).
+// Callback is executed with true once the server has stored the whole file, or with false on error
+EXPORT void setTcpUploadFileCallback( Handle* handle, Handle::ResultCallback callback);
+EXPORT void sendTcpUploadFile( Handle* handle, const char* sourcePath, const char* fileName);
+
+// State of the world, sent by the server every tick, is kept in a jitter buffer, and sampled at render time.
+// The state shown is slightly in the past, interpolated between received ticks, and the delay adapts to the measured jitter of the network.
+// If the next tick is late anyway, the state is extrapolated, for at most 100ms.
+// Ticks are placed on the timeline by the tick rate of the world, which comes with the state.
+// A state is 7 floats: position (x, y, z), orientation (2) and wheel speed (2)
+EXPORT bool sampleControllerState( Handle* handle, const data::IdType id, float* state); // Returns false if there is no such controller in the world
+EXPORT uint32_t sampleWorldState( Handle* handle, data::IdType* ids, float* states, const uint32_t capacity); // Fills up to capacity ids and states of controllers. Returns their count
+EXPORT float getStateBufferDelay( Handle* handle); // Current delay of the render time, in milliseconds
+
+static_assert(sizeof(data::Controller::DesiredState) == 7 * sizeof(float));
+
 
 /// DOCS END
 
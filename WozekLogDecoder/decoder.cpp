@@ -0,0 +1,43 @@
+#include "binaryLog.hpp"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Turns binary output logs of the server (see binaryLog.hpp) back into the text, the server would have written
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		std::cout << "Use the parameters [binary_log_file] [-t (optional, prefix lines with seconds since the start of the session)]";
+		return 0;
+	}
+	
+	const std::string path = argv[1];
+	const bool timestamps = argc > 2 && std::string(argv[2]) == "-t";
+	
+	std::ifstream file(path, std::ios::binary);
+	if(!file.is_open())
+	{
+		std::cerr << "Cannot open " << path << '\n';
+		return 1;
+	}
+	const std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	
+	std::ios::sync_with_stdio(false);
+	binlog::Decoder decoder(data.data(), data.size());
+	while(decoder.next(std::cout, timestamps))
+	{
+	}
+	std::cout.flush();
+	
+	// Last record can be cut short, when the server was killed while writing it
+	if(!decoder.isAtEnd())
+	{
+		std::cerr << "Decoding stopped at byte " << decoder.getPosition() << " of " << data.size() << ", data is invalid or truncated\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,302 @@
+#include "trafficCapture.hpp"
+#include <iostream>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// Replays traffic captured by the server (see trafficCapture.hpp) against a running server, keeping the original timing,
+// scaled by the speed, or as fast as possible. Each captured UDP sender and TCP connection gets its own socket,
+// so the server sees as many clients as there were. Responses of the server are read and counted, but not checked
+
+using Clock = std::chrono::steady_clock;
+
+// Data queued for a connection, above which reading of the capture waits for the server, when replaying at maximum speed
+constexpr size_t MaxQueuedBytes = 16 * 1024 * 1024;
+
+// How long responses are still read, after the last record was replayed
+constexpr auto DrainDuration = std::chrono::seconds(1);
+
+struct Statistics
+{
+	uint64_t records = 0;
+	uint64_t bytesSent = 0;
+	uint64_t bytesReceived = 0;
+	uint64_t datagramsReceived = 0;
+	uint64_t errors = 0;
+
+	Clock::duration maxLag = Clock::duration::zero();
+	Clock::duration totalLag = Clock::duration::zero();
+};
+
+Statistics statistics;
+size_t queuedBytes = 0;
+
+class UdpSource
+{
+	asioudp::socket socket;
+	std::array<char, 1 << 16> receiveBuffer;
+	asioudp::endpoint sender;
+
+	void awaitResponse()
+	{
+		socket.async_receive_from(asio::buffer(receiveBuffer), sender, [this](const Error& err, const size_t length){
+			if(err)
+				return;
+			statistics.datagramsReceived++;
+			statistics.bytesReceived += length;
+			awaitResponse();
+		});
+	}
+
+public:
+
+	void send(const asioudp::endpoint& server, const std::vector<char>& data)
+	{
+		Error err;
+		socket.send_to(asio::buffer(data), server, 0, err);
+		if(err)
+			statistics.errors++;
+		else
+			statistics.bytesSent += data.size();
+	}
+
+	void close()
+	{
+		Error err;
+		socket.close(err);
+	}
+
+	UdpSource(asio::io_context& ioContext)
+		: socket(ioContext, asioudp::endpoint(asioudp::v4(), 0))
+	{
+		awaitResponse();
+	}
+};
+
+class TcpConnection : public std::enable_shared_from_this<TcpConnection>
+{
+	asiotcp::socket socket;
+	std::array<char, 1 << 16> receiveBuffer;
+
+	bool connected = false;
+	bool writing = false;
+	bool closeRequested = false;
+	bool failed = false;
+	std::deque<std::vector<char>> queue;
+	
+	// Drops the queued data, and everything sent later
+	void fail()
+	{
+		failed = true;
+		statistics.errors++;
+		for(const auto& data : queue)
+			queuedBytes -= data.size();
+		queue.clear();
+	}
+
+	void awaitResponse()
+	{
+		socket.async_read_some(asio::buffer(receiveBuffer), [this, me = shared_from_this()](const Error& err, const size_t length){
+			if(err)
+				return;
+			statistics.bytesReceived += length;
+			awaitResponse();
+		});
+	}
+
+	void writeNext()
+	{
+		if(!connected || writing)
+			return;
+		if(queue.empty())
+		{
+			if(closeRequested)
+			{
+				Error err;
+				socket.shutdown(asiotcp::socket::shutdown_send, err);
+			}
+			return;
+		}
+		writing = true;
+		asio::async_write(socket, asio::buffer(queue.front()), [this, me = shared_from_this()](const Error& err, const size_t length){
+			writing = false;
+			if(err)
+			{
+				fail();
+				return;
+			}
+			queuedBytes -= queue.front().size();
+			queue.pop_front();
+			statistics.bytesSent += length;
+			writeNext();
+		});
+	}
+
+public:
+
+	void connect(const asiotcp::endpoint& server)
+	{
+		socket.async_connect(server, [this, server, me = shared_from_this()](const Error& err){
+			if(err)
+			{
+				std::cout << "Cannot connect to " << server << ": " << err << '\n';
+				fail();
+				return;
+			}
+			connected = true;
+			awaitResponse();
+			writeNext();
+		});
+	}
+
+	void send(std::vector<char>&& data)
+	{
+		if(failed)
+			return;
+		queuedBytes += data.size();
+		queue.emplace_back(std::move(data));
+		writeNext();
+	}
+
+	// Closes the sending side, once everything queued is written
+	void close()
+	{
+		closeRequested = true;
+		writeNext();
+	}
+
+	void abort()
+	{
+		Error err;
+		socket.close(err);
+	}
+
+	TcpConnection(asio::io_context& ioContext)
+		: socket(ioContext)
+	{}
+};
+
+int main(int argc, char** argv)
+{
+	if(argc < 5)
+	{
+		std::cout << "Use the parameters [capture_file] [address] [port] [speed (1 for real time, N for N times faster, 0 for as fast as possible)]";
+		return 0;
+	}
+
+	const std::string capturePath = argv[1];
+	const std::string address = argv[2];
+	const unsigned short port = std::atoi(argv[3]);
+	const double speed = std::atof(argv[4]);
+
+	capture::Reader reader;
+	if(!reader.open(capturePath))
+	{
+		std::cout << "Cannot open capture file " << capturePath << '\n';
+		return 0;
+	}
+
+	Error err;
+	const asio::ip::address serverAddress = asio::ip::make_address(address, err);
+	if(err)
+	{
+		std::cout << "Invalid address " << address << ": " << err << '\n';
+		return 0;
+	}
+	const asioudp::endpoint udpServer(serverAddress, port);
+	const asiotcp::endpoint tcpServer(serverAddress, port);
+
+	asio::io_context ioContext;
+	auto work = asio::make_work_guard(ioContext);
+
+	std::map<uint32_t, std::unique_ptr<UdpSource>> udpSources;
+	std::map<uint32_t, std::shared_ptr<TcpConnection>> tcpConnections;
+
+	capture::RecordHeader record;
+	std::vector<char> data;
+	const Clock::time_point start = Clock::now();
+
+	while(reader.next(record, data))
+	{
+		if(speed > 0)
+		{
+			const Clock::time_point due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(record.timestamp) / speed);
+			ioContext.run_until(due);
+			const Clock::duration lag = Clock::now() - due;
+			statistics.maxLag = std::max(statistics.maxLag, lag);
+			statistics.totalLag += lag;
+		}
+		else
+		{
+			ioContext.poll();
+			while(queuedBytes > MaxQueuedBytes)
+				ioContext.run_one();
+		}
+		statistics.records++;
+
+		switch(record.type)
+		{
+		case capture::RecordType::UdpDatagram:
+			{
+				auto& source = udpSources[record.source];
+				if(!source)
+					source = std::make_unique<UdpSource>(ioContext);
+				source->send(udpServer, data);
+			}
+			break;
+		case capture::RecordType::TcpOpened:
+			{
+				auto& connection = tcpConnections[record.source];
+				connection = std::make_shared<TcpConnection>(ioContext);
+				connection->connect(tcpServer);
+			}
+			break;
+		case capture::RecordType::TcpData:
+			if(const auto it = tcpConnections.find(record.source); it != tcpConnections.end())
+				it->second->send(std::move(data));
+			break;
+		case capture::RecordType::TcpClosed:
+			if(const auto it = tcpConnections.find(record.source); it != tcpConnections.end())
+			{
+				it->second->close();
+			}
+			break;
+		default:
+			std::cout << "Unknown record type " << int(record.type) << ", at record " << statistics.records << '\n';
+			statistics.errors++;
+			break;
+		}
+	}
+	const Clock::duration duration = Clock::now() - start;
+
+	for(auto& [source, connection] : tcpConnections)
+		connection->close();
+	ioContext.run_for(DrainDuration);
+
+	for(auto& [source, udpSource] : udpSources)
+		udpSource->close();
+	for(auto& [source, connection] : tcpConnections)
+		connection->abort();
+	work.reset();
+	ioContext.run();
+
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+	const double seconds = std::chrono::duration<double>(duration).count();
+	std::cout << "Replayed " << statistics.records << " records, " << statistics.bytesSent << " bytes in " << seconds << " s ("
+			  << (seconds > 0 ? statistics.records / seconds : 0) << " records/s) from "
+			  << udpSources.size() << " UDP senders\n";
+	std::cout << "Received " << statistics.datagramsReceived << " datagrams, " << statistics.bytesReceived << " bytes in total, with "
+			  << statistics.errors << " errors\n";
+	if(speed > 0 && statistics.records > 0)
+	{
+		std::cout << "Lag behind the capture timing: max " << Milliseconds(statistics.maxLag).count() << " ms, mean "
+				  << Milliseconds(statistics.totalLag).count() / statistics.records << " ms\n";
+	}
+
+	return 0;
+}
@@ -8,6 +8,19 @@
 #include <atomic>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <queue>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <map>
 
 #include "Datagrams.hpp"
 
@@ -17,140 +30,886 @@ namespace db
 using IdType = data::IdType;
 
 
-template <int IdSlots, typename RecordT, typename IdT = IdType>
+// Table of records, addressed directly by id.
+// Records are stored in fixed-size pages, allocated as the table grows. Pages never move,
+// so references to records stay valid for the whole lifetime of the table.
+// Access to records is synchronized with a fixed set of striped locks, instead of a lock per record.
+// Slots of erased records are reused, lowest first, so the table stays dense under churn.
+// An id is made of the slot number (low bits) and the generation of the slot (high bits). The generation is
+// incremented whenever a record is erased, so the id of an erased record never aliases the record reusing its slot.
+// A slot whose generation cannot be incremented any more is retired, instead of wrapping around to ids handed out before
+template <typename RecordT, typename IdT = IdType>
 class TableBase
 {
+public:
+	
+	static constexpr size_t PageSizeLog2 = 10;
+	static constexpr size_t PageSize = size_t(1) << PageSizeLog2;
+	static constexpr size_t MaxPagesLog2 = 14;
+	static constexpr size_t MaxPages = size_t(1) << MaxPagesLog2;
+	static constexpr size_t StripesCount = 64;
+	
+	static constexpr size_t SlotBits = PageSizeLog2 + MaxPagesLog2;
+	static constexpr IdT MaxSlot = PageSize * MaxPages - 1;
+	static constexpr IdT GenerationMask = IdT(~IdT(0)) >> SlotBits;
+	
+	static_assert(sizeof(IdT) * 8 > SlotBits);
+	
+	static IdT getSlotNumber(const IdT id) { return id & MaxSlot; }
+	static IdT getGeneration(const IdT id) { return id >> SlotBits; }
+	static IdT makeId(const IdT slotNumber, const IdT generation) { return (generation << SlotBits) | slotNumber; }
+	
+private:
+	
 	//static_assert(std::is_trivially_destructible_v<RecordT>);
 	
-	asio::io_context::strand strand;
+	struct Slot
+	{
+		RecordT record;
+		bool exists = false;
+		IdT generation = 0;
+	};
+	
+	struct Page
+	{
+		std::array<Slot, PageSize> slots;
+	};
+	
+	struct alignas(64) Stripe
+	{
+		std::shared_mutex shared_mutex;
+	};
+	
+	std::array<std::atomic<Page*>, MaxPages> pages = {};
+	std::mutex growMutex;
+	
+	std::array<Stripe, StripesCount> stripes;
 	
 	std::atomic<IdT> lastFreeIndex = 1;
 	
-	auto getNextIndex()
+	std::mutex freeSlotsMutex;
+	std::priority_queue<IdT, std::vector<IdT>, std::greater<IdT>> freeSlots;
+	
+	// Record of the last generation of the slot was erased, so the slot is never reused
+	static bool isRetired(const Slot& slot) { return !slot.exists && slot.generation == GenerationMask; }
+	
+	// Returns the slot number, or 0 if the table is full
+	IdT allocateSlot()
 	{
-		auto newIndex = lastFreeIndex.fetch_add(1, std::memory_order::memory_order_relaxed);
-		assert(newIndex <= IdSlots);
+		{
+			std::lock_guard lock{freeSlotsMutex};
+			if(!freeSlots.empty())
+			{
+				const auto slotNumber = freeSlots.top();
+				freeSlots.pop();
+				return slotNumber;
+			}
+		}
+		
+		auto newIndex = lastFreeIndex.load(std::memory_order_relaxed);
+		do
+		{
+			if(newIndex > MaxSlot)
+			{
+				return 0;
+			}
+		}
+		while(!lastFreeIndex.compare_exchange_weak(newIndex, newIndex + 1, std::memory_order_relaxed));
 		
 		return newIndex;
 	}
 	
-public:
+	void releaseSlot(const IdT slotNumber)
+	{
+		std::lock_guard lock{freeSlotsMutex};
+		freeSlots.push(slotNumber);
+	}
 	
-	struct MutexedRecord
+	// Ids handed out later have to be in slots after this one
+	void markSlotUsed(const IdT slotNumber)
 	{
-		std::unique_ptr<RecordT> data;
-		std::shared_mutex shared_mutex;
-	};
+		auto nextIndex = lastFreeIndex.load(std::memory_order_relaxed);
+		while(nextIndex <= slotNumber && !lastFreeIndex.compare_exchange_weak(nextIndex, slotNumber + 1, std::memory_order_relaxed))
+		{}
+	}
 	
-	std::array<MutexedRecord, IdSlots + 1 > records;
+	static size_t getPageIndex(const IdT id) { return getSlotNumber(id) >> PageSizeLog2; }
+	static size_t getSlotIndex(const IdT id) { return getSlotNumber(id) & (PageSize - 1); }
 	
-	MutexedRecord& getMutexedRecordById(const IdT id)
+	Page* getPage(const IdT id)
 	{
-		assert(id < records.size() && id != 0);
-		return records[id];
+		if(getSlotNumber(id) == 0)
+		{
+			return nullptr;
+		}
+		return pages[getPageIndex(id)].load(std::memory_order_acquire);
+	}
+	
+	Page* getOrCreatePage(const IdT id)
+	{
+		if(auto page = getPage(id))
+		{
+			return page;
+		}
+		
+		std::lock_guard lock{growMutex};
+		auto& pagePtr = pages[getPageIndex(id)];
+		if(auto page = pagePtr.load(std::memory_order_relaxed))
+		{
+			return page;
+		}
+		auto page = new Page;
+		pagePtr.store(page, std::memory_order_release);
+		return page;
 	}
 	
-	auto createNewRecord()
+	Slot* getSlot(const IdT id)
 	{
-		const auto id = getNextIndex();
-		records[id].data.reset(new RecordT);
+		auto page = getPage(id);
+		return page ? &page->slots[getSlotIndex(id)] : nullptr;
+	}
+	
+	static bool isCurrent(const Slot& slot, const IdT id)
+	{
+		return slot.exists && slot.generation == getGeneration(id);
+	}
+	
+public:
+	
+	std::shared_mutex& getStripeMutex(const IdT id) { return stripes[getSlotNumber(id) % StripesCount].shared_mutex; }
+	
+	// Returns 0 if the table is full
+	IdT createNewRecord()
+	{
+		return createNewRecord([](IdT, RecordT*){});
+	}
+	
+	// Callback, called as callback(IdT id, RecordT* record), fills the new record before any other thread can access it.
+	// Returns 0 if the table is full
+	template<typename Callback>
+	IdT createNewRecord(Callback&& callback)
+	{
+		static_assert(std::is_invocable_v<Callback, IdT, RecordT*>);
+		
+		const auto slotNumber = allocateSlot();
+		if(slotNumber == 0)
+		{
+			return 0;
+		}
+		
+		auto& slot = getOrCreatePage(slotNumber)->slots[getSlotIndex(slotNumber)];
+		
+		std::unique_lock lock{ getStripeMutex(slotNumber) };
+		const auto id = makeId(slotNumber, slot.generation);
+		slot.record = RecordT();
+		slot.exists = true;
+		callback(id, &slot.record);
 		return id;
 	}
 	
+	// Callback receives nullptr, if the record dosen't exist
 	template<typename Callback>
 	auto accessSafeRead(const IdT id, Callback&& callback)
 	{
 		static_assert(std::is_invocable_v<Callback, const RecordT*>);
 		
-		std::shared_lock lock{ getMutexedRecordById(id).shared_mutex };
-		return callback(getMutexedRecordById(id).data.get());
+		auto slot = getSlot(id);
+		if(!slot)
+		{
+			return callback(static_cast<const RecordT*>(nullptr));
+		}
+		
+		std::shared_lock lock{ getStripeMutex(id) };
+		return callback(isCurrent(*slot, id) ? static_cast<const RecordT*>(&slot->record) : nullptr);
 	}
+	// Callback receives nullptr, if the record dosen't exist
 	template<typename Callback>
 	auto accessSafeWrite(const IdT id, Callback&& callback)
 	{
 		static_assert(std::is_invocable_v<Callback, RecordT*>);
 		
-		std::unique_lock lock{ getMutexedRecordById(id).shared_mutex };
-		return callback(getMutexedRecordById(id).data.get());
+		auto slot = getSlot(id);
+		if(!slot)
+		{
+			return callback(static_cast<RecordT*>(nullptr));
+		}
+		
+		std::unique_lock lock{ getStripeMutex(id) };
+		return callback(isCurrent(*slot, id) ? &slot->record : nullptr);
 	}
 	
-	TableBase(asio::io_context& ioContext)
-		: strand(ioContext)
-	{}
+	// Predicate, called as predicate(const RecordT* record) under the record's lock, decides whether the record is erased.
+	// The slot is reused by a later createNewRecord, under the next generation, unless it was the last one. Returns whether the record was erased
+	template<typename Predicate>
+	bool eraseRecordIf(const IdT id, Predicate&& predicate)
+	{
+		static_assert(std::is_invocable_r_v<bool, Predicate, const RecordT*>);
+		
+		auto slot = getSlot(id);
+		if(!slot)
+		{
+			return false;
+		}
+		
+		{
+			std::unique_lock lock{ getStripeMutex(id) };
+			if(!isCurrent(*slot, id) || !predicate(static_cast<const RecordT*>(&slot->record)))
+			{
+				return false;
+			}
+			slot->record = RecordT();
+			slot->exists = false;
+			if(isRetired(*slot))
+			{
+				return true;
+			}
+			slot->generation++;
+		}
+		
+		releaseSlot(getSlotNumber(id));
+		return true;
+	}
+	
+	bool eraseRecord(const IdT id)
+	{
+		return eraseRecordIf(id, [](const RecordT*){ return true; });
+	}
+	
+	// Recreates a record with given id (e.g. when loading a snapshot). Ids handed out later will be in other slots.
+	// Callback fills the record, like in createNewRecord. Returns false if the id is invalid.
+	// Once all records are restored, rebuildFreeSlots has to be called
+	template<typename Callback>
+	bool restoreRecord(const IdT id, Callback&& callback)
+	{
+		static_assert(std::is_invocable_v<Callback, RecordT*>);
+		
+		if(getSlotNumber(id) == 0)
+		{
+			return false;
+		}
+		markSlotUsed(getSlotNumber(id));
+		
+		auto& slot = getOrCreatePage(id)->slots[getSlotIndex(id)];
+		
+		std::unique_lock lock{ getStripeMutex(id) };
+		slot.record = RecordT();
+		slot.exists = true;
+		slot.generation = getGeneration(id);
+		callback(&slot.record);
+		return true;
+	}
+	
+	// Restores the generation of a free slot, as returned by forEachFreeSlot
+	bool restoreFreeSlot(const IdT id)
+	{
+		if(getSlotNumber(id) == 0)
+		{
+			return false;
+		}
+		markSlotUsed(getSlotNumber(id));
+		
+		auto& slot = getOrCreatePage(id)->slots[getSlotIndex(id)];
+		
+		std::unique_lock lock{ getStripeMutex(id) };
+		if(slot.exists)
+		{
+			return false;
+		}
+		slot.generation = getGeneration(id);
+		return true;
+	}
+	
+	// Collects all unused slots below getSlotsEnd, that are not retired, into the free list
+	void rebuildFreeSlots()
+	{
+		std::vector<IdT> unused;
+		const auto slotsEnd = getSlotsEnd();
+		for(IdT slotNumber = 1; slotNumber < slotsEnd; slotNumber++)
+		{
+			auto slot = getSlot(slotNumber);
+			std::shared_lock lock{ getStripeMutex(slotNumber) };
+			if(!slot || (!slot->exists && !isRetired(*slot)))
+			{
+				unused.push_back(slotNumber);
+			}
+		}
+		
+		std::lock_guard lock{freeSlotsMutex};
+		freeSlots = decltype(freeSlots)(std::greater<IdT>(), std::move(unused));
+	}
+	
+	// Calls callback(id, const RecordT&) for every existing record, in order of slots.
+	// Each record is read under its own lock, so records created or changed meanwhile may or may not be visited
+	template<typename Callback>
+	void forEachRecord(Callback&& callback)
+	{
+		static_assert(std::is_invocable_v<Callback, IdT, const RecordT&>);
+		
+		const auto slotsEnd = getSlotsEnd();
+		for(IdT slotNumber = 1; slotNumber < slotsEnd; slotNumber++)
+		{
+			auto slot = getSlot(slotNumber);
+			if(!slot)
+			{
+				// Skip the rest of the unallocated page
+				slotNumber |= PageSize - 1;
+				continue;
+			}
+			
+			std::shared_lock lock{ getStripeMutex(slotNumber) };
+			if(slot->exists)
+			{
+				callback(makeId(slotNumber, slot->generation), static_cast<const RecordT&>(slot->record));
+			}
+		}
+	}
+	
+	// Calls callback(id) for every free slot, that was used before, with the id it would get when reused.
+	// For a retired slot, it is the id of its last record
+	template<typename Callback>
+	void forEachFreeSlot(Callback&& callback)
+	{
+		static_assert(std::is_invocable_v<Callback, IdT>);
+		
+		const auto slotsEnd = getSlotsEnd();
+		for(IdT slotNumber = 1; slotNumber < slotsEnd; slotNumber++)
+		{
+			auto slot = getSlot(slotNumber);
+			if(!slot)
+			{
+				slotNumber |= PageSize - 1;
+				continue;
+			}
+			
+			std::shared_lock lock{ getStripeMutex(slotNumber) };
+			if(!slot->exists && slot->generation != 0)
+			{
+				callback(makeId(slotNumber, slot->generation));
+			}
+		}
+	}
+	
+	// All slots used so far are lower than this
+	IdT getSlotsEnd() { return std::min<IdT>(lastFreeIndex.load(std::memory_order_relaxed), MaxSlot + 1); }
+	
+	TableBase() {}
+	
+	TableBase(const TableBase&) = delete;
+	
+	~TableBase()
+	{
+		for(auto& page : pages)
+		{
+			delete page.load(std::memory_order_relaxed);
+		}
+	}
 };
 
-template <typename IndexedValueT, typename IdT = IdType>
-class IndexBase
+// Minimal epoch based read-copy-update.
+// Readers only mark the read section in a (sharded) counter, and never block.
+// Writers have to be serialized externally. After unlinking an object, a writer calls synchronize(),
+// which waits until all read sections that could still see the object have ended, before freeing it.
+class ReadCopyUpdate
 {
-	std::optional<asio::io_context::strand> strand;
+	static constexpr size_t Shards = 16;
+	
+	struct alignas(64) Counter
+	{
+		std::atomic<uint64_t> readers = 0;
+	};
 	
-	std::shared_mutex shared_mutex;
+	std::atomic<uint64_t> epoch = 0;
+	std::array<std::array<Counter, Shards>, 2> counters;
 	
-	std::unordered_map<IndexedValueT, IdT> indexMap;
+	static size_t getShard()
+	{
+		static std::atomic<size_t> nextShard = 0;
+		thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % Shards;
+		return shard;
+	}
 	
 public:
 	
-	void setContext(asio::io_context& context) { strand.emplace(context); }
-	bool hasContext() { return strand.has_value(); }
-	auto& getStrand() { return strand.value(); }
-	
-	template<typename Callback>
-	void getSafeCallback(const IndexedValueT& value, Callback&& callback)
+	class ReadSection
 	{
-		asio::post( strand.value(), [this,&callback,value](){
-				auto it = indexMap.find(value);
-				if(it != indexMap.end())
+		Counter* counter;
+		
+	public:
+		
+		ReadSection(ReadCopyUpdate& rcu)
+		{
+			const auto shard = getShard();
+			while(true)
+			{
+				const auto currentEpoch = rcu.epoch.load();
+				counter = &rcu.counters[currentEpoch & 1][shard];
+				counter->readers.fetch_add(1);
+				if(rcu.epoch.load() == currentEpoch)
 				{
-					callback(it->second);
+					break;
 				}
-				callback(0);
-			} );
+				counter->readers.fetch_sub(1);
+			}
+		}
+		
+		ReadSection(const ReadSection&) = delete;
+		
+		~ReadSection()
+		{
+			counter->readers.fetch_sub(1, std::memory_order_release);
+		}
+	};
+	
+	void synchronize()
+	{
+		const auto previousEpoch = epoch.fetch_add(1);
+		for(auto& counter : counters[previousEpoch & 1])
+		{
+			while(counter.readers.load() != 0)
+			{
+				std::this_thread::yield();
+			}
+		}
 	}
+};
+
+// Names kept in sorted order, for prefix and range scans.
+// Scans are much rarer than exact lookups, so a plain sorted map behind a shared lock is enough.
+template <typename IdT = IdType>
+class OrderedNameIndexBase
+{
+	std::shared_mutex mutex;
+	std::map<std::string, IdT, std::less<>> names;
 	
-	IdT get(const IndexedValueT& value)
+public:
+	
+	void set(const IdT id, const std::string_view name)
 	{
-		std::shared_lock lock{shared_mutex};
-		auto it = indexMap.find(value);
-		if(it != indexMap.end())
+		std::unique_lock lock{mutex};
+		auto it = names.lower_bound(name);
+		if(it != names.end() && it->first == name)
 		{
-			return it->second;
+			it->second = id;
+			return;
 		}
-		return 0;
+		names.emplace_hint(it, std::string(name), id);
 	}
 	
-	bool has(const IndexedValueT& value)
+	void erase(const std::string_view name)
 	{
-		std::shared_lock lock{shared_mutex};
-		return indexMap.find(value) != indexMap.end();
+		std::unique_lock lock{mutex};
+		auto it = names.find(name);
+		if(it != names.end())
+		{
+			names.erase(it);
+		}
 	}
 	
-	void set(const IdT id, const IndexedValueT& value)
+	// Calls callback(IdT id, const std::string& name) for at most limit names starting with prefix,
+	// that come after the name given as "after" (all of them, if it is empty), in sorted order.
+	// Returns whether there are more matching names, after the last one visited
+	template<typename Callback>
+	bool scanPrefix(const std::string_view prefix, const std::string_view after, const size_t limit, Callback&& callback)
 	{
-		std::unique_lock lock{shared_mutex};
-		indexMap[value] = id;
+		static_assert(std::is_invocable_v<Callback, IdT, const std::string&>);
+		
+		std::shared_lock lock{mutex};
+		
+		auto it = after.empty() || after < prefix ? names.lower_bound(prefix) : names.upper_bound(after);
+		auto matches = [&]{ return it != names.end() && std::string_view(it->first).substr(0, prefix.size()) == prefix; };
+		
+		for(size_t visited = 0; visited < limit && matches(); ++visited, ++it)
+		{
+			callback(it->second, it->first);
+		}
+		return matches();
 	}
 	
-	IndexBase() {};
-	virtual ~IndexBase(){};
+	size_t size()
+	{
+		std::shared_lock lock{mutex};
+		return names.size();
+	}
 };
 
+// Index of ids by name. Lookups are lock-free and can be done with any string_view, without allocating.
+// Names are kept in an open-addressing hash table of pointers to immutable entries,
+// which is replaced as a whole when it grows (copy-on-write). Writers are serialized with a mutex.
+template <typename IdT = IdType>
+class NameIndexBase
+{
+	struct Entry
+	{
+		size_t hash;
+		IdT id;
+		std::string name;
+	};
+	
+	struct Table
+	{
+		size_t mask;
+		std::unique_ptr<std::atomic<const Entry*>[]> slots;
+		size_t usedSlots = 0; // including tombstones
+		
+		Table(const size_t capacity)
+			: mask(capacity - 1), slots(new std::atomic<const Entry*>[capacity])
+		{
+			for(size_t i=0; i<capacity; i++)
+			{
+				slots[i].store(nullptr, std::memory_order_relaxed);
+			}
+		}
+		
+		size_t getCapacity() const { return mask + 1; }
+	};
+	
+	static constexpr size_t InitialCapacity = 1024;
+	
+	// Marks removed entries, so that the probing does not stop on them
+	static inline const Entry tombstone = {0, 0, {}};
+	
+	ReadCopyUpdate rcu;
+	std::mutex writeMutex;
+	std::atomic<Table*> table;
+	
+	// Updated under writeMutex, together with the table
+	OrderedNameIndexBase<IdT> ordered;
+	
+	static size_t getHash(const std::string_view name) { return std::hash<std::string_view>()(name); }
+	
+	// Returns the slot with given name, or the empty slot ending the probe sequence
+	static std::atomic<const Entry*>& probe(const Table& table, const std::string_view name, const size_t hash)
+	{
+		for(size_t i = hash & table.mask; ; i = (i + 1) & table.mask)
+		{
+			auto& slot = table.slots[i];
+			const auto entry = slot.load(std::memory_order_acquire);
+			if(entry == nullptr || (entry != &tombstone && entry->hash == hash && entry->name == name))
+			{
+				return slot;
+			}
+		}
+	}
+	
+	static void insertUnique(Table& table, const Entry* entry)
+	{
+		for(size_t i = entry->hash & table.mask; ; i = (i + 1) & table.mask)
+		{
+			if(table.slots[i].load(std::memory_order_relaxed) == nullptr)
+			{
+				table.slots[i].store(entry, std::memory_order_relaxed);
+				++table.usedSlots;
+				return;
+			}
+		}
+	}
+	
+	// Has to be called under writeMutex. Keeps the load factor (with tombstones) at most 1/2
+	void reserveSlot()
+	{
+		auto current = table.load(std::memory_order_relaxed);
+		if((current->usedSlots + 1) * 2 <= current->getCapacity())
+		{
+			return;
+		}
+		
+		size_t liveEntries = 0;
+		for(size_t i=0; i<current->getCapacity(); i++)
+		{
+			const auto entry = current->slots[i].load(std::memory_order_relaxed);
+			liveEntries += entry != nullptr && entry != &tombstone;
+		}
+		
+		size_t newCapacity = current->getCapacity();
+		while((liveEntries + 1) * 4 > newCapacity)
+		{
+			newCapacity *= 2;
+		}
+		
+		auto grown = new Table(newCapacity);
+		for(size_t i=0; i<current->getCapacity(); i++)
+		{
+			const auto entry = current->slots[i].load(std::memory_order_relaxed);
+			if(entry != nullptr && entry != &tombstone)
+			{
+				insertUnique(*grown, entry);
+			}
+		}
+		
+		// Entries are shared by both tables, only the old slots array is freed
+		table.store(grown, std::memory_order_release);
+		rcu.synchronize();
+		delete current;
+	}
+	
+	// Has to be called under writeMutex, for a name that is not indexed yet
+	void insertNew(const Entry* newEntry)
+	{
+		reserveSlot();
+		auto current = table.load(std::memory_order_relaxed);
+		probe(*current, newEntry->name, newEntry->hash).store(newEntry, std::memory_order_release);
+		++current->usedSlots;
+		ordered.set(newEntry->id, newEntry->name);
+	}
+	
+public:
+	
+	using ReadSection = ReadCopyUpdate::ReadSection;
+	
+	// Allows for many lookups within one read section, with getInReadSection
+	ReadSection getReadSection() { return ReadSection(rcu); }
+	
+	IdT getInReadSection(const std::string_view name)
+	{
+		const auto entry = probe(*table.load(std::memory_order_acquire), name, getHash(name)).load(std::memory_order_acquire);
+		return entry ? entry->id : 0;
+	}
+	
+	// Returns 0 if the name is not indexed
+	IdT get(const std::string_view name)
+	{
+		ReadSection section(rcu);
+		return getInReadSection(name);
+	}
+	
+	bool has(const std::string_view name)
+	{
+		return get(name) != 0;
+	}
+	
+	void set(const IdT id, const std::string_view name)
+	{
+		const auto hash = getHash(name);
+		auto newEntry = new Entry{hash, id, std::string(name)};
+		
+		std::lock_guard lock{writeMutex};
+		
+		auto& existing = probe(*table.load(std::memory_order_relaxed), name, hash);
+		if(auto oldEntry = existing.load(std::memory_order_relaxed))
+		{
+			existing.store(newEntry, std::memory_order_release);
+			ordered.set(id, name);
+			rcu.synchronize();
+			delete oldEntry;
+			return;
+		}
+		
+		insertNew(newEntry);
+	}
+	
+	// Atomic get-or-create. If the name is not indexed, create() is called under the write lock,
+	// and the id it returns is indexed (unless it is 0).
+	// Returns the id, and whether it was created
+	template<typename Create>
+	std::pair<IdT, bool> getOrInsert(const std::string_view name, Create&& create)
+	{
+		const auto hash = getHash(name);
+		
+		std::lock_guard lock{writeMutex};
+		
+		if(auto entry = probe(*table.load(std::memory_order_relaxed), name, hash).load(std::memory_order_relaxed))
+		{
+			return {entry->id, false};
+		}
+		
+		const IdT id = create();
+		if(id == 0)
+		{
+			return {0, false};
+		}
+		
+		insertNew(new Entry{hash, id, std::string(name)});
+		return {id, true};
+	}
+	
+	// Removes the name, if it is indexed with given id. Remove() is called under the write lock,
+	// and the name is removed only if it returns true. Returns whether the name was removed
+	template<typename Remove>
+	bool eraseIf(const std::string_view name, const IdT id, Remove&& remove)
+	{
+		const auto hash = getHash(name);
+		
+		std::lock_guard lock{writeMutex};
+		
+		auto& slot = probe(*table.load(std::memory_order_relaxed), name, hash);
+		const auto entry = slot.load(std::memory_order_relaxed);
+		if(!entry || entry->id != id || !remove())
+		{
+			return false;
+		}
+		
+		slot.store(&tombstone, std::memory_order_release);
+		ordered.erase(name);
+		rcu.synchronize();
+		delete entry;
+		return true;
+	}
+	
+	bool erase(const std::string_view name, const IdT id)
+	{
+		return eraseIf(name, id, []{ return true; });
+	}
+	
+	// See OrderedNameIndexBase::scanPrefix
+	template<typename Callback>
+	bool scanPrefix(const std::string_view prefix, const std::string_view after, const size_t limit, Callback&& callback)
+	{
+		return ordered.scanPrefix(prefix, after, limit, std::forward<Callback>(callback));
+	}
+	
+	NameIndexBase()
+		: table(new Table(InitialCapacity))
+	{}
+	
+	NameIndexBase(const NameIndexBase&) = delete;
+	
+	~NameIndexBase()
+	{
+		auto current = table.load();
+		for(size_t i=0; i<current->getCapacity(); i++)
+		{
+			const auto entry = current->slots[i].load();
+			if(entry != nullptr && entry != &tombstone)
+			{
+				delete entry;
+			}
+		}
+		delete current;
+	}
+};
 
+// Table-wide log of changes, ordered by version. Every mutation of a record takes the next version,
+// so a client that has seen everything up to some version can catch up with only the records changed since.
+// Only the last capacity changes are kept. Clients further behind than that have to fetch everything again.
+template <typename IdT = IdType>
+class ChangeLogBase
+{
+public:
+	
+	using Version = uint64_t;
+	
+private:
+	
+	std::mutex mutex;
+	std::deque<std::pair<Version, IdT>> changes;
+	Version currentVersion = 0;
+	Version truncatedVersion = 0; // changes up to this version are no longer kept
+	size_t capacity;
+	
+public:
+	
+	// Versions handed out before a restart, that did not make it to the disk, could be handed out again after it.
+	// Versions restored after a restart are moved forward by this much, so that clients which saw them resync instead
+	static constexpr Version RestartGap = Version(1) << 20;
+	
+	ChangeLogBase(const size_t capacity_ = 1024 * 64)
+		: capacity(capacity_)
+	{}
+	
+	// Returns the version of the change. Has to be called under the lock of the changed record,
+	// so that versions of each record are in order of its mutations
+	Version append(const IdT id)
+	{
+		std::lock_guard lock{mutex};
+		changes.emplace_back(++currentVersion, id);
+		if(changes.size() > capacity)
+		{
+			truncatedVersion = changes.front().first;
+			changes.pop_front();
+		}
+		return currentVersion;
+	}
+	
+	Version getCurrentVersion()
+	{
+		std::lock_guard lock{mutex};
+		return currentVersion;
+	}
+	
+	// Makes sure versions handed out from now on are newer than given one. Used while the database is restored
+	void restore(const Version version)
+	{
+		std::lock_guard lock{mutex};
+		currentVersion = std::max(currentVersion, version);
+		truncatedVersion = currentVersion;
+		changes.clear();
+	}
+	
+	// Called once the database is restored. Every client has to fetch everything again
+	void restart()
+	{
+		restore(getCurrentVersion() + RestartGap);
+	}
+	
+	// Calls callback(IdT id) once for every record changed after given version, in order of ids,
+	// and sets current to the version it is up to date with. Returns false, without calling the callback,
+	// if changes since given version are no longer kept, or it is not a version of this log
+	template<typename Callback>
+	bool forEachChangedSince(const Version since, Version& current, Callback&& callback)
+	{
+		static_assert(std::is_invocable_v<Callback, IdT>);
+		
+		std::vector<IdT> changed;
+		{
+			std::lock_guard lock{mutex};
+			current = currentVersion;
+			if(since < truncatedVersion || since > currentVersion)
+			{
+				return false;
+			}
+			// Versions are consecutive, so the first change after the given version can be found directly
+			const auto first = changes.end() - (currentVersion - since);
+			changed.reserve(changes.end() - first);
+			for(auto it = first; it != changes.end(); ++it)
+			{
+				changed.push_back(it->second);
+			}
+		}
+		
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+		for(const auto id : changed)
+		{
+			callback(id);
+		}
+		return true;
+	}
+};
 
-
-
-
-
-
-
-
-
-
-
-
-
-
+// Returns the id of the record with given name, and whether it was created.
+// The record is created and indexed if the name was not indexed yet. Returns id 0 if the table is full.
+// Callback, called as callback(IdT id, RecordT* record, bool created), fills the record within the same critical section
+// in which it was found or created, so no other thread can see a half-filled record.
+template <typename RecordT, typename IdT, typename Callback>
+std::pair<IdT, bool> findOrInsert(TableBase<RecordT, IdT>& table, NameIndexBase<IdT>& index, const std::string_view name, Callback&& callback)
+{
+	static_assert(std::is_invocable_v<Callback, IdT, RecordT*, bool>);
+	
+	auto fillExisting = [&](const IdT id){
+		return table.accessSafeWrite(id, [&](RecordT* record){
+			if(!record)
+				return false;
+			callback(id, record, false);
+			return true;
+		});
+	};
+	
+	// Common case of a repeated registration is lock-free until the record itself is accessed
+	if(const auto id = index.get(name))
+	{
+		if(fillExisting(id))
+			return {id, false};
+	}
+	
+	const auto res = index.getOrInsert(name, [&]{
+		return table.createNewRecord([&](const IdT id, RecordT* record){ callback(id, record, true); });
+	});
+	
+	if(res.first != 0 && !res.second && !fillExisting(res.first))
+	{
+		return {0, false};
+	}
+	return res;
 }
 
-
-
-
+}
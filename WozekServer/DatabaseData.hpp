@@ -2,6 +2,8 @@
 
 #include "asio_lib.hpp"
 #include "DatabaseBase.hpp"
+#include <chrono>
+#include <vector>
 
 
 
@@ -17,21 +19,247 @@ struct ControllerRecord
 	
 	asioudp::endpoint endpoint;
 	
+	// Version of the last change, taken from ControllerChangeLog
+	uint64_t version = 0;
+	
+};
+
+using ControllerTable = TableBase<ControllerRecord>;
+using ControllerNameIndex = NameIndexBase<>;
+using ControllerChangeLog = ChangeLogBase<>;
+
+// Hot, frequently updated state of controllers, kept apart from ControllerRecord as a struct of arrays.
+// Every field is stored contiguously by slot number, in pages matching the pages of ControllerTable,
+// so walking all controllers (e.g. for expiry) never chases pointers.
+// Each slot remembers the full id (with generation) of the controller it belongs to, so stale ids are rejected.
+// Desired and measured state of controllers in a world is kept only by the world (see World::Controllers)
+class ControllerStateTable
+{
+public:
+	
+	using IdT = IdType;
+	
+	// Nanoseconds of the steady clock. 0 means never updated
+	using Timepoint = uint64_t;
+	
 	struct Rotation
 	{
 		data::RotationType X = 0, Y = 0, Z = 0;
-	} rotation;
+	};
+	
+	static constexpr size_t PageSizeLog2 = ControllerTable::PageSizeLog2;
+	static constexpr size_t PageSize = ControllerTable::PageSize;
+	static constexpr size_t MaxPages = ControllerTable::MaxPages;
 	
+private:
+	
+	template <typename T>
+	using Column = std::array<T, PageSize>;
+	
+	struct Page
+	{
+		std::shared_mutex mutex;
+		
+		Column<IdT> ids = {}; // 0 if the slot is not active
+		Column<Timepoint> lastUpdate = {};
+		Column<Timepoint> lastSeen = {};
+		
+		Column<data::RotationType> rotation[3] = {};
+	};
+	
+	// Calls callback(column) for every column of the page
+	template <typename PageT, typename Callback>
+	static void forEachColumn(PageT& page, Callback&& callback)
+	{
+		callback(page.lastUpdate);
+		callback(page.lastSeen);
+		callback(page.ids);
+		for(auto& column : page.rotation) callback(column);
+	}
+	
+	std::array<std::atomic<Page*>, MaxPages> pages = {};
+	std::mutex growMutex;
+	
+	static size_t getPageIndex(const IdT id) { return ControllerTable::getSlotNumber(id) >> PageSizeLog2; }
+	static size_t getSlotIndex(const IdT id) { return ControllerTable::getSlotNumber(id) & (PageSize - 1); }
+	
+	Page* getPage(const IdT id)
+	{
+		if(ControllerTable::getSlotNumber(id) == 0)
+		{
+			return nullptr;
+		}
+		return pages[getPageIndex(id)].load(std::memory_order_acquire);
+	}
+	
+	Page* getOrCreatePage(const IdT id)
+	{
+		if(auto page = getPage(id))
+		{
+			return page;
+		}
+		
+		std::lock_guard lock{growMutex};
+		auto& pagePtr = pages[getPageIndex(id)];
+		if(auto page = pagePtr.load(std::memory_order_relaxed))
+		{
+			return page;
+		}
+		auto page = new Page;
+		pagePtr.store(page, std::memory_order_release);
+		return page;
+	}
+	
+	// Callback is called as callback(page, slotIndex), only for active controllers. Returns false if the controller is not active
+	template <typename Callback>
+	bool accessWrite(const IdT id, Callback&& callback)
+	{
+		auto page = getPage(id);
+		if(!page)
+		{
+			return false;
+		}
+		const auto slot = getSlotIndex(id);
+		std::unique_lock lock{page->mutex};
+		if(page->ids[slot] != id)
+		{
+			return false;
+		}
+		callback(*page, slot);
+		return true;
+	}
+	
+	template <typename Callback>
+	bool accessRead(const IdT id, Callback&& callback)
+	{
+		auto page = getPage(id);
+		if(!page)
+		{
+			return false;
+		}
+		const auto slot = getSlotIndex(id);
+		std::shared_lock lock{page->mutex};
+		if(page->ids[slot] != id)
+		{
+			return false;
+		}
+		callback(static_cast<const Page&>(*page), slot);
+		return true;
+	}
+	
+public:
+	
+	static Timepoint now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	
+	// Has to be called once the controller is registered, before any of its state can be set
+	void activate(const IdT id, const Timepoint timepoint = now())
+	{
+		if(ControllerTable::getSlotNumber(id) == 0)
+		{
+			return;
+		}
+		auto page = getOrCreatePage(id);
+		const auto slot = getSlotIndex(id);
+		
+		std::unique_lock lock{page->mutex};
+		forEachColumn(*page, [slot](auto& column){ column[slot] = {}; });
+		page->ids[slot] = id;
+		page->lastSeen[slot] = timepoint;
+	}
+	
+	void deactivate(const IdT id)
+	{
+		accessWrite(id, [](Page& page, const size_t slot){ page.ids[slot] = 0; });
+	}
+	
+	// Deactivates the controller only if it was not seen since the deadline. Returns whether it was deactivated
+	bool deactivateIfIdle(const IdT id, const Timepoint deadline)
+	{
+		bool res = false;
+		accessWrite(id, [&](Page& page, const size_t slot){
+			if(page.lastSeen[slot] < deadline)
+			{
+				page.ids[slot] = 0;
+				res = true;
+			}
+		});
+		return res;
+	}
+	
+	// Marks the controller as alive. Returns false if the controller is not active
+	bool touch(const IdT id, const Timepoint timepoint = now())
+	{
+		return accessWrite(id, [&](Page& page, const size_t slot){ page.lastSeen[slot] = timepoint; });
+	}
+	
+	// Appends ids of all active controllers not seen since the deadline. Scans only the ids and lastSeen columns
+	void collectIdle(const Timepoint deadline, std::vector<IdT>& out)
+	{
+		for(auto& pagePtr : pages)
+		{
+			auto page = pagePtr.load(std::memory_order_acquire);
+			if(!page)
+			{
+				continue;
+			}
+			std::shared_lock lock{page->mutex};
+			for(size_t slot = 0; slot < PageSize; slot++)
+			{
+				if(page->ids[slot] != 0 && page->lastSeen[slot] < deadline)
+				{
+					out.push_back(page->ids[slot]);
+				}
+			}
+		}
+	}
+	
+	bool setRotation(const IdT id, const Rotation& rotation, const Timepoint timepoint = now())
+	{
+		return accessWrite(id, [&](Page& page, const size_t slot){
+			page.rotation[0][slot] = rotation.X;
+			page.rotation[1][slot] = rotation.Y;
+			page.rotation[2][slot] = rotation.Z;
+			page.lastUpdate[slot] = timepoint;
+			page.lastSeen[slot] = timepoint;
+		});
+	}
+	
+	std::optional<Rotation> getRotation(const IdT id)
+	{
+		std::optional<Rotation> res;
+		accessRead(id, [&](const Page& page, const size_t slot){
+			res.emplace(Rotation{page.rotation[0][slot], page.rotation[1][slot], page.rotation[2][slot]});
+		});
+		return res;
+	}
+	
+	std::optional<Timepoint> getLastUpdate(const IdT id)
+	{
+		std::optional<Timepoint> res;
+		accessRead(id, [&](const Page& page, const size_t slot){ res = page.lastUpdate[slot]; });
+		return res;
+	}
+	
+	ControllerStateTable() {}
+	ControllerStateTable(const ControllerStateTable&) = delete;
+	
+	~ControllerStateTable()
+	{
+		for(auto& page : pages)
+		{
+			delete page.load(std::memory_order_relaxed);
+		}
+	}
 };
 
-using ControllerTable = TableBase<100, ControllerRecord>;
-using ControllerNameIndex = IndexBase<std::string>;
-
 /*
 
 
 class ControllerTable
-	: public TableBase<100, ControllerRecord>
+	: public TableBase<ControllerRecord>
 {
 public:
 	
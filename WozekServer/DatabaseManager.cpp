@@ -1,9 +1,161 @@
 #include "DatabaseManager.hpp"
+#include "durableFile.hpp"
+#include "fileCache.hpp"
+#include "logging.hpp"
 
 namespace db
 {
 
 DatabaseManager databaseManager;
 
+bool DatabaseManager::open(const fs::path& directory_)
+{
+	directory = directory_;
+	const auto snapshotPath = directory / SnapshotFilename;
+	
+	uint32_t walSegment = 0;
+	std::error_code ignored;
+	if(fs::exists(snapshotPath, ignored))
+	{
+		try
+		{
+			MappedFile file(snapshotPath);
+			if(!persistence::restoreSnapshot(getDatabase(), file.data(), file.size(), walSegment))
+			{
+				return false;
+			}
+		}
+		catch(std::exception&)
+		{
+			return false;
+		}
+	}
+	
+	const auto lastSegment = persistence::WriteAheadLog::replay(getDatabase(), directory, walSegment);
+	getDatabase().controllerTable.rebuildFreeSlots();
+	getDatabase().controllerChangeLog.restart();
+	
+	if(!writeAheadLog.open(directory, lastSegment + 1))
+	{
+		return false;
+	}
+	writeAheadLog.removeSegmentsBefore(walSegment);
+	return true;
+}
+
+bool DatabaseManager::saveSnapshot()
+{
+	std::lock_guard lock{snapshotMutex};
+	
+	// Every mutation appended to the older segments is already applied, so it will be a part of the snapshot
+	const auto walSegment = writeAheadLog.startNewSegment();
+	const auto snapshot = persistence::serializeSnapshot(getDatabase(), walSegment);
+	if(!DurableFile::replaceAtomically(directory / SnapshotFilename, snapshot.data(), snapshot.size()))
+	{
+		return false;
+	}
+	writeAheadLog.removeSegmentsBefore(walSegment);
+	return true;
+}
+
+void DatabaseManager::startSnapshots(const std::chrono::seconds& duration)
+{
+	stopSnapshots();
+	snapshotDuration = duration;
+	if(duration == std::chrono::seconds(0))
+		return;
+	snapshotsStopping = false;
+	snapshotThread = std::thread([this]{ snapshotLoop(); });
+}
+
+void DatabaseManager::stopSnapshots()
+{
+	if(!snapshotThread.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard lock{snapshotThreadMutex};
+		snapshotsStopping = true;
+	}
+	snapshotCondition.notify_one();
+	snapshotThread.join();
 }
 
+void DatabaseManager::snapshotLoop()
+{
+	std::unique_lock lock{snapshotThreadMutex};
+	while(!snapshotCondition.wait_for(lock, snapshotDuration, [this]{ return snapshotsStopping; }))
+	{
+		lock.unlock();
+		if(!saveSnapshot())
+		{
+			logger.output("Cannot save database snapshot to "_fmt, directory);
+			logger.error(Logger::Error::DatabaseSnapshotError);
+		}
+		if(writeAheadLog.hasFailed())
+		{
+			logger.output("Cannot write the database log to "_fmt, directory);
+			logger.error(Logger::Error::DatabaseLogError);
+		}
+		lock.lock();
+	}
+}
+
+size_t DatabaseManager::expireIdleControllers(const std::chrono::seconds& expiryTime)
+{
+	auto& database = getDatabase();
+	const auto deadline = ControllerStateTable::now() - std::chrono::duration_cast<std::chrono::nanoseconds>(expiryTime).count();
+	
+	std::vector<IdType> idle;
+	database.controllerStateTable.collectIdle(deadline, idle);
+	
+	size_t res = 0;
+	for(const auto id : idle)
+	{
+		std::string name;
+		database.controllerTable.accessSafeRead(id, [&](const ControllerRecord* record){
+			if(record)
+				name = record->name;
+		});
+		
+		// Under the index lock, so that a concurrent registration of the same name either refreshes
+		// the controller before it is checked, or creates a new one after it is erased.
+		// Liveness is checked again under the record's lock, as the controller could have been seen since it was collected
+		res += database.controllerNameIndex.eraseIf(name, id, [&]{
+			return database.controllerTable.eraseRecordIf(id, [&](const ControllerRecord*){
+				if(!database.controllerStateTable.deactivateIfIdle(id, deadline))
+					return false;
+				writeAheadLog.appendEraseControllerRecord(id, database.controllerChangeLog.append(id));
+				return true;
+			});
+		});
+	}
+	return res;
+}
+
+void DatabaseManager::startSweeps(const std::chrono::seconds& expiryTime_, const std::chrono::seconds& duration)
+{
+	expiryTime = expiryTime_;
+	sweepTimerDuration = duration;
+	if(duration == std::chrono::seconds(0))
+		return;
+	sweepTimer.emplace(getContext());
+	sweepTimerStart();
+}
+
+void DatabaseManager::sweepTimerStart()
+{
+	sweepTimer.value().expires_after(sweepTimerDuration);
+	sweepTimer.value().async_wait([this](const ::Error& err){
+		if(err)
+			return;
+		if(const auto expired = expireIdleControllers(expiryTime))
+		{
+			logger.output("Expired "_fmt, expired, " idle controllers"_fmt);
+		}
+		sweepTimerStart();
+	});
+}
+
+}
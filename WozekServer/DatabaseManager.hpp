@@ -5,8 +5,16 @@
 #include <iostream>
 #include <optional>
 #include <typeinfo>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "DatabaseData.hpp"
+#include "DatabasePersistence.hpp"
+
+namespace fs = std::filesystem;
 
 namespace db
 {
@@ -19,9 +27,11 @@ public:
 	
 	ControllerTable controllerTable;
 	ControllerNameIndex controllerNameIndex;
+	ControllerStateTable controllerStateTable;
+	ControllerChangeLog controllerChangeLog;
 	
 	Database(asio::io_context& ioContext_)
-		: ioContext(ioContext_), controllerTable(ioContext_)
+		: ioContext(ioContext_)
 	{
 	}
 };
@@ -30,8 +40,51 @@ class DatabaseManager
 {
 	std::optional<Database> database;
 	
+	fs::path directory;
+	persistence::WriteAheadLog writeAheadLog;
+	
+	std::mutex snapshotMutex;
+	
+	// Serializing and syncing a snapshot takes long, so it is done by its own thread, and not by the threads that serve the requests
+	std::chrono::seconds snapshotDuration;
+	std::mutex snapshotThreadMutex;
+	std::condition_variable snapshotCondition;
+	bool snapshotsStopping = false;
+	std::thread snapshotThread;
+	
+	std::chrono::seconds expiryTime;
+	std::chrono::seconds sweepTimerDuration;
+	std::optional<asio::steady_timer> sweepTimer;
+	
+	void snapshotLoop();
+	void sweepTimerStart();
+	
 public:
 	
+	static constexpr const char* SnapshotFilename = "controllers.snapshot";
+	
+	// Loads the last snapshot from the directory, replays the write-ahead log on top of it, and starts a new log segment.
+	// Returns false if the snapshot exists, but cannot be read or is corrupted. Has to be called before the servers are started
+	bool open(const fs::path& directory);
+	
+	// Crash-consistent. After a crash, the file holds either the previous or the new snapshot.
+	// Once the snapshot is saved, the log segments it covers are removed
+	bool saveSnapshot();
+	
+	// Periodically saves a snapshot on a background thread
+	void startSnapshots(const std::chrono::seconds& duration);
+	
+	// Stops the background snapshots. Waits for the one being saved
+	void stopSnapshots();
+	
+	// Erases controllers not seen for at least expiryTime, freeing their ids for reuse. Returns the number of erased controllers
+	size_t expireIdleControllers(const std::chrono::seconds& expiryTime);
+	
+	// Periodically expires idle controllers in the background
+	void startSweeps(const std::chrono::seconds& expiryTime, const std::chrono::seconds& duration);
+	
+	auto& getWriteAheadLog() { return writeAheadLog; }
+	
 	void setContext(asio::io_context& ioContext) {database.emplace(ioContext);}
 	bool hasContext() {return database.has_value();}
 	auto& getContext() {assert(hasContext()); return database.value().ioContext;}
@@ -44,6 +97,10 @@ public:
 	DatabaseManager()
 	{
 	}
+	~DatabaseManager()
+	{
+		stopSnapshots();
+	}
 	
 	
 };
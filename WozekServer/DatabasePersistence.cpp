@@ -0,0 +1,464 @@
+#include "DatabasePersistence.hpp"
+#include "DatabaseManager.hpp"
+#include "fileCache.hpp"
+#include <algorithm>
+#include <cstdio>
+
+namespace db
+{
+
+namespace persistence
+{
+
+EncodedEndpoint EncodedEndpoint::encode(const asioudp::endpoint& endpoint)
+{
+	EncodedEndpoint res;
+	res.port = endpoint.port();
+	
+	const auto address = endpoint.address();
+	if(address.is_v4())
+	{
+		const auto bytes = address.to_v4().to_bytes();
+		res.family = 4;
+		std::memcpy(res.address, bytes.data(), bytes.size());
+	}
+	else if(address.is_v6())
+	{
+		const auto bytes = address.to_v6().to_bytes();
+		res.family = 6;
+		std::memcpy(res.address, bytes.data(), bytes.size());
+	}
+	return res;
+}
+
+asioudp::endpoint EncodedEndpoint::decode() const
+{
+	if(family == 4)
+	{
+		asio::ip::address_v4::bytes_type bytes;
+		std::memcpy(bytes.data(), address, bytes.size());
+		return asioudp::endpoint(asio::ip::address_v4(bytes), port);
+	}
+	if(family == 6)
+	{
+		asio::ip::address_v6::bytes_type bytes;
+		std::memcpy(bytes.data(), address, bytes.size());
+		return asioudp::endpoint(asio::ip::address_v6(bytes), port);
+	}
+	return asioudp::endpoint();
+}
+
+void appendControllerRecord(std::vector<char>& out, const IdType id, const ControllerRecord& record)
+{
+	RecordHeader header;
+	header.id = id;
+	header.nameLength = std::min<size_t>(record.name.size(), UINT16_MAX);
+	header.endpoint = EncodedEndpoint::encode(record.endpoint);
+	
+	const auto offset = out.size();
+	out.resize(offset + sizeof(header) + header.nameLength);
+	std::memcpy(out.data() + offset, &header, sizeof(header));
+	std::memcpy(out.data() + offset + sizeof(header), record.name.data(), header.nameLength);
+	out.insert(out.end(), reinterpret_cast<const char*>(&record.version), reinterpret_cast<const char*>(&record.version) + sizeof(record.version));
+}
+
+bool readControllerRecord(const char*& it, const char* end, IdType& id, ControllerRecord& record, const bool versioned)
+{
+	RecordHeader header;
+	if(size_t(end - it) < sizeof(header))
+	{
+		return false;
+	}
+	std::memcpy(&header, it, sizeof(header));
+	
+	const size_t size = sizeof(header) + header.nameLength + (versioned ? sizeof(record.version) : 0);
+	if(size_t(end - it) < size || header.id == 0)
+	{
+		return false;
+	}
+	
+	id = header.id;
+	record.name.assign(it + sizeof(header), header.nameLength);
+	record.endpoint = header.endpoint.decode();
+	record.version = 0;
+	if(versioned)
+	{
+		std::memcpy(&record.version, it + sizeof(header) + header.nameLength, sizeof(record.version));
+	}
+	it += size;
+	return true;
+}
+
+uint64_t checksum(const char* data, const size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i=0; i<size; i++)
+	{
+		hash ^= uint8_t(data[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Creates or overwrites the record, and everything derived from it
+static bool restoreControllerRecord(Database& database, const IdType id, ControllerRecord&& record)
+{
+	if(ControllerTable::getSlotNumber(id) == 0)
+	{
+		return false;
+	}
+	database.controllerNameIndex.set(id, record.name);
+	database.controllerChangeLog.restore(record.version);
+	database.controllerTable.restoreRecord(id, [&](ControllerRecord* restored){ *restored = std::move(record); });
+	database.controllerStateTable.activate(id);
+	return true;
+}
+
+static void eraseControllerRecord(Database& database, const IdType id, const uint64_t version)
+{
+	database.controllerChangeLog.restore(version);
+	std::string name;
+	database.controllerTable.accessSafeRead(id, [&](const ControllerRecord* record){
+		if(record)
+			name = record->name;
+	});
+	database.controllerNameIndex.erase(name, id);
+	database.controllerTable.eraseRecord(id);
+	database.controllerStateTable.deactivate(id);
+}
+
+std::vector<char> serializeSnapshot(Database& database, const uint32_t walSegment)
+{
+	std::vector<char> res(sizeof(SnapshotHeader));
+	SnapshotHeader header;
+	std::memcpy(header.magic, SnapshotHeader::Magic, sizeof(header.magic));
+	header.version = SnapshotHeader::CurrentVersion;
+	header.recordsCount = 0;
+	header.walSegment = walSegment;
+	header.freeSlotsCount = 0;
+	// Taken before the records, so that every change not in the snapshot has a newer version
+	header.changeVersion = database.controllerChangeLog.getCurrentVersion();
+	
+	database.controllerTable.forEachRecord([&](const IdType id, const ControllerRecord& record){
+		appendControllerRecord(res, id, record);
+		++header.recordsCount;
+	});
+	database.controllerTable.forEachFreeSlot([&](const IdType id){
+		res.insert(res.end(), reinterpret_cast<const char*>(&id), reinterpret_cast<const char*>(&id) + sizeof(id));
+		++header.freeSlotsCount;
+	});
+	
+	header.bodySize = res.size() - sizeof(header);
+	header.bodyChecksum = checksum(res.data() + sizeof(header), header.bodySize);
+	std::memcpy(res.data(), &header, sizeof(header));
+	return res;
+}
+
+bool restoreSnapshot(Database& database, const char* data, const size_t size, uint32_t& walSegment)
+{
+	SnapshotHeader header = {};
+	if(size < SnapshotHeader::Version1Size)
+	{
+		return false;
+	}
+	std::memcpy(&header, data, std::min(size, sizeof(header)));
+	
+	const bool versioned = header.version >= 2;
+	const size_t headerSize = versioned ? sizeof(header) : SnapshotHeader::Version1Size;
+	if(std::memcmp(header.magic, SnapshotHeader::Magic, sizeof(header.magic)) != 0 ||
+	   header.version == 0 || header.version > SnapshotHeader::CurrentVersion ||
+	   size < headerSize || header.bodySize != size - headerSize ||
+	   header.bodyChecksum != checksum(data + headerSize, header.bodySize))
+	{
+		return false;
+	}
+	
+	walSegment = header.walSegment;
+	database.controllerChangeLog.restore(versioned ? header.changeVersion : 0);
+	
+	const char* it = data + headerSize;
+	const char* const end = data + size;
+	
+	IdType id;
+	ControllerRecord record;
+	for(uint32_t i=0; i<header.recordsCount; i++)
+	{
+		if(!readControllerRecord(it, end, id, record, versioned))
+		{
+			return false;
+		}
+		if(!restoreControllerRecord(database, id, std::move(record)))
+		{
+			return false;
+		}
+	}
+	
+	if(size_t(end - it) != header.freeSlotsCount * sizeof(IdType))
+	{
+		return false;
+	}
+	for(uint32_t i=0; i<header.freeSlotsCount; i++, it += sizeof(IdType))
+	{
+		std::memcpy(&id, it, sizeof(id));
+		database.controllerTable.restoreFreeSlot(id);
+	}
+	return true;
+}
+
+/// Write-ahead log ///
+
+fs::path WriteAheadLog::getSegmentPath(const fs::path& directory, const uint32_t segment)
+{
+	char number[16];
+	std::snprintf(number, sizeof(number), "%08u", unsigned(segment));
+	return directory / (std::string(FilePrefix) + number);
+}
+
+std::vector<uint32_t> WriteAheadLog::listSegments(const fs::path& directory)
+{
+	std::vector<uint32_t> res;
+	std::error_code err;
+	for(auto& entry : fs::directory_iterator(directory, err))
+	{
+		const auto filename = entry.path().filename().string();
+		if(filename.size() <= std::strlen(FilePrefix) || filename.compare(0, std::strlen(FilePrefix), FilePrefix) != 0)
+		{
+			continue;
+		}
+		const auto number = filename.substr(std::strlen(FilePrefix));
+		if(number.find_first_not_of("0123456789") != std::string::npos)
+		{
+			continue;
+		}
+		res.push_back(std::stoul(number));
+	}
+	std::sort(res.begin(), res.end());
+	return res;
+}
+
+uint32_t WriteAheadLog::replay(Database& database, const fs::path& directory, const uint32_t firstSegment)
+{
+	uint32_t lastSegment = firstSegment > 0 ? firstSegment - 1 : 0;
+	
+	for(const auto segment : listSegments(directory))
+	{
+		if(segment < firstSegment)
+		{
+			continue;
+		}
+		lastSegment = segment;
+		
+		std::unique_ptr<MappedFile> file;
+		try
+		{
+			file = std::make_unique<MappedFile>(getSegmentPath(directory, segment));
+		}
+		catch(std::exception&)
+		{
+			continue;
+		}
+		
+		const char* it = file->data();
+		const char* const end = it + file->size();
+		
+		EntryHeader header;
+		while(size_t(end - it) >= sizeof(header))
+		{
+			std::memcpy(&header, it, sizeof(header));
+			const char* payload = it + sizeof(header);
+			if(size_t(end - payload) < header.size || checksum(payload, header.size) != header.checksum)
+			{
+				// Torn write at the end of the segment
+				break;
+			}
+			it = payload + header.size;
+			
+			if(header.type == EntryType::SetControllerRecord)
+			{
+				// Entry holds a single record, so it is versioned exactly when something follows the name
+				IdType id;
+				ControllerRecord record;
+				if(readControllerRecord(payload, it, id, record, false))
+				{
+					if(size_t(it - payload) == sizeof(record.version))
+					{
+						std::memcpy(&record.version, payload, sizeof(record.version));
+					}
+					restoreControllerRecord(database, id, std::move(record));
+				}
+			}
+			else if(header.type == EntryType::EraseControllerRecord && header.size >= sizeof(IdType))
+			{
+				IdType id;
+				uint64_t version = 0;
+				std::memcpy(&id, payload, sizeof(id));
+				if(header.size == sizeof(id) + sizeof(version))
+				{
+					std::memcpy(&version, payload + sizeof(id), sizeof(version));
+				}
+				eraseControllerRecord(database, id, version);
+			}
+		}
+	}
+	
+	return lastSegment;
+}
+
+bool WriteAheadLog::open(const fs::path& directory_, const uint32_t segment)
+{
+	close();
+	
+	directory = directory_;
+	currentSegment = segment;
+	stopping = false;
+	failed = false;
+	
+	// Segment file is created right away, so that the next replay will know about it, even if it stays empty
+	fileSegment = segment;
+	if(!file.open(getSegmentPath(directory, segment), true) || !DurableFile::syncDirectory(directory))
+	{
+		file.close();
+		return false;
+	}
+	
+	writerThread = std::thread([this]{ writerLoop(); });
+	return true;
+}
+
+void WriteAheadLog::close()
+{
+	if(!writerThread.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard lock{mutex};
+		stopping = true;
+	}
+	condition.notify_one();
+	writerThread.join();
+	file.close();
+}
+
+bool WriteAheadLog::hasFailed()
+{
+	std::lock_guard lock{mutex};
+	return failed;
+}
+
+void WriteAheadLog::writerLoop()
+{
+	std::deque<Batch> writing;
+	
+	std::unique_lock lock{mutex};
+	while(true)
+	{
+		condition.wait(lock, [this]{ return !pending.empty() || stopping; });
+		if(pending.empty())
+		{
+			return;
+		}
+		
+		// Everything appended while the previous batch was being synced is written out together
+		std::swap(writing, pending);
+		lock.unlock();
+		
+		bool ok = true;
+		for(auto& batch : writing)
+		{
+			ok = writeBatch(batch) && ok;
+		}
+		ok = file.sync() && ok;
+		writing.clear();
+		
+		lock.lock();
+		if(!ok)
+		{
+			failed = true;
+		}
+	}
+}
+
+bool WriteAheadLog::writeBatch(const Batch& batch)
+{
+	if(batch.data.empty())
+	{
+		return true;
+	}
+	if(batch.segment != fileSegment)
+	{
+		// Previous segment has to be durable, before any later entry is
+		bool ok = file.sync();
+		fileSegment = batch.segment;
+		ok = file.open(getSegmentPath(directory, fileSegment), true) && ok;
+		ok = DurableFile::syncDirectory(directory) && ok;
+		if(!ok)
+		{
+			return false;
+		}
+	}
+	return file.write(batch.data.data(), batch.data.size());
+}
+
+void WriteAheadLog::append(const EntryType type, const std::vector<char>& payload)
+{
+	EntryHeader header;
+	header.size = payload.size();
+	header.type = type;
+	header.checksum = checksum(payload.data(), payload.size());
+	
+	{
+		std::lock_guard lock{mutex};
+		if(!writerThread.joinable())
+		{
+			return;
+		}
+		if(pending.empty() || pending.back().segment != currentSegment)
+		{
+			pending.push_back({currentSegment, {}});
+		}
+		auto& data = pending.back().data;
+		data.insert(data.end(), reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header) + sizeof(header));
+		data.insert(data.end(), payload.begin(), payload.end());
+	}
+	condition.notify_one();
+}
+
+void WriteAheadLog::appendSetControllerRecord(const IdType id, const ControllerRecord& record)
+{
+	std::vector<char> payload;
+	appendControllerRecord(payload, id, record);
+	append(EntryType::SetControllerRecord, payload);
+}
+
+void WriteAheadLog::appendEraseControllerRecord(const IdType id, const uint64_t version)
+{
+	std::vector<char> payload(sizeof(id) + sizeof(version));
+	std::memcpy(payload.data(), &id, sizeof(id));
+	std::memcpy(payload.data() + sizeof(id), &version, sizeof(version));
+	append(EntryType::EraseControllerRecord, payload);
+}
+
+uint32_t WriteAheadLog::startNewSegment()
+{
+	std::lock_guard lock{mutex};
+	return ++currentSegment;
+}
+
+void WriteAheadLog::removeSegmentsBefore(const uint32_t segment)
+{
+	for(const auto oldSegment : listSegments(directory))
+	{
+		if(oldSegment >= segment)
+		{
+			break;
+		}
+		std::error_code ignored;
+		fs::remove(getSegmentPath(directory, oldSegment), ignored);
+	}
+	DurableFile::syncDirectory(directory);
+}
+
+}
+
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "asio_lib.hpp"
+#include "DatabaseData.hpp"
+#include "durableFile.hpp"
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <cstddef>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace db
+{
+
+class Database;
+
+namespace persistence
+{
+
+// Endpoint in a fixed-size, platform independent form
+struct EncodedEndpoint
+{
+	uint8_t family = 0; // 0 - none, 4 - IPv4, 6 - IPv6
+	uint8_t reserved = 0;
+	uint16_t port = 0;
+	uint8_t address[16] = {};
+	
+	static EncodedEndpoint encode(const asioudp::endpoint& endpoint);
+	asioudp::endpoint decode() const;
+};
+
+// Encoded ControllerRecord is a RecordHeader, followed by nameLength bytes of the name, and then by the version (uint64_t).
+// Records written before versions were introduced end with the name
+struct RecordHeader
+{
+	IdType id;
+	uint16_t nameLength;
+	EncodedEndpoint endpoint;
+};
+
+// Appends the encoded record to the end of out
+void appendControllerRecord(std::vector<char>& out, const IdType id, const ControllerRecord& record);
+
+// Decodes a record from [it, end), and advances it past the record. Returns false if the data is invalid or truncated.
+// The version is read only if versioned is set, otherwise it is left at 0
+bool readControllerRecord(const char*& it, const char* end, IdType& id, ControllerRecord& record, const bool versioned);
+
+// Fast, non-cryptographic (FNV-1a) checksum, for detecting torn or corrupted files
+uint64_t checksum(const char* data, const size_t size);
+
+/// Snapshots ///
+
+// Snapshot file is a SnapshotHeader, followed by recordsCount encoded records, in order of slots,
+// and then by freeSlotsCount ids, that free slots of the table would get when reused.
+// Version 1 snapshots have no changeVersion in the header, and no versions in the records
+struct SnapshotHeader
+{
+	static constexpr char Magic[8] = {'W', 'O', 'Z', 'E', 'K', 'D', 'B', 'S'};
+	static constexpr uint32_t CurrentVersion = 2;
+	
+	char magic[8];
+	uint32_t version;
+	uint32_t recordsCount;
+	uint64_t bodySize;
+	uint64_t bodyChecksum;
+	uint32_t walSegment; // first segment of the write-ahead log, that has to be replayed on top of the snapshot
+	uint32_t freeSlotsCount;
+	uint64_t changeVersion; // current version of the change log
+	
+	static constexpr size_t Version1Size = 40;
+};
+static_assert(offsetof(SnapshotHeader, changeVersion) == SnapshotHeader::Version1Size);
+
+// Serializes all controllers. Can be called while the database is in use,
+// each record is consistent on its own, but records may come from slightly different moments
+std::vector<char> serializeSnapshot(Database& database, const uint32_t walSegment);
+
+// Restores the controllers into an empty database, preserving their ids and generations of free slots.
+// Returns false if the snapshot is invalid
+bool restoreSnapshot(Database& database, const char* data, const size_t size, uint32_t& walSegment);
+
+/// Write-ahead log ///
+
+// Append-only log of database mutations, made since the last snapshot.
+// Appending only copies the entry into a memory buffer. A dedicated writer thread writes out everything
+// appended meanwhile and syncs it with a single fdatasync (group commit), so callers never wait for the disk.
+// The log is split into numbered segment files. Each snapshot starts a new segment, and once it is saved,
+// all older segments are removed, as everything in them is already a part of the snapshot.
+// Replaying an entry is idempotent, so entries already reflected in the snapshot can be safely replayed again.
+class WriteAheadLog
+{
+public:
+	
+	enum class EntryType : uint8_t
+	{
+		SetControllerRecord = 1,
+		EraseControllerRecord = 2,
+	};
+	
+	struct EntryHeader
+	{
+		uint32_t size; // of the payload, following the header
+		EntryType type;
+		uint8_t reserved[3] = {};
+		uint64_t checksum; // of the payload
+	};
+	
+private:
+	
+	struct Batch
+	{
+		uint32_t segment;
+		std::vector<char> data;
+	};
+	
+	fs::path directory;
+	
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<Batch> pending;
+	uint32_t currentSegment = 0;
+	bool stopping = false;
+	bool failed = false;
+	
+	std::thread writerThread;
+	
+	// Used only by the writer thread
+	DurableFile file;
+	uint32_t fileSegment = 0;
+	
+	void writerLoop();
+	bool writeBatch(const Batch& batch);
+	
+	void append(const EntryType type, const std::vector<char>& payload);
+	
+public:
+	
+	static constexpr const char* FilePrefix = "controllers.wal.";
+	
+	static fs::path getSegmentPath(const fs::path& directory, const uint32_t segment);
+	
+	// Returns numbers of all segments in the directory, in ascending order
+	static std::vector<uint32_t> listSegments(const fs::path& directory);
+	
+	// Applies all entries from segments starting with firstSegment. Stops at the first torn or corrupted entry of a segment.
+	// Returns the number of the last segment found (or firstSegment - 1, if there were none). Segments are numbered from 1
+	static uint32_t replay(Database& database, const fs::path& directory, const uint32_t firstSegment);
+	
+	// New entries are appended to a new segment, with given number
+	bool open(const fs::path& directory, const uint32_t segment);
+	bool isOpen() { return writerThread.joinable(); }
+	
+	// Writes out everything appended so far, and stops the writer thread
+	void close();
+	
+	// True if writing to the disk failed at some point
+	bool hasFailed();
+	
+	// Has to be called right after the mutation is applied, while the record is still locked,
+	// so that entries of a record are appended in the same order the mutations were applied
+	void appendSetControllerRecord(const IdType id, const ControllerRecord& record);
+	void appendEraseControllerRecord(const IdType id, const uint64_t version);
+	
+	// Entries appended from now on go to a new segment. Returns its number
+	uint32_t startNewSegment();
+	
+	// Removes segment files older than given one
+	void removeSegmentsBefore(const uint32_t segment);
+	
+	WriteAheadLog() {}
+	WriteAheadLog(const WriteAheadLog&) = delete;
+	~WriteAheadLog() { close(); }
+};
+
+}
+
+}
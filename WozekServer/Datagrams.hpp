@@ -98,6 +98,99 @@ namespace LookupIdForName
 	};
 }
 
+namespace BulkLookupIdForName
+{
+	constexpr static char request_id = 0x21;
+	
+	constexpr static uint32_t MaxNamesCount = 1024 * 16;
+	constexpr static uint32_t MaxTotalLength = 1024 * 1024;
+	
+	struct Request
+	{
+		uint32_t namesCount;
+		uint32_t totalLength;
+		// totalLength bytes with namesCount names, each being uint32_t nameLength followed by the name
+	};
+	
+	struct Response
+	{
+		uint32_t namesCount;
+		// namesCount ids (IdType), in order of the requested names. 0 if the name dosen't exist
+	};
+}
+namespace ScanNamesByPrefix
+{
+	constexpr static char request_id = 0x22;
+	
+	constexpr static uint32_t MaxPrefixLength = 128;
+	constexpr static uint32_t MaxLimit = 4096;
+	constexpr static uint32_t BatchSize = 256;
+	
+	// Returns up to limit names starting with the prefix, in sorted order.
+	// To get the next page, the last name received is sent back as "after"
+	struct Request
+	{
+		uint32_t prefixLength;
+		uint32_t afterLength; // 0 to start from the first matching name
+		uint32_t limit;
+		// prefixLength bytes of the prefix, followed by afterLength bytes of the name to start after
+	};
+	
+	// Response is streamed as a sequence of batches, of at most BatchSize entries each, the last one marked Final
+	struct BatchHeader
+	{
+		enum Flags : uint8_t {
+			Final = 1, // no more batches follow for this request
+			More = 2, // set on the final batch, if more names match beyond the limit
+		};
+		
+		uint32_t count;
+		uint8_t flags;
+		// count entries, each being IdType id, uint32_t nameLength and the name
+	};
+}
+namespace ControllerChangesSince
+{
+	constexpr static char request_id = 0x23;
+	
+	struct Request
+	{
+		uint64_t version; // last version received, 0 if nothing was received yet
+	};
+	
+	struct Response
+	{
+		enum Flags : uint8_t {
+			FullState = 1, // requested version is too old, entries hold all controllers, and any other controller is gone
+		};
+		
+		uint64_t version; // to be sent in the next request
+		uint32_t count;
+		uint8_t flags;
+		// count entries, each being an Entry followed by nameLength bytes of the name
+	};
+	
+	struct Entry
+	{
+		IdType id;
+		uint32_t nameLength; // 0 if the controller was erased
+		uint64_t version;
+	};
+	static_assert(sizeof(Entry) == 16);
+}
+namespace MetricsSnapshot
+{
+	constexpr static char request_id = 0x24;
+	
+	// Request has no body. Response is the text of the snapshot, with a metric per line in the Prometheus text format:
+	// name, optional labels in braces and the value, e.g. wozek_latency_count{request="TcpEcho"} 12
+	struct Response
+	{
+		uint32_t length;
+		// length bytes of the text
+	};
+}
+
 // UDP
 
 
@@ -132,6 +225,22 @@ struct UdpUpdateState
 	//static_assert(sizeof(Request) == sizeof(Request::rotation) + sizeof(Request::id) + 1);
 };
 
+// State of a controller, that has joined the world (see JoinWorld), sent by the controller from the address it registered from.
+// Desired state is what the controller is told to do, measured one is what its sensors report
+namespace UdpUpdateControllerState
+{
+	constexpr static char request_id = 0x71;
+	
+	struct Request
+	{
+		IdType controllerId;
+		IdType worldId;
+		Controller::DesiredState desiredState;
+		Controller::MeasuredState measuredState;
+	};
+	static_assert(sizeof(Request) == 44);
+}
+
 namespace SegmentedFileTransfer
 {	
 	struct Header
@@ -145,8 +254,21 @@ namespace SegmentedFileTransfer
 	enum Error {
 		Good = 0,
 		FileSystem = 1,
-		SegmentTooLong = 2
+		SegmentTooLong = 2,
+		InvalidHeader = 3
 	};
+	
+	// Sent by the receiver in response to a Header, if the window of the previous Negotiation has been used up.
+	// The sender may then send the data of current segment, and (window - 1) more segments without awaiting a response.
+	// Following segments should not be longer than segmentLength.
+	// Once the whole file is received, the receiver sends one more, with code Good if the file was stored
+	struct Negotiation
+	{
+		uint64_t segmentLength;
+		uint32_t window;
+		uint32_t code; // Error
+	};
+	static_assert(sizeof(Negotiation) == sizeof(Negotiation::segmentLength) + sizeof(Negotiation::window) + sizeof(Negotiation::code) );
 };
 
 
@@ -168,6 +290,7 @@ namespace RegisterAsController
 			Accepted = 0,
 			Invalid = 1,
 			InUse = 2,
+			Full = 3,
 		};
 		
 		IdType id;
@@ -176,6 +299,41 @@ namespace RegisterAsController
 	static_assert(sizeof(ResponseHeader) == sizeof(ResponseHeader::ResultCode)*4 + sizeof(ResponseHeader::id));
 };
 
+// Adds the controller to a running world, which then simulates it, and streams its state to the main host of the world.
+// Has to be sent from the address the controller registered from
+namespace JoinWorld
+{
+	constexpr static char request_id = 0x51;
+	
+	struct Request
+	{
+		IdType controllerId;
+		IdType worldId;
+	};
+	
+	struct Response
+	{
+		enum ResultCode : char {
+			Accepted = 0,
+			UnknownController = 1, // or registered from another address
+			UnknownWorld = 2,
+		};
+		
+		ResultCode resultCode;
+	};
+	static_assert(sizeof(Request) == 8);
+	static_assert(sizeof(Response) == 1);
+}
+
+// Removes the controller from the world. Request and response are the same as of JoinWorld
+namespace LeaveWorld
+{
+	constexpr static char request_id = 0x52;
+	
+	using Request = JoinWorld::Request;
+	using Response = JoinWorld::Response;
+}
+
 
 
 /// OLD ////////////////////////////
@@ -280,6 +438,8 @@ namespace StartTheWorld
 
 namespace FileTransfer
 {
+	// Once the upload is accepted, the file is sent as a segmented file transfer (see SegmentedFileTransfer),
+	// and replaces the stored file of that name only when it is received whole
 	namespace Upload
 	{
 		constexpr static char Code = 0x05;
@@ -302,6 +462,7 @@ namespace FileTransfer
 		static_assert(sizeof(Response) == 1);
 	}
 	
+	// Once the download is accepted, fileSize bytes of the file follow the response
 	namespace Download
 	{
 		constexpr static char Code = 0x06;
@@ -328,6 +489,8 @@ namespace FileTransfer
 
 // UDP
 
+// State of all controllers of a world, sent to its main host every tick.
+// It is split into packetsCount datagrams, each starting with Code and a Header, and holding controllersCount of the controllers
 struct UpdateHostState
 {
 	constexpr static char Code = 0x01;
@@ -335,8 +498,11 @@ struct UpdateHostState
 	struct Header
 	{
 		IdType worldId;
-		uint64_t timepoint;
-		uint64_t controllersCount;
+		uint16_t packetIndex;
+		uint16_t packetsCount;
+		uint64_t timepoint; // tick of the world, counted from 1, the same for all packets of the update
+		uint32_t controllersCount;
+		uint32_t tickRate; // of the world, ticks per second, so that the host can place the ticks on its timeline
 	
 		size_t getSizeof() {return sizeof(UpdateHostState) + sizeof(ControllerData) * controllersCount;}
 	};
@@ -350,5 +516,42 @@ struct UpdateHostState
 	Header header;
 	// ContollerData[]	
 };
+static_assert(sizeof(UpdateHostState::Header) == 24);
+
+// The same state as UpdateHostState, with quantized fields, encoded relative to the state of the baseline tick (see stateCodec.hpp).
+// Each datagram is Code and a Header, followed by bitsCount bits of controllersCount bit-packed entries, sorted by id
+namespace UpdateHostStateDelta
+{
+	constexpr static char Code = 0x02;
+	
+	struct Header
+	{
+		IdType worldId;
+		uint16_t packetIndex;
+		uint16_t packetsCount;
+		uint64_t timepoint; // tick of the world, counted from 1, the same for all packets of the update
+		uint64_t baseline; // tick acknowledged by the host, which entries are relative to, 0 if they are relative to zero states
+		uint32_t controllersCount;
+		uint32_t bitsCount;
+		Vector3f steps; // quantization steps of position, orientation and wheel speed
+		uint32_t tickRate; // of the world, ticks per second
+	};
+	static_assert(sizeof(Header) == 48);
+}
+
+// Sent by the main host to the server, once it has received all packets of an UpdateHostStateDelta.
+// Following updates are encoded relative to the acknowledged tick
+namespace AckHostState
+{
+	constexpr static char request_id = 0x72;
+	
+	struct Request
+	{
+		IdType worldId;
+		uint32_t reserved = 0;
+		uint64_t timepoint;
+	};
+	static_assert(sizeof(Request) == 16);
+}
 
 }
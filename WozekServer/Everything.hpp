@@ -15,6 +15,7 @@ namespace fs = std::filesystem;
 #include "ipAuthorization.hpp"
 #include "fileManager.hpp"
 #include "DatabaseManager.hpp"
+#include "worldManager.hpp"
 #include "TCPWozekServer.hpp"
 
 
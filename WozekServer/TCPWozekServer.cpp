@@ -1,8 +1,10 @@
 #include "TCPWozekServer.hpp"
+#include "metrics.hpp"
 
 #include <filesystem>
 #include <string_view>
 #include <algorithm>
+#include <cstring>
 
 
 namespace tcp
@@ -12,7 +14,8 @@ namespace tcp
 
 void WozekSession::awaitRequest()
 {
-	log("Awaiting request");
+	finishRequest();
+	log("Awaiting request"_fmt);
 	resetState();
 	asyncReadObjects<char>(
 		&WozekSession::handleReceivedRequestId,
@@ -21,6 +24,7 @@ void WozekSession::awaitRequest()
 }
 void WozekSession::awaitRequestSilent()
 {
+	finishRequest();
 	resetState();
 	asyncReadObjects<char>(
 		&WozekSession::handleReceivedRequestId,
@@ -29,6 +33,15 @@ void WozekSession::awaitRequestSilent()
 }
 
 
+void WozekSession::finishRequest()
+{
+	if(requestLatency)
+	{
+		logger.latency(*requestLatency, std::chrono::steady_clock::now() - requestStart);
+		requestLatency.reset();
+	}
+}
+
 void WozekSession::handleReceivedRequestId(char id)
 {
 	if(id == data::HeartbeatCode) // heartbeat
@@ -37,59 +50,102 @@ void WozekSession::handleReceivedRequestId(char id)
 		return;
 	}
 	
-	log("Handling request code: ", static_cast<int>(id));
+	requestStart = std::chrono::steady_clock::now();
+	log("Handling request code: "_fmt, static_cast<int>(id));
 	switch (id)
 	{
 		case data::EchoRequest::request_id:
 		{
+			requestLatency = Logger::Latency::TcpEcho;
 			receiveEchoRequest();
 			break;
 		}
 		case data::RegisterAsController::request_id:
 		{
+			requestLatency = Logger::Latency::TcpRegisterAsController;
 			receiveRegisterAsControllerRequest();
 			break;
 		}
 		case data::LookupIdForName::request_id:
 		{
+			requestLatency = Logger::Latency::TcpLookupIdForName;
 			receiveLookupIdForNameRequest();
 			break;
 		}
-		/*
-		case data::RegisterNewHost::Code : // Register as new host
+		case data::BulkLookupIdForName::request_id:
 		{
-			handleRegisterHostRequest();
+			requestLatency = Logger::Latency::TcpBulkLookupIdForName;
+			receiveBulkLookupIdForNameRequest();
 			break;
 		}
-		case data::UploadMap::Code : // Host uploading a map file
-		{				
-			handleUploadMapRequest();
+		case data::ScanNamesByPrefix::request_id:
+		{
+			requestLatency = Logger::Latency::TcpScanNamesByPrefix;
+			receiveScanNamesByPrefixRequest();
 			break;
 		}
-		case data::DownloadMap::Code : // Host downloading a map file
-		{				
-			handleDownloadMapRequest();
+		case data::ControllerChangesSince::request_id:
+		{
+			requestLatency = Logger::Latency::TcpControllerChangesSince;
+			receiveControllerChangesSinceRequest();
+			break;
+		}
+		case data::StartTheWorld::Code:
+		{
+			requestLatency = Logger::Latency::TcpStartTheWorld;
+			receiveStartTheWorldRequest();
+			break;
+		}
+		case data::JoinWorld::request_id:
+		{
+			requestLatency = Logger::Latency::TcpJoinWorld;
+			receiveJoinWorldRequest();
+			break;
+		}
+		case data::LeaveWorld::request_id:
+		{
+			requestLatency = Logger::Latency::TcpLeaveWorld;
+			receiveLeaveWorldRequest();
+			break;
+		}
+		case data::FileTransfer::Upload::Code:
+		{
+			requestLatency = Logger::Latency::TcpUploadFile;
+			receiveUploadFileRequest();
 			break;
 		}
-		case data::StartTheWorld::Code : // Host starting the world 
+		case data::FileTransfer::Download::Code:
 		{
-			handleStartTheWorld();
+			requestLatency = Logger::Latency::TcpDownloadFile;
+			receiveDownloadFileRequest();
 			break;
 		}
-		case data::FileTransfer::Upload::Code :
+		case data::MetricsSnapshot::request_id:
 		{
-			handleUploadFile();
+			requestLatency = Logger::Latency::TcpMetricsSnapshot;
+			handleMetricsSnapshotRequest();
 			break;
 		}
-		case data::FileTransfer::Download::Code :
+		/*
+		case data::RegisterNewHost::Code : // Register as new host
 		{
-			handleDownloadFile();
+			handleRegisterHostRequest();
+			break;
+		}
+		case data::UploadMap::Code : // Host uploading a map file
+		{				
+			handleUploadMapRequest();
+			break;
+		}
+		case data::DownloadMap::Code : // Host downloading a map file
+		{				
+			handleDownloadMapRequest();
 			break;
 		}
 		*/
 		default:
 		{
-			logError(Logger::Error::TcpInvalidRequests, "Request code not recognized");
+			logError(Logger::Error::TcpInvalidRequests, "Request code not recognized"_fmt);
 			shutdownSession(); // if not recognized, close connection
 		}
 	}
@@ -100,7 +156,7 @@ void WozekSession::handleReceivedRequestId(char id)
 void WozekSession::receiveEchoRequest()
 {
 	this->setState<States::EchoMessageBuffer>();
-	log("Receiving Echo Request");
+	log("Receiving Echo Request"_fmt);
 	receiveEchoRequestMessagePart();
 }
 void WozekSession::receiveEchoRequestMessagePart()
@@ -128,14 +184,14 @@ void WozekSession::handleEchoRequestMessagePart(const char c)
 }
 void WozekSession::abortEchoRequest()
 {
-	logError(Logger::Error::TcpEchoTooLong, "Received echo message was too long (over ", MaxEchoRequestMessageLength, " characters)");
+	logError(Logger::Error::TcpEchoTooLong, "Received echo message was too long (over "_fmt, MaxEchoRequestMessageLength, " characters)"_fmt);
 	shutdownSession();
 }
 
 void WozekSession::sendEchoResponse()
 {
 	auto& state = getState<States::EchoMessageBuffer>();
-	log("Echoing message with length: ", state.buffer.size(), " \"", state.buffer, "\"");
+	log("Echoing message with length: "_fmt, state.buffer.size(), " \""_fmt, state.buffer, "\""_fmt);
 	asyncWrite(
 		asio::buffer(state.buffer.c_str(), state.buffer.size() + 1),
 		&WozekSession::finilizeRequest,
@@ -148,7 +204,7 @@ void WozekSession::sendEchoResponse()
 
 void WozekSession::receiveLookupIdForNameRequest()
 {
-	log("Receiving Id Lookup Request");
+	log("Receiving Id Lookup Request"_fmt);
 	asyncReadObjects<data::LookupIdForName::Request>(
 		&WozekSession::handleLookupIdForNameRequest,
 		&WozekSession::errorAbort
@@ -157,14 +213,14 @@ void WozekSession::receiveLookupIdForNameRequest()
 
 void WozekSession::handleLookupIdForNameRequest(const data::LookupIdForName::Request& request)
 {
-	if(request.nameLength <= 0)
+	if(request.nameLength <= 0 || request.nameLength > buffer.getTotalBufferSize())
 	{
-		logError(Logger::Error::TcpInvalidNameSizeForLookup , "Invalid name size: ", request.nameLength);
+		logError(Logger::Error::TcpInvalidNameSizeForLookup , "Invalid name size: "_fmt, request.nameLength);
 		shutdownSession();
 		return;
 	}
 	
-	log("Receiving name of length: ", request.nameLength);
+	log("Receiving name of length: "_fmt, request.nameLength);
 	asyncRead(
 		buffer.get(request.nameLength),
 		[=]{handleLookupIdForNameRequestData(request.nameLength);},
@@ -174,10 +230,9 @@ void WozekSession::handleLookupIdForNameRequest(const data::LookupIdForName::Req
 
 void WozekSession::handleLookupIdForNameRequestData(const size_t nameLength)
 {
-	std::string name(nameLength, 0);
-	buffer.loadBytes(name.data(), nameLength);
+	const std::string_view name(static_cast<const char*>(buffer.get().data()), nameLength);
 	
-	log("Lookung up name: ", name);
+	log("Lookung up name: "_fmt, std::string(name)); // logs are written asynchronously, so the name cannot refer to the buffer
 	
 	auto& index = db::databaseManager.getDatabase().controllerNameIndex;
 	const auto res = index.get(name);
@@ -190,7 +245,162 @@ void WozekSession::handleLookupIdForNameRequestData(const size_t nameLength)
 
 void WozekSession::finalizeLookupIdForNameRequest(const data::LookupIdForName::Response& response)
 {
-	log("Responding with looked up id: ", response.id);
+	log("Responding with looked up id: "_fmt, response.id);
+	asyncWriteObjects(
+		&WozekSession::awaitRequest,
+		&WozekSession::errorAbort,
+		response
+	);
+}
+
+
+/// World ///
+
+void WozekSession::receiveStartTheWorldRequest()
+{
+	log("Receiving Start The World Request"_fmt);
+	asyncReadObjects<data::StartTheWorld::RequestHeader>(
+		&WozekSession::handleStartTheWorldRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleStartTheWorldRequest(const data::StartTheWorld::RequestHeader& request)
+{
+	data::StartTheWorld::ResponseHeader response = {};
+	response.code = data::StartTheWorld::ResponseHeader::Failure;
+	
+	// Only hosts can start worlds. There is no registration of hosts, so they are the addresses listed in the hosts file
+	if(!hostAuthorizer.checkIfIpv4IsAllowed(remoteEndpoint.address().to_v4().to_uint()))
+	{
+		logError(Logger::Error::TcpForbidden, "Unable to start a world, the address is not allowed to host worlds"_fmt);
+		finalizeStartTheWorldRequest(response);
+		return;
+	}
+	
+	if(request.port == 0 || startedWorlds.size() >= MaxWorldsPerSession)
+	{
+		logError(Logger::Error::TcpStartTheWorldFailed, "Unable to start a world on port "_fmt, request.port, " with "_fmt, startedWorlds.size(), " worlds already started"_fmt);
+		finalizeStartTheWorldRequest(response);
+		return;
+	}
+	
+	response.worldId = worldManager.createWorld({remoteEndpoint.address(), request.port}, config.worldTickSettings);
+	if(response.worldId == 0)
+	{
+		logError(Logger::Error::TcpStartTheWorldFailed, "Too many worlds"_fmt);
+		finalizeStartTheWorldRequest(response);
+		return;
+	}
+	
+	startedWorlds.push_back(response.worldId);
+	response.code = data::StartTheWorld::ResponseHeader::Success;
+	log("World started successfuly. Id: "_fmt, response.worldId);
+	finalizeStartTheWorldRequest(response);
+}
+
+void WozekSession::finalizeStartTheWorldRequest(const data::StartTheWorld::ResponseHeader& response)
+{
+	log("Sending Start The World Response"_fmt);
+	
+	asyncWriteObjects(
+		&WozekSession::awaitRequest,
+		&WozekSession::errorAbort,
+		response
+	);
+}
+
+std::optional<asioudp::endpoint> WozekSession::getOwnControllerEndpoint(const data::IdType controllerId)
+{
+	std::optional<asioudp::endpoint> res;
+	db::databaseManager.getDatabase().controllerTable.accessSafeRead(controllerId, [&](auto record){
+		if(record && record->endpoint.address() == remoteEndpoint.address())
+			res = record->endpoint;
+	});
+	return res;
+}
+
+void WozekSession::receiveJoinWorldRequest()
+{
+	log("Receiving Join World Request"_fmt);
+	asyncReadObjects<data::JoinWorld::Request>(
+		&WozekSession::handleJoinWorldRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleJoinWorldRequest(const data::JoinWorld::Request& request)
+{
+	data::JoinWorld::Response response;
+	response.resultCode = data::JoinWorld::Response::Accepted;
+	
+	const auto endpoint = getOwnControllerEndpoint(request.controllerId);
+	if(!endpoint)
+	{
+		logError(Logger::Error::TcpJoinWorldFailed, "Controller "_fmt, request.controllerId, " is not registered from this address"_fmt);
+		response.resultCode = data::JoinWorld::Response::UnknownController;
+		finalizeJoinOrLeaveWorldRequest(response);
+		return;
+	}
+	
+	// Joining again changes nothing, as the world keeps a controller only once
+	const bool found = worldManager.post(request.worldId, [id = request.controllerId, endpoint = *endpoint](World& world){
+		world.addController(id, endpoint);
+	});
+	if(!found)
+	{
+		logError(Logger::Error::TcpJoinWorldFailed, "World "_fmt, request.worldId, " not found"_fmt);
+		response.resultCode = data::JoinWorld::Response::UnknownWorld;
+		finalizeJoinOrLeaveWorldRequest(response);
+		return;
+	}
+	
+	db::databaseManager.getDatabase().controllerStateTable.touch(request.controllerId);
+	log("Controller "_fmt, request.controllerId, " joins world "_fmt, request.worldId);
+	finalizeJoinOrLeaveWorldRequest(response);
+}
+
+void WozekSession::receiveLeaveWorldRequest()
+{
+	log("Receiving Leave World Request"_fmt);
+	asyncReadObjects<data::LeaveWorld::Request>(
+		&WozekSession::handleLeaveWorldRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleLeaveWorldRequest(const data::LeaveWorld::Request& request)
+{
+	data::LeaveWorld::Response response;
+	response.resultCode = data::LeaveWorld::Response::Accepted;
+	
+	if(!getOwnControllerEndpoint(request.controllerId))
+	{
+		logError(Logger::Error::TcpJoinWorldFailed, "Controller "_fmt, request.controllerId, " is not registered from this address"_fmt);
+		response.resultCode = data::LeaveWorld::Response::UnknownController;
+		finalizeJoinOrLeaveWorldRequest(response);
+		return;
+	}
+	
+	const bool found = worldManager.post(request.worldId, [id = request.controllerId](World& world){
+		world.removeController(id);
+	});
+	if(!found)
+	{
+		logError(Logger::Error::TcpJoinWorldFailed, "World "_fmt, request.worldId, " not found"_fmt);
+		response.resultCode = data::LeaveWorld::Response::UnknownWorld;
+		finalizeJoinOrLeaveWorldRequest(response);
+		return;
+	}
+	
+	log("Controller "_fmt, request.controllerId, " leaves world "_fmt, request.worldId);
+	finalizeJoinOrLeaveWorldRequest(response);
+}
+
+void WozekSession::finalizeJoinOrLeaveWorldRequest(const data::JoinWorld::Response& response)
+{
+	log("Sending Join or Leave World Response"_fmt);
+	
 	asyncWriteObjects(
 		&WozekSession::awaitRequest,
 		&WozekSession::errorAbort,
@@ -198,12 +408,271 @@ void WozekSession::finalizeLookupIdForNameRequest(const data::LookupIdForName::R
 	);
 }
 
+void WozekSession::receiveBulkLookupIdForNameRequest()
+{
+	log("Receiving Bulk Id Lookup Request"_fmt);
+	asyncReadObjects<data::BulkLookupIdForName::Request>(
+		&WozekSession::handleBulkLookupIdForNameRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleBulkLookupIdForNameRequest(const data::BulkLookupIdForName::Request& request)
+{
+	if(request.namesCount == 0 || request.namesCount > data::BulkLookupIdForName::MaxNamesCount ||
+	   request.totalLength < request.namesCount * sizeof(uint32_t) || request.totalLength > data::BulkLookupIdForName::MaxTotalLength)
+	{
+		logError(Logger::Error::TcpInvalidBulkLookup, "Invalid bulk lookup of "_fmt, request.namesCount, " names with total length "_fmt, request.totalLength);
+		shutdownSession();
+		return;
+	}
+	
+	auto& state = setState<States::BulkLookup>();
+	state.names.resize(request.totalLength);
+	
+	log("Receiving "_fmt, request.namesCount, " names of total length: "_fmt, request.totalLength);
+	asyncRead(
+		asio::buffer(state.names),
+		[=]{handleBulkLookupIdForNameRequestData(request.namesCount);},
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleBulkLookupIdForNameRequestData(const uint32_t namesCount)
+{
+	auto& state = getState<States::BulkLookup>();
+	
+	data::BulkLookupIdForName::Response response;
+	response.namesCount = namesCount;
+	state.response.resize(sizeof(response) + namesCount * sizeof(data::IdType));
+	std::memcpy(state.response.data(), &response, sizeof(response));
+	
+	const char* it = state.names.data();
+	const char* const end = it + state.names.size();
+	char* idDest = state.response.data() + sizeof(response);
+	bool valid = true;
+	
+	{
+		// All names are resolved within one read section of the index
+		auto& index = db::databaseManager.getDatabase().controllerNameIndex;
+		auto section = index.getReadSection();
+		
+		for(uint32_t i=0; i<namesCount; i++)
+		{
+			uint32_t nameLength;
+			if(size_t(end - it) < sizeof(nameLength))
+			{
+				valid = false;
+				break;
+			}
+			std::memcpy(&nameLength, it, sizeof(nameLength));
+			it += sizeof(nameLength);
+			if(size_t(end - it) < nameLength)
+			{
+				valid = false;
+				break;
+			}
+			
+			const data::IdType id = index.getInReadSection(std::string_view(it, nameLength));
+			std::memcpy(idDest, &id, sizeof(id));
+			idDest += sizeof(id);
+			it += nameLength;
+		}
+	}
+	
+	if(!valid || it != end)
+	{
+		logError(Logger::Error::TcpInvalidBulkLookup, "Names of bulk lookup do not match their declared lengths"_fmt);
+		shutdownSession();
+		return;
+	}
+	
+	log("Responding with "_fmt, namesCount, " looked up ids"_fmt);
+	asyncWrite(
+		asio::buffer(state.response),
+		&WozekSession::finilizeRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::receiveScanNamesByPrefixRequest()
+{
+	log("Receiving Scan Names By Prefix Request"_fmt);
+	asyncReadObjects<data::ScanNamesByPrefix::Request>(
+		&WozekSession::handleScanNamesByPrefixRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleScanNamesByPrefixRequest(const data::ScanNamesByPrefix::Request& request)
+{
+	if(request.prefixLength > data::ScanNamesByPrefix::MaxPrefixLength ||
+	   request.afterLength > sizeof(data::RegisterAsController::RequestHeader::name) ||
+	   request.limit == 0 || request.limit > data::ScanNamesByPrefix::MaxLimit)
+	{
+		logError(Logger::Error::TcpInvalidPrefixScan, "Invalid prefix scan with prefix length "_fmt, request.prefixLength,
+				 ", cursor length "_fmt, request.afterLength, " and limit "_fmt, request.limit);
+		shutdownSession();
+		return;
+	}
+	
+	auto& state = setState<States::PrefixScan>();
+	state.request.resize(request.prefixLength + request.afterLength);
+	if(state.request.empty())
+	{
+		handleScanNamesByPrefixRequestData(request);
+		return;
+	}
+	
+	asyncRead(
+		asio::buffer(state.request),
+		[=]{handleScanNamesByPrefixRequestData(request);},
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleScanNamesByPrefixRequestData(const data::ScanNamesByPrefix::Request& request)
+{
+	auto& state = getState<States::PrefixScan>();
+	const std::string_view prefix(state.request.data(), request.prefixLength);
+	const std::string_view after(state.request.data() + request.prefixLength, request.afterLength);
+	
+	// Whole page is collected at once, so that it is consistent, even though it is sent in many batches
+	state.entries.reserve(request.limit);
+	state.more = db::databaseManager.getDatabase().controllerNameIndex.scanPrefix(prefix, after, request.limit,
+		[&](const data::IdType id, const std::string& name){
+			state.entries.emplace_back(id, name);
+		}
+	);
+	
+	log("Responding with "_fmt, state.entries.size(), " names matching the prefix"_fmt);
+	sendScanNamesByPrefixBatch();
+}
+
+void WozekSession::sendScanNamesByPrefixBatch()
+{
+	auto& state = getState<States::PrefixScan>();
+	
+	const size_t count = std::min<size_t>(state.entries.size() - state.sent, data::ScanNamesByPrefix::BatchSize);
+	const bool final = state.sent + count == state.entries.size();
+	
+	data::ScanNamesByPrefix::BatchHeader header;
+	header.count = count;
+	header.flags = final ? data::ScanNamesByPrefix::BatchHeader::Final : 0;
+	if(final && state.more)
+	{
+		header.flags |= data::ScanNamesByPrefix::BatchHeader::More;
+	}
+	
+	state.batch.clear();
+	state.batch.insert(state.batch.end(), reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header) + sizeof(header));
+	for(size_t i=state.sent; i<state.sent + count; i++)
+	{
+		const auto& [id, name] = state.entries[i];
+		const uint32_t nameLength = name.size();
+		state.batch.insert(state.batch.end(), reinterpret_cast<const char*>(&id), reinterpret_cast<const char*>(&id) + sizeof(id));
+		state.batch.insert(state.batch.end(), reinterpret_cast<const char*>(&nameLength), reinterpret_cast<const char*>(&nameLength) + sizeof(nameLength));
+		state.batch.insert(state.batch.end(), name.begin(), name.end());
+	}
+	state.sent += count;
+	
+	if(final)
+	{
+		asyncWrite(
+			asio::buffer(state.batch),
+			&WozekSession::finilizeRequest,
+			&WozekSession::errorAbort
+		);
+		return;
+	}
+	asyncWrite(
+		asio::buffer(state.batch),
+		&WozekSession::sendScanNamesByPrefixBatch,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::receiveControllerChangesSinceRequest()
+{
+	log("Receiving Controller Changes Since Request"_fmt);
+	asyncReadObjects<data::ControllerChangesSince::Request>(
+		&WozekSession::handleControllerChangesSinceRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleControllerChangesSinceRequest(const data::ControllerChangesSince::Request& request)
+{
+	auto& database = db::databaseManager.getDatabase();
+	auto& state = setState<States::ControllerChanges>();
+	
+	data::ControllerChangesSince::Response response = {};
+	state.response.resize(sizeof(response));
+	
+	auto appendEntry = [&](const data::IdType id, const db::ControllerRecord* record){
+		data::ControllerChangesSince::Entry entry;
+		entry.id = id;
+		entry.nameLength = record ? record->name.size() : 0;
+		entry.version = record ? record->version : 0;
+		state.response.insert(state.response.end(), reinterpret_cast<const char*>(&entry), reinterpret_cast<const char*>(&entry) + sizeof(entry));
+		if(record)
+		{
+			state.response.insert(state.response.end(), record->name.begin(), record->name.end());
+		}
+		++response.count;
+	};
+	
+	const bool incremental = database.controllerChangeLog.forEachChangedSince(request.version, response.version, [&](const data::IdType id){
+		database.controllerTable.accessSafeRead(id, [&](const db::ControllerRecord* record){ appendEntry(id, record); });
+	});
+	if(!incremental)
+	{
+		// Records changed while they are being collected get a version newer than the one in the response,
+		// so they will be sent again with the next request
+		response.flags = data::ControllerChangesSince::Response::FullState;
+		database.controllerTable.forEachRecord([&](const data::IdType id, const db::ControllerRecord& record){ appendEntry(id, &record); });
+	}
+	std::memcpy(state.response.data(), &response, sizeof(response));
+	
+	log("Responding with "_fmt, response.count, incremental ? " changed controllers" : " controllers", " up to version "_fmt, response.version);
+	asyncWrite(
+		asio::buffer(state.response),
+		&WozekSession::finilizeRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+
+/// Metrics ///
+
+void WozekSession::handleMetricsSnapshotRequest()
+{
+	log("Handling Metrics Snapshot Request"_fmt);
+	auto& state = setState<States::MetricsSnapshot>();
+	
+	std::ostringstream os;
+	metrics::writeSnapshot(os);
+	
+	data::MetricsSnapshot::Response response;
+	const std::string text = os.str();
+	response.length = text.size();
+	state.response.assign(reinterpret_cast<const char*>(&response), sizeof(response));
+	state.response += text;
+	
+	log("Responding with metrics snapshot of "_fmt, response.length, " bytes"_fmt);
+	asyncWrite(
+		asio::buffer(state.response),
+		&WozekSession::finilizeRequest,
+		&WozekSession::errorAbort
+	);
+}
+
 
 /// Controller Controller ///
 
 void WozekSession::receiveRegisterAsControllerRequest()
 {
-	log("Receiving Register As Controller Request");
+	log("Receiving Register As Controller Request"_fmt);
 	asyncReadObjects<data::RegisterAsController::RequestHeader>(
 		&WozekSession::handleRegisterAsControllerRequest,
 		&WozekSession::errorAbort
@@ -212,12 +681,12 @@ void WozekSession::receiveRegisterAsControllerRequest()
 
 void WozekSession::handleRegisterAsControllerRequest(const data::RegisterAsController::RequestHeader& request)
 {
-	auto nameSize = strlen(request.name);
-	log("Received Register As Controller Request with name (", nameSize, ") : ", request.name);
+	auto nameSize = strnlen(request.name, sizeof(request.name));
+	log("Received Register As Controller Request with name ("_fmt, nameSize, ") : "_fmt, request.name);
 	
 	if(nameSize <= 2 || nameSize >= sizeof(request.name))
 	{
-		logError(Logger::Error::TcpRegisterAsControllerInvalidName, "Invalid name");
+		logError(Logger::Error::TcpRegisterAsControllerInvalidName, "Invalid name"_fmt);
 		data::RegisterAsController::ResponseHeader response;
 		response.resultCode = data::RegisterAsController::ResponseHeader::ResultCode::Invalid;
 		finalizeRegisterAsControllerRequest(response);
@@ -225,40 +694,48 @@ void WozekSession::handleRegisterAsControllerRequest(const data::RegisterAsContr
 	}
 	else
 	{
-		log("Name Accepted");
-		
-		std::string name;
-		name.resize(nameSize);
-		std::memcpy(name.data(), request.name, nameSize);
+		log("Name Accepted"_fmt);
 		
-		auto& table = db::databaseManager.getDatabase().controllerTable;
-		auto& index = db::databaseManager.getDatabase().controllerNameIndex;
+		const std::string_view name(request.name, nameSize);
+		auto& database = db::databaseManager.getDatabase();
+		const auto endpoint = asioudp::endpoint(remoteEndpoint.address(), 0); // TODO set port
 		
 		data::RegisterAsController::ResponseHeader response;
 		response.resultCode = data::RegisterAsController::ResponseHeader::ResultCode::Accepted;
 		
+		const auto res = db::findOrInsert(database.controllerTable, database.controllerNameIndex, name, [&](const auto id, auto record, const bool created){
+			if(created)
+			{
+				record->name = name;
+				database.controllerStateTable.activate(id);
+			}
+			else
+			{
+				database.controllerStateTable.touch(id);
+				
+				// Registering again from the same endpoint changes nothing, that replicas or the log would need to know about
+				if(record->endpoint == endpoint)
+					return;
+			}
+			record->endpoint = endpoint;
+			record->version = database.controllerChangeLog.append(id);
+			db::databaseManager.getWriteAheadLog().appendSetControllerRecord(id, *record);
+		});
+		response.id = res.first;
 		
-		// TODO could be faster
-		if( (response.id = index.get(name)) )
+		if(response.id == 0)
 		{
-			log("Name already existed.");
+			logError(Logger::Error::TcpRegisterAsControllerTableFull, "Controller table is full"_fmt);
+			response.resultCode = data::RegisterAsController::ResponseHeader::ResultCode::Full;
+			finalizeRegisterAsControllerRequest(response);
+			return;
 		}
-		else
+		
+		if(!res.second)
 		{
-			response.id = table.createNewRecord();
-			index.set(response.id, name);
-			
-			table.accessSafeWrite(response.id, [&name](auto record){
-				record->name = name;
-			});
+			log("Name already existed."_fmt);
 		}
-		
-		
-		log("Controller id: ", response.id);
-		
-		table.accessSafeWrite(response.id, [this](auto record){
-			record->endpoint = asioudp::endpoint(remoteEndpoint.address(), 0); // TODO set port
-		});
+		log("Controller id: "_fmt, response.id);
 		
 		finalizeRegisterAsControllerRequest(response);
 		
@@ -269,7 +746,7 @@ void WozekSession::handleRegisterAsControllerRequest(const data::RegisterAsContr
 
 void WozekSession::finalizeRegisterAsControllerRequest(const data::RegisterAsController::ResponseHeader& response)
 {
-	log("Sending Register As Controller Response");
+	log("Sending Register As Controller Response"_fmt);
 	
 	asyncWriteObjects(
 		&WozekSession::awaitRequest,
@@ -284,11 +761,20 @@ void WozekSession::finalizeRegisterAsControllerRequest(const data::RegisterAsCon
 
 void WozekSession::startSegmentedFileReceive(const fs::path path, const size_t totalSize)
 {
-	log("Starting Segmented File Receive. ", path, " (", totalSize, " bytes)");
+	log("Starting Segmented File Receive. "_fmt, path, " ("_fmt, totalSize, " bytes)"_fmt);
 	auto& state = setState<States::SegmentedFileTransfer>();
-	state.bigBuffer.resize(BigBUfferDefaultSize);
+	state.bigBuffer = fileManager.getBufferPool().acquire(BigBUfferDefaultSize);
 	state.bytesRemaining = totalSize;
-	state.fileStream.emplace(getContext(), path, std::ios::trunc | std::ios::out);
+	state.path = path;
+	state.temporaryPath = fileManager.getTemporaryPath(path);
+	state.negotiator.setBounds(config.segmentLengthMin, config.segmentLengthMax, config.segmentWindowMax);
+	
+	const bool isLarge = totalSize >= config.largeUploadSize;
+	if(!state.uploadFile.open(state.temporaryPath, totalSize, isLarge, isLarge && config.directIoForLargeUploads))
+	{
+		state.internalFileError = true;
+		logError(Logger::Error::FileSystemError, "Cannot open file for the segmented file receive. Awaiting completion of the transfer."_fmt);
+	}
 	receiveSegmentFileHeader();
 }
 
@@ -305,32 +791,64 @@ void WozekSession::handleSegmentFileHeader(const data::SegmentedFileTransfer::He
 {
 	if(header.startHeader != data::SegmentedFileTransfer::Header::correctStartHeader)
 	{
-		logError(Logger::Error::TcpSegFileTransferError, "Received Segment Header has invalid code");
-		sendSegmentFileError(data::SegmentedFileTransfer::SegmentTooLong);
+		logError(Logger::Error::TcpSegFileTransferError, "Received Segment Header has invalid code"_fmt);
+		sendSegmentFileError(data::SegmentedFileTransfer::InvalidHeader);
 		return;
 	}
 	
-	auto& state = setState<States::SegmentedFileTransfer>();
+	auto& state = getState<States::SegmentedFileTransfer>();
 	state.fileSegmentLengthLeft = header.segmentLength;
 	
-	if(state.bytesRemaining < header.segmentLength) // invalid segment length
+	if(header.segmentLength == 0 || state.bytesRemaining < header.segmentLength || header.segmentLength > state.negotiator.getMaxSegmentLength()) // invalid segment length
 	{
-		logError(Logger::Error::TcpSegFileTransferError, "Received Segment Header is too long");
+		logError(Logger::Error::TcpSegFileTransferError, "Received Segment Header has invalid length: "_fmt, header.segmentLength);
 		sendSegmentFileError(data::SegmentedFileTransfer::SegmentTooLong);
 		return;
 	}
 	
+	if(state.segmentsUntilNegotiation > 0)
+	{
+		--state.segmentsUntilNegotiation;
+		receiveSegmentFileData(state.fileSegmentLengthLeft);
+		return;
+	}
+	
+	sendSegmentNegotiation();
+}
+
+void WozekSession::sendSegmentNegotiation()
+{
+	auto& state = getState<States::SegmentedFileTransfer>();
+	const auto negotiation = state.negotiator.negotiate();
+	state.segmentsUntilNegotiation = negotiation.window - 1;
+	
 	asyncWriteObjects(
-		[&]{ receiveSegmentFileData(state.fileSegmentLengthLeft); },
+		[this]{
+			auto& state = getState<States::SegmentedFileTransfer>();
+			state.negotiator.startRound();
+			receiveSegmentFileData(state.fileSegmentLengthLeft);
+		},
 		&WozekSession::errorCritical,
-		char(data::SegmentedFileTransfer::Error::Good)
+		negotiation
 	);
 }
 
 void WozekSession::receiveSegmentFileData(const size_t length)
 {
-	auto& state = setState<States::SegmentedFileTransfer>();
+	auto& state = getState<States::SegmentedFileTransfer>();
 	auto toReceive = std::min(length, state.bigBuffer.size() - state.bufferFilled);
+	
+	// First read after a Negotiation completes on arrival of any data, to measure the round trip time
+	if(state.negotiator.isAwaitingFirstData())
+	{
+		asyncReadSome(
+			asio::buffer(state.bigBuffer.data() + state.bufferFilled, toReceive),
+			&WozekSession::handleSegmentFileData,
+			&WozekSession::errorCritical
+		);
+		return;
+	}
+	
 	asyncRead(
 		asio::buffer(state.bigBuffer.data() + state.bufferFilled, toReceive),
 		[=](){ handleSegmentFileData(toReceive); },
@@ -340,20 +858,25 @@ void WozekSession::receiveSegmentFileData(const size_t length)
 
 void WozekSession::handleSegmentFileData(const size_t length)
 {
-	auto& state = setState<States::SegmentedFileTransfer>();
+	auto& state = getState<States::SegmentedFileTransfer>();
 	
 	state.bufferFilled += length;
 	state.fileSegmentLengthLeft -= length;
 	state.bytesRemaining -= length;
+	state.negotiator.addReceivedBytes(length);
 	// TODO file multitasking
 	
-	if(!state.internalFileError && state.bufferFilled == state.bigBuffer.size())
+	// After a file error the rest of the segment is only drained, so that every read has room to make progress
+	if(state.internalFileError)
+	{
+		state.bufferFilled = 0;
+	}
+	else if(state.bufferFilled == state.bigBuffer.size())
 	{
-		state.fileStream->stream.write(state.bigBuffer.data(), state.bigBuffer.size());
-		if(state.fileStream->stream.fail())
+		if(!state.uploadFile.write(state.bigBuffer.data(), state.bigBuffer.size(), state.bigBuffer.size()))
 		{
 			state.internalFileError = true;
-			logError(Logger::Error::FileSystemError, "File error while receiving segmented file. Awaiting completion of the segment.");
+			logError(Logger::Error::FileSystemError, "File error while receiving segmented file. Awaiting completion of the segment."_fmt);
 		}
 		state.bufferFilled = 0;
 	}
@@ -374,10 +897,9 @@ void WozekSession::handleSegmentFileData(const size_t length)
 	{
 		if(state.bufferFilled > 0)
 		{
-			state.fileStream->stream.write(state.bigBuffer.data(), state.bigBuffer.size());
-			if(state.fileStream->stream.fail())
+			if(!state.uploadFile.write(state.bigBuffer.data(), state.bufferFilled, state.bigBuffer.size()))
 			{
-				logError(Logger::Error::FileSystemError, "File error while receiving last segment.");				
+				logError(Logger::Error::FileSystemError, "File error while receiving last segment."_fmt);				
 				sendSegmentFileError(data::SegmentedFileTransfer::FileSystem);
 				return;
 			}
@@ -393,15 +915,149 @@ void WozekSession::handleSegmentFileData(const size_t length)
 
 void WozekSession::finalizeSegmentFileReceive()
 {
-	returnCallbackGood();
+	auto& state = getState<States::SegmentedFileTransfer>();
+	if(!state.uploadFile.close() || !fileManager.commitTemporaryFile(state.temporaryPath, state.path))
+	{
+		logError(Logger::Error::FileSystemError, "Cannot replace file "_fmt, state.path, " with the received one."_fmt);
+		sendSegmentFileError(data::SegmentedFileTransfer::FileSystem);
+		return;
+	}
+	state.temporaryPath.clear();
+	log("Segmented File Receive completed. Round trip: "_fmt, state.negotiator.getSmoothedRtt(), "s, throughput: "_fmt, state.negotiator.getBestThroughput(), " B/s"_fmt);
+	
+	data::SegmentedFileTransfer::Negotiation negotiation = {};
+	negotiation.code = data::SegmentedFileTransfer::Good;
+	asyncWriteObjects(
+		&WozekSession::returnCallbackGood,
+		&WozekSession::errorCritical,
+		negotiation
+	);
 }
 
 void WozekSession::sendSegmentFileError(const data::SegmentedFileTransfer::Error error)
 {
+	data::SegmentedFileTransfer::Negotiation negotiation = {};
+	negotiation.code = error;
 	asyncWriteObjects(
-		&WozekSession::returnCallbackGood,
+		&WozekSession::returnCallbackError,
 		&WozekSession::errorCritical,
-		char(error)
+		negotiation
+	);
+}
+
+void WozekSession::receiveUploadFileRequest()
+{
+	log("Receiving Upload File Request"_fmt);
+	asyncReadObjects<data::FileTransfer::Upload::Request>(
+		&WozekSession::handleUploadFileRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleUploadFileRequest(const data::FileTransfer::Upload::Request& request)
+{
+	data::FileTransfer::Upload::Response response;
+	response.code = data::FileTransfer::Upload::Response::AcceptCode;
+	
+	if(request.fileSize == 0 || request.fileSize > config.maxUploadSize)
+	{
+		logError(Logger::Error::TcpSegFileTransferError, "Invalid size of the file to upload: "_fmt, request.fileSize);
+		response.code = data::FileTransfer::Upload::Response::InvalidSizeCode;
+		asyncWriteObjects(&WozekSession::finilizeRequest, &WozekSession::errorAbort, response);
+		return;
+	}
+	
+	const std::string_view name(request.fileName, strnlen(request.fileName, sizeof(request.fileName)));
+	if(!FileManager::isValidFileName(name))
+	{
+		logError(Logger::Error::TcpInvalidFileName, "Invalid name of the file to upload"_fmt);
+		response.code = data::FileTransfer::Upload::Response::InvalidNameCode;
+		asyncWriteObjects(&WozekSession::finilizeRequest, &WozekSession::errorAbort, response);
+		return;
+	}
+	
+	const auto path = fileManager.getOtherFilesPath(name);
+	const size_t fileSize = request.fileSize;
+	log("Receiving file "_fmt, std::string(name), " ("_fmt, fileSize, " bytes)"_fmt);
+	asyncWriteObjects(
+		[=]{
+			// After an error, the rest of the transfer cannot be told apart from the next request, so the connection is closed
+			pushCallbackStack([this](CallbackResult::Ptr result){
+				resetState();
+				if(result->status == CallbackResult::Status::Good)
+					finilizeRequest();
+				else
+					shutdownSession();
+			});
+			startSegmentedFileReceive(path, fileSize);
+		},
+		&WozekSession::errorAbort,
+		response
+	);
+}
+
+void WozekSession::receiveDownloadFileRequest()
+{
+	log("Receiving Download File Request"_fmt);
+	asyncReadObjects<data::FileTransfer::Download::Request>(
+		&WozekSession::handleDownloadFileRequest,
+		&WozekSession::errorAbort
+	);
+}
+
+void WozekSession::handleDownloadFileRequest(const data::FileTransfer::Download::Request& request)
+{
+	data::FileTransfer::Download::Response response = {};
+	response.code = data::FileTransfer::Download::Response::FileNotFoundCode;
+	
+	const std::string_view name(request.fileName, strnlen(request.fileName, sizeof(request.fileName)));
+	if(!FileManager::isValidFileName(name))
+	{
+		logError(Logger::Error::TcpInvalidFileName, "Invalid name of the file to download"_fmt);
+		asyncWriteObjects(&WozekSession::finilizeRequest, &WozekSession::errorAbort, response);
+		return;
+	}
+	
+	auto file = fileManager.getMappedFile(fileManager.getOtherFilesPath(name));
+	if(!file)
+	{
+		log("File to download not found: "_fmt, std::string(name));
+		asyncWriteObjects(&WozekSession::finilizeRequest, &WozekSession::errorAbort, response);
+		return;
+	}
+	
+	auto& state = setState<States::FileDownload>();
+	state.file = std::move(file);
+	
+	response.code = data::FileTransfer::Download::Response::AcceptCode;
+	response.fileSize = state.file->size();
+	log("Sending file "_fmt, std::string(name), " ("_fmt, response.fileSize, " bytes)"_fmt);
+	asyncWriteObjects(
+		&WozekSession::sendDownloadFileData,
+		&WozekSession::errorAbort,
+		response
+	);
+}
+
+void WozekSession::sendDownloadFileData()
+{
+	auto& state = getState<States::FileDownload>();
+	if(state.sent == state.file->size())
+	{
+		log("File sent"_fmt);
+		resetState();
+		finilizeRequest();
+		return;
+	}
+	
+	const size_t length = std::min(state.file->size() - state.sent, DownloadChunkSize);
+	asyncWrite(
+		asio::buffer(state.file->data() + state.sent, length),
+		[=]{
+			getState<States::FileDownload>().sent += length;
+			sendDownloadFileData();
+		},
+		&WozekSession::errorAbort
 	);
 }
 
@@ -636,54 +1292,6 @@ void WozekConnectionHandler::handleDownloadFile()
 }
 
 
-/// Start the World ///
-
-void WozekConnectionHandler::handleStartTheWorld()
-{
-	static auto failRoutine = [this]{
-		data::StartTheWorld::ResponseHeader resHeader;
-		resHeader.code = data::StartTheWorld::ResponseHeader::Failure;
-		sendTerminatingMessageObject(resHeader);
-	};
-	
-	log("Handling Start The World Request");
-	asyncReadObject<data::StartTheWorld::RequestHeader>(asyncBranch(
-	[=](auto& reqHeader)
-	{
-		if(id == 0 || type != Type::Host || reqHeader.port == 0)
-		{
-			
-			log("Unable to start world on current host");
-			failRoutine();
-			return;
-		}
-		
-		asyncPost(db::databaseManager.getStrand(), [=]{
-			auto worldId = db::databaseManager.createAndAddRecord<db::Database::Table::World>();
-			if(worldId == 0)
-			{
-				logError("Failure while creating a new world in the database");
-				failRoutine();
-				return;
-			}
-			
-			auto& world = *db::databaseManager.get<db::Database::Table::World>(worldId);
-			world.createStrand(getContext());
-			world.setMainHost(id, {getRemote().address(), reqHeader.port});
-			
-			
-			log("World started successfuly. Id: ", worldId);
-			data::StartTheWorld::ResponseHeader resHeader;
-			resHeader.code = data::StartTheWorld::ResponseHeader::Success;
-			resHeader.worldId = worldId;
-			sendTerminatingMessageObject(resHeader);
-		});
-		
-	}));
-}
-
-
-
 /// File Transfer ///
 
 void WozekConnectionHandler::initiateFileTransferReceive(const size_t totalSize, fs::path path, std::function<void(bool)> mainCallback,  bool silent)
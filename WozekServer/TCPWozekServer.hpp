@@ -9,11 +9,14 @@
 #include <chrono>
 #include <array>
 #include <sstream>
+#include <optional>
 
 #include "states.hpp"
 #include "config.hpp"
 #include "ipAuthorization.hpp"
 #include "DatabaseManager.hpp"
+#include "worldManager.hpp"
+#include "trafficCapture.hpp"
 
 
 namespace tcp
@@ -50,7 +53,9 @@ public:
 	
 	~WozekSession()
 	{
-		log("Connection Terminated");
+		// Sessions normally end by shutting down, this only catches the ones that did not, so their worlds are stopped and their close is captured
+		shutdownSession();
+		log("Connection Terminated"_fmt);
 	}
 	
 	/// Type and Database
@@ -58,35 +63,41 @@ public:
 	//Type type = Type::None;
 	//db::IdType id = 0;
 	
+	// Worlds started by this session. They are stopped once it ends
+	std::vector<data::IdType> startedWorlds;
+	
+	// Number of the connection in the traffic capture, 0 if it is not captured
+	uint32_t captureConnection = 0;
+	
 private:
 	
-	/// Logging
+	// Request being handled, if its latency is recorded
+	std::optional<Logger::Latency> requestLatency;
+	std::chrono::steady_clock::time_point requestStart;
 	
-	std::string getPrefix() // TODO: add timestamp
-	{
-		std::stringstream ss;
-		ss << "[ " << remoteEndpoint << " ] ";
-		return ss.str();
-	}
+	// Records the latency of the request that has just been handled
+	void finishRequest();
+	
+	/// Logging
 	
 	template <typename ...Ts>
 	void log(Ts&& ...args)
 	{
-		logger.output(getPrefix(), std::forward<Ts>(args)...);
+		logger.output("[ "_fmt, remoteEndpoint, " ] "_fmt, std::forward<Ts>(args)...);
 	}
 	template <typename ...Ts>
 	void logError(Logger::Error name, Ts&& ...args)
 	{
 		if constexpr (sizeof...(args) > 0)
 		{
-			logger.output(getPrefix(), "Error {code: ", static_cast<int>(name), "} ", std::forward<Ts>(args)...);
+			logger.output("[ "_fmt, remoteEndpoint, " ] Error {code: "_fmt, static_cast<int>(name), "} "_fmt, std::forward<Ts>(args)...);
 		}
 		logger.error(name);
 	}
 	template <typename ...Ts>
 	void logError(Ts&& ...args)
 	{
-		logger.output(getPrefix(), "Error ", std::forward<Ts>(args)...);
+		logger.output("[ "_fmt, remoteEndpoint, " ] Error "_fmt, std::forward<Ts>(args)...);
 		logger.error(Logger::Error::UnknownError);
 	}
 	
@@ -113,11 +124,21 @@ private:
 	void startSegmentedFileReceive(const fs::path path, const size_t totalSize);
 	void receiveSegmentFileHeader();
 	void handleSegmentFileHeader(const data::SegmentedFileTransfer::Header header);
+	void sendSegmentNegotiation();
 	void sendSegmentFileError(const data::SegmentedFileTransfer::Error error);
 	void receiveSegmentFileData(const size_t length);
 	void handleSegmentFileData(const size_t length);
 	void finalizeSegmentFileReceive();
 	
+	void receiveUploadFileRequest();
+	void handleUploadFileRequest(const data::FileTransfer::Upload::Request& request);
+	
+	// Files are sent straight from their mapping, in chunks of this many bytes
+	static constexpr size_t DownloadChunkSize = 1024 * 1024 * 4;
+	void receiveDownloadFileRequest();
+	void handleDownloadFileRequest(const data::FileTransfer::Download::Request& request);
+	void sendDownloadFileData();
+	
 	
 		/// Name lookup ///
 	
@@ -126,12 +147,44 @@ private:
 	void handleLookupIdForNameRequestData(const size_t nameLength);
 	void finalizeLookupIdForNameRequest(const data::LookupIdForName::Response& response);
 	
+	void receiveBulkLookupIdForNameRequest();
+	void handleBulkLookupIdForNameRequest(const data::BulkLookupIdForName::Request& request);
+	void handleBulkLookupIdForNameRequestData(const uint32_t namesCount);
+	
+	void receiveScanNamesByPrefixRequest();
+	void handleScanNamesByPrefixRequest(const data::ScanNamesByPrefix::Request& request);
+	void handleScanNamesByPrefixRequestData(const data::ScanNamesByPrefix::Request& request);
+	void sendScanNamesByPrefixBatch();
+	
+	void receiveControllerChangesSinceRequest();
+	void handleControllerChangesSinceRequest(const data::ControllerChangesSince::Request& request);
+	
+		/// Metrics ///
+	
+	void handleMetricsSnapshotRequest();
+	
 		/// Controller ///
 		
 	void receiveRegisterAsControllerRequest();
 	void handleRegisterAsControllerRequest(const data::RegisterAsController::RequestHeader& request);
 	void finalizeRegisterAsControllerRequest(const data::RegisterAsController::ResponseHeader& response);
 	
+		/// World ///
+	
+	static constexpr size_t MaxWorldsPerSession = 4;
+	void receiveStartTheWorldRequest();
+	void handleStartTheWorldRequest(const data::StartTheWorld::RequestHeader& request);
+	void finalizeStartTheWorldRequest(const data::StartTheWorld::ResponseHeader& response);
+	
+	// Endpoint of the controller, if it is registered from the address of this session
+	std::optional<asioudp::endpoint> getOwnControllerEndpoint(const data::IdType controllerId);
+	
+	void receiveJoinWorldRequest();
+	void handleJoinWorldRequest(const data::JoinWorld::Request& request);
+	void receiveLeaveWorldRequest();
+	void handleLeaveWorldRequest(const data::LeaveWorld::Request& request);
+	void finalizeJoinOrLeaveWorldRequest(const data::JoinWorld::Response& response);
+	
 	/*
 		
 	// SegFmented ile Transfer
@@ -161,10 +214,6 @@ private:
 	void handleUploadFile();
 	void handleDownloadFile();
 	
-	// World
-	
-	void handleStartTheWorld();
-	
 	/// Handlers ///
 	
 */
@@ -176,12 +225,13 @@ private:
 		
 		if(err == asio::error::eof)
 		{
-			log("Disconnected");
+			log("Disconnected"_fmt);
 		}
 		else
 		{
 			logError(Logger::Error::TcpConnectionBroken, err);
 		}
+		shutdownSession();
 		return true;
 	}
 	
@@ -193,9 +243,10 @@ private:
 		
 		if(err == asio::error::eof)
 		{
-			logError(Logger::Error::TcpUnexpectedConnectionClosed, "Connection unexpectedly closed");
+			logError(Logger::Error::TcpUnexpectedConnectionClosed, "Connection unexpectedly closed"_fmt);
 		}
 		logError(Logger::Error::TcpConnectionBroken, err);
+		shutdownSession();
 		return true;
 	}
 
@@ -208,7 +259,7 @@ private:
 		
 		if(err == asio::error::eof)
 		{
-			logError(Logger::Error::TcpUnexpectedConnectionClosed, "Connection unexpectedly closed");
+			logError(Logger::Error::TcpUnexpectedConnectionClosed, "Connection unexpectedly closed"_fmt);
 		}
 		logError(Logger::Error::TcpConnectionBroken, err);
 		returnCallbackCriticalError();
@@ -218,27 +269,38 @@ private:
 protected:
 	virtual void timeoutHandler_impl()
 	{
-		logError(Logger::Error::TcpTimeout, "Socket timed out");
+		logError(Logger::Error::TcpTimeout, "Socket timed out"_fmt);
 	}
 	virtual bool start_impl()
 	{
-		log("New connection");
+		log("New connection"_fmt);
 		logger.log(Logger::Log::TcpActiveConnections);
 		logger.log(Logger::Log::TcpTotalConnections);
+		captureConnection = trafficCapture.recordTcpOpened();
 		
 		awaitRequest();
 		return true;
 	}
 	virtual void shutdown_impl()
 	{
-		log("Shutting down...");
+		log("Shutting down..."_fmt);
 		logger.log(Logger::Log::TcpActiveConnections, -1);
+		for(const auto worldId : startedWorlds)
+		{
+			worldManager.destroyWorld(worldId);
+		}
+		startedWorlds.clear();
+		trafficCapture.recordTcpClosed(captureConnection);
 	}
 	virtual void startError_impl(const Error& err)
 	{
-		logger.output("Unknown error while connecting to the remote endpoint: ", err);
+		logger.output("Unknown error while connecting to the remote endpoint: "_fmt, err);
 		logger.error(Logger::Error::TcpUnknownError);
 	}
+	virtual void received_impl(const char* data, const size_t length)
+	{
+		trafficCapture.recordTcpData(captureConnection, data, length);
+	}
 };
 
 class WozekServer : public BasicServer<WozekSession>
@@ -252,7 +314,7 @@ public:
 protected:
 	bool connectionErrorHandler_impl(const Error& err)
 	{
-		logger.output("Error occured while connecting:\n\t", err);
+		logger.output("Error occured while connecting:\n\t"_fmt, err);
 		return false;
 	}
 	
@@ -261,14 +323,14 @@ protected:
 		const auto address = remote.address();
 		if(!address.is_v4())
 		{
-			logger.output("Connected from forbidden (v6) address: ", remote);
+			logger.output("Connected from forbidden (v6) address: "_fmt, remote);
 			logger.error(Logger::Error::TcpForbidden);
 			return false;
 		}
 		
 		if(!ipAuthorizer.checkIfIpv4IsAllowed(address.to_v4().to_uint()))
 		{
-			logger.output("Connected from forbidden address: ", remote);
+			logger.output("Connected from forbidden address: "_fmt, remote);
 			logger.error(Logger::Error::TcpForbidden);
 			return false;
 		}
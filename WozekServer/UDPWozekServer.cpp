@@ -1,6 +1,7 @@
 #include "UDPWozekServer.hpp"
 
 #include "DatabaseManager.hpp"
+#include "worldManager.hpp"
 
 namespace udp
 {
@@ -13,28 +14,43 @@ void WozekUDPReceiver::handleRequest()
 	char requestId;
 	buffer.loadBytes(&requestId, 1);
 	
-	log("Handling request id: ", int(requestId));
+	log("Handling request id: "_fmt, int(requestId));
 	
 	switch(requestId)
 	{
 		case data::EchoRequest::request_id :
 		{
+			requestLatency = Logger::Latency::UdpEcho;
 			handleEchoRequest();
 			break;
 		}
 		case data::UdpFetchState::request_id :
 		{
+			requestLatency = Logger::Latency::UdpFetchState;
 			handleFetchStateRequest();
 			break;
 		}
 		case data::UdpUpdateState::request_id :
 		{
+			requestLatency = Logger::Latency::UdpUpdateState;
 			handleUpdateStateRequest();
 			break;
 		}
+		case data::UdpUpdateControllerState::request_id :
+		{
+			requestLatency = Logger::Latency::UdpUpdateControllerState;
+			handleUpdateControllerStateRequest();
+			break;
+		}
+		case data::AckHostState::request_id :
+		{
+			requestLatency = Logger::Latency::UdpAckHostState;
+			handleAckHostStateRequest();
+			break;
+		}
 		default:
 		{
-			logError(Logger::Error::UdpUnknownCode, "Unrecognized UDP request code ", int(requestId));
+			logError(Logger::Error::UdpUnknownCode, "Unrecognized UDP request code "_fmt, int(requestId));
 		}
 	}
 }
@@ -44,28 +60,36 @@ void WozekUDPReceiver::handleFetchStateRequest()
 	data::IdType id;
 	buffer.loadObjectAt(1, id);
 	
-	auto& table = db::databaseManager.getDatabase().controllerTable;
+	auto& database = db::databaseManager.getDatabase();
 	
 	buffer.saveObject(char(data::UdpFetchState::response_id));
 	
-	table.accessSafeRead(id, [this, id](auto record){
+	const bool authorized = database.controllerTable.accessSafeRead(id, [this, id](auto record){
 		if(!record)
 		{
-			log("Id ", id, " not found.");
-			return;
+			log("Id "_fmt, id, " not found."_fmt);
+			return false;
 		}
 		
 		if(record->endpoint.address() != remoteEndpoint.address()) // TODO check port
 		{
-			log("Invalid endpoint. Expected: ", record->endpoint, ", received from: ", remoteEndpoint);
-			return;
+			log("Invalid endpoint. Expected: "_fmt, record->endpoint, ", received from: "_fmt, remoteEndpoint);
+			return false;
 		}
-		
-		buffer.saveObjectAt(1, record->rotation);
-		static_assert(sizeof(record->rotation) == sizeof(data::UdpFetchState::Response));
+		return true;
 	});
 	
-	log("Sending Update State to ", remoteEndpoint);
+	if(authorized)
+	{
+		database.controllerStateTable.touch(id);
+		if(auto rotation = database.controllerStateTable.getRotation(id))
+		{
+			buffer.saveObjectAt(1, *rotation);
+			static_assert(sizeof(*rotation) == sizeof(data::UdpFetchState::Response));
+		}
+	}
+	
+	log("Sending Update State to "_fmt, remoteEndpoint);
 	
 	asyncWriteTo(
 		buffer.get(1 + sizeof(data::UdpFetchState::Response)),
@@ -79,7 +103,7 @@ void WozekUDPReceiver::handleFetchStateRequest()
 
 void WozekUDPReceiver::handleEchoRequest()
 {
-	log("Handling Echo Request. Sending back to ", remoteEndpoint);
+	log("Handling Echo Request. Sending back to "_fmt, remoteEndpoint);
 	buffer.saveObject(char(data::EchoRequest::response_id));
 	asyncWriteTo(
 		buffer.get(bytesTransfered),
@@ -91,26 +115,77 @@ void WozekUDPReceiver::handleEchoRequest()
 
 void WozekUDPReceiver::handleUpdateStateRequest()
 {
-	log("Handling Update State Request");
-	auto& table = db::databaseManager.getDatabase().controllerTable;
+	log("Handling Update State Request"_fmt);
+	auto& stateTable = db::databaseManager.getDatabase().controllerStateTable;
 	
 	data::IdType id;
 	buffer.loadObjectAt(1, id);
 	
-	table.accessSafeWrite(id, [this, &id](auto record){
-		if(!record)
-		{
-			log("Invalid id");
-			return;
-		}
-		
-		// TODO authorization
-		
-		buffer.loadBytesAt(1 + sizeof(id), (char*)&record->rotation, sizeof(record->rotation));
-		log("Updated state of ", id, " to ", (int)record->rotation.X , ' ', (int)record->rotation.Y , ' ', (int)record->rotation.Z);
+	// TODO authorization
+	
+	db::ControllerStateTable::Rotation rotation;
+	buffer.loadBytesAt(1 + sizeof(id), (char*)&rotation, sizeof(rotation));
+	
+	if(!stateTable.setRotation(id, rotation))
+	{
+		log("Invalid id"_fmt);
+		return;
+	}
+	log("Updated state of "_fmt, id, " to "_fmt, (int)rotation.X , ' ', (int)rotation.Y , ' ', (int)rotation.Z);
+}
+
+void WozekUDPReceiver::handleAckHostStateRequest()
+{
+	if(bytesTransfered < 1 + sizeof(data::AckHostState::Request))
+	{
+		logError(Logger::Error::UdpInvalidRequest, "Acknowledgement of host state too short: "_fmt, bytesTransfered, " bytes"_fmt);
+		return;
+	}
+	
+	data::AckHostState::Request request;
+	buffer.loadObjectAt(1, request);
+	
+	const bool found = worldManager.post(request.worldId, [sender = remoteEndpoint, tick = request.timepoint](World& world){
+		if(world.validateMainHostEndpoint(sender))
+			world.acknowledgeHostState(tick);
 	});
+	if(!found)
+	{
+		log("Acknowledged state of unknown world "_fmt, request.worldId);
+	}
 }
 
+void WozekUDPReceiver::handleUpdateControllerStateRequest()
+{
+	if(bytesTransfered < 1 + sizeof(data::UdpUpdateControllerState::Request))
+	{
+		logError(Logger::Error::UdpInvalidRequest, "Controller state too short: "_fmt, bytesTransfered, " bytes"_fmt);
+		return;
+	}
+	
+	data::UdpUpdateControllerState::Request request;
+	buffer.loadObjectAt(1, request);
+	
+	auto& database = db::databaseManager.getDatabase();
+	const bool authorized = database.controllerTable.accessSafeRead(request.controllerId, [this](auto record){
+		return record && record->endpoint.address() == remoteEndpoint.address(); // TODO check port
+	});
+	if(!authorized)
+	{
+		log("State of controller "_fmt, request.controllerId, " not from its endpoint"_fmt);
+		return;
+	}
+	database.controllerStateTable.touch(request.controllerId);
+	
+	const bool found = worldManager.post(request.worldId, [request](World& world){
+		if(world.setDesiredState(request.controllerId, request.desiredState))
+			world.setMeasuredState(request.controllerId, request.measuredState);
+	});
+	if(!found)
+	{
+		log("State of controller "_fmt, request.controllerId, " for unknown world "_fmt, request.worldId);
+	}
+}
 
 
 }
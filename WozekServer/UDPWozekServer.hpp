@@ -3,6 +3,9 @@
 #include "asio_lib.hpp"
 #include "logging.hpp"
 #include "Datagrams.hpp"
+#include "trafficCapture.hpp"
+#include <optional>
+#include <chrono>
 
 namespace udp
 {
@@ -32,31 +35,24 @@ class WozekUDPReceiver : public BasicHandler<WozekUDPReceiver,ArrayBuffer< 512 >
 {
 	/// Logging
 	
-	std::string getPrefix() // TODO: add timestamp
-	{
-		std::stringstream ss;
-		ss << "[UDP " << remoteEndpoint << "] ";
-		return ss.str();
-	}
-	
 	template <typename ...Ts>
 	void log(Ts&& ...args)
 	{
-		logger.output(getPrefix(), std::forward<Ts>(args)...);
+		logger.output("[UDP "_fmt, remoteEndpoint, "] "_fmt, std::forward<Ts>(args)...);
 	}
 	template <typename ...Ts>
 	void logError(Logger::Error name, Ts&& ...args)
 	{
 		if constexpr (sizeof...(args) > 0)
 		{
-			logger.output(getPrefix(), "Error {code: ", static_cast<int>(name), "} ", std::forward<Ts>(args)...);
+			logger.output("[UDP "_fmt, remoteEndpoint, "] Error {code: "_fmt, static_cast<int>(name), "} "_fmt, std::forward<Ts>(args)...);
 		}
 		logger.error(name);
 	}
 	template <typename ...Ts>
 	void logError(Ts&& ...args)
 	{
-		logger.output(getPrefix(), "Error ", std::forward<Ts>(args)...);
+		logger.output("[UDP "_fmt, remoteEndpoint, "] Error "_fmt, std::forward<Ts>(args)...);
 		logger.error(Logger::Error::UnknownError);
 	}
 	
@@ -69,18 +65,30 @@ protected:
 	
 	virtual void connectionErrorHandler_impl(const Error& err)
 	{
-		logError(Logger::Error::UdpConnectionError, "Error while connecting to remote endpoint: ", err);
+		logError(Logger::Error::UdpConnectionError, "Error while connecting to remote endpoint: "_fmt, err);
 	}
 	virtual void resolutionErrorHandler_impl(const Error& err)
 	{
-		logError(Logger::Error::UdpResolutionError, "Error while resolving endpoint address: ", err);
+		logError(Logger::Error::UdpResolutionError, "Error while resolving endpoint address: "_fmt, err);
 	}
 	
+	// Set once the request is recognized, if its latency is recorded
+	std::optional<Logger::Latency> requestLatency;
+	std::chrono::steady_clock::time_point requestStart;
+	
 	virtual void handle_impl()
 	{
-		log("Received ", bytesTransfered, " bytes from endpoint: ", remoteEndpoint);
+		requestStart = std::chrono::steady_clock::now();
+		requestLatency.reset();
+		log("Received "_fmt, bytesTransfered, " bytes from endpoint: "_fmt, remoteEndpoint);
+		trafficCapture.recordDatagram(remoteEndpoint, static_cast<const char*>(buffer.get().data()), bytesTransfered);
 		
 		handleRequest();
+		
+		if(requestLatency)
+		{
+			logger.latency(*requestLatency, std::chrono::steady_clock::now() - requestStart);
+		}
 	}
 	
 public:
@@ -95,6 +103,8 @@ public:
 	void handleFetchStateRequest();
 	void handleEchoRequest();
 	void handleUpdateStateRequest();
+	void handleAckHostStateRequest();
+	void handleUpdateControllerStateRequest();
 	
 	
 	bool errorAbort(const Error& err) {
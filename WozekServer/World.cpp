@@ -0,0 +1,504 @@
+#include "World.hpp"
+#include "logging.hpp"
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+/// Controllers ///
+
+bool World::addController(const data::IdType id, const asioudp::endpoint& remoteEndpoint)
+{
+	if(!controllerIndices.emplace(id, controllers.size()).second)
+	{
+		return false;
+	}
+	controllers.ids.push_back(id);
+	controllers.remoteEndpoints.push_back(remoteEndpoint);
+	controllers.forEachIntegratedColumn([](auto& simulated, auto& desired){
+		simulated.push_back(0);
+		desired.push_back(0);
+	});
+	interestGrid.insert(controllers.size() - 1, 0, 0, 0);
+	hostStateOrderValid = false;
+	return true;
+}
+
+bool World::removeController(const data::IdType id)
+{
+	const auto index = getControllerIndex(id);
+	if(!index)
+	{
+		return false;
+	}
+	
+	// The last controller takes the place of the removed one, so the columns stay dense
+	const auto last = controllers.size() - 1;
+	controllerIndices[controllers.ids[last]] = *index;
+	controllerIndices.erase(id);
+	controllers.forEachColumn([&](auto& column){
+		column[*index] = column[last];
+		column.pop_back();
+	});
+	interestGrid.remove(*index);
+	if(*index != last)
+	{
+		interestGrid.renumber(last, *index);
+	}
+	hostStateOrderValid = false;
+	return true;
+}
+
+bool World::setDesiredState(const data::IdType id, const data::Controller::DesiredState& state)
+{
+	const auto index = getControllerIndex(id);
+	if(!index)
+	{
+		return false;
+	}
+	for(size_t i=0; i<3; i++) controllers.desiredPosition[i][*index] = state.position[i];
+	for(size_t i=0; i<2; i++) controllers.desiredOrientation[i][*index] = state.orientation[i];
+	for(size_t i=0; i<2; i++) controllers.desiredWheelSpeed[i][*index] = state.wheelSpeed[i];
+	interestGridStale = true;
+	return true;
+}
+
+bool World::setMeasuredState(const data::IdType id, const data::Controller::MeasuredState& state)
+{
+	const auto index = getControllerIndex(id);
+	if(!index)
+	{
+		return false;
+	}
+	for(size_t i=0; i<2; i++) controllers.wheelSpeed[i][*index] = state.wheelSpeed[i];
+	return true;
+}
+
+bool World::getSimulatedState(const data::IdType id, data::Controller::DesiredState& state)
+{
+	const auto index = getControllerIndex(id);
+	if(!index)
+	{
+		return false;
+	}
+	for(size_t i=0; i<3; i++) state.position[i] = controllers.position[i][*index];
+	for(size_t i=0; i<2; i++) state.orientation[i] = controllers.orientation[i][*index];
+	for(size_t i=0; i<2; i++) state.wheelSpeed[i] = controllers.wheelSpeed[i][*index];
+	return true;
+}
+
+/// Interest ///
+
+void World::rebuildInterestGrid(const float interestRadius)
+{
+	interestGrid = SpatialGrid(interestRadius);
+	interestGridStale = false;
+	for(size_t index=0; index<controllers.size(); index++)
+	{
+		interestGrid.insert(index, controllers.desiredPosition[0][index], controllers.desiredPosition[1][index], controllers.desiredPosition[2][index]);
+	}
+}
+
+void World::updateInterestGrid()
+{
+	if(!interestGridStale)
+	{
+		return;
+	}
+	interestGridStale = false;
+	
+	// Controllers staying within their cells, which is nearly all of them at any tick, cost only a key comparison
+	const size_t count = controllers.size();
+	for(size_t index=0; index<count; index++)
+	{
+		interestGrid.update(index, controllers.desiredPosition[0][index], controllers.desiredPosition[1][index], controllers.desiredPosition[2][index]);
+	}
+}
+
+/// Host state ///
+
+void World::openHostSocket()
+{
+	hostSocket.reset();
+	if(mainHost.remoteEndpoint.port() == 0)
+	{
+		return;
+	}
+	
+	Error err;
+	hostSocket.emplace(getStrand().context());
+	hostSocket.value().open(mainHost.remoteEndpoint.protocol(), err);
+	if(!err)
+	{
+		hostSocket.value().non_blocking(true, err);
+	}
+	if(err)
+	{
+		logger.output("Cannot open socket for the state of world "_fmt, id, ": "_fmt, err);
+		logger.error(Logger::Error::UdpConnectionError);
+		hostSocket.reset();
+	}
+}
+
+void World::serializeHostState(const uint64_t tick)
+{
+	using Update = data::UpdateHostState;
+	constexpr size_t HeaderSize = sizeof(Update::Code) + sizeof(Update::Header);
+	
+	const size_t perDatagram = std::max<size_t>(1, (tickSettings.hostStateDatagramSize - std::min(tickSettings.hostStateDatagramSize, HeaderSize)) / sizeof(Update::ControllerData));
+	const size_t count = std::min(controllers.size(), perDatagram * UINT16_MAX);
+	const size_t datagrams = std::max<size_t>(1, (count + perDatagram - 1) / perDatagram);
+	
+	hostStateBuffer.resize(datagrams * HeaderSize + count * sizeof(Update::ControllerData));
+	hostStateDatagramEnds.clear();
+	
+	Update::Header header;
+	header.worldId = id;
+	header.packetsCount = datagrams;
+	header.timepoint = tick;
+	header.tickRate = tickSettings.rate;
+	
+	char* out = hostStateBuffer.data();
+	for(size_t datagram = 0; datagram < datagrams; datagram++)
+	{
+		const size_t begin = datagram * perDatagram;
+		const size_t end = std::min(count, begin + perDatagram);
+		
+		header.packetIndex = datagram;
+		header.controllersCount = end - begin;
+		*out++ = Update::Code;
+		std::memcpy(out, &header, sizeof(header));
+		out += sizeof(header);
+		
+		Update::ControllerData controller;
+		for(size_t index = begin; index < end; index++)
+		{
+			controller.id = controllers.ids[index];
+			for(size_t i=0; i<3; i++) controller.desiredState.position[i] = controllers.desiredPosition[i][index];
+			for(size_t i=0; i<2; i++) controller.desiredState.orientation[i] = controllers.desiredOrientation[i][index];
+			for(size_t i=0; i<2; i++) controller.desiredState.wheelSpeed[i] = controllers.desiredWheelSpeed[i][index];
+			std::memcpy(out, &controller, sizeof(controller));
+			out += sizeof(controller);
+		}
+		hostStateDatagramEnds.push_back(out - hostStateBuffer.data());
+	}
+}
+
+void World::serializeHostStateDelta(const uint64_t tick)
+{
+	namespace Update = data::UpdateHostStateDelta;
+	constexpr size_t HeaderSize = sizeof(Update::Code) + sizeof(Update::Header);
+	constexpr size_t MaxEntrySize = (data::codec::MaxEntryBits + 7) / 8;
+	static const data::codec::QuantizedState Zero;
+	
+	const size_t historySize = std::max<size_t>(1, tickSettings.hostStateHistory);
+	if(hostStateHistory.size() != historySize)
+	{
+		hostStateHistory.clear();
+		hostStateHistory.resize(historySize);
+		hostStateAcknowledged = 0;
+	}
+	
+	const size_t count = controllers.size();
+	if(!hostStateOrderValid)
+	{
+		hostStateOrder.resize(count);
+		std::iota(hostStateOrder.begin(), hostStateOrder.end(), 0);
+		std::sort(hostStateOrder.begin(), hostStateOrder.end(), [this](const uint32_t a, const uint32_t b){
+			return controllers.ids[a] < controllers.ids[b];
+		});
+		hostStateOrderValid = true;
+	}
+	
+	// Quantized state of this tick, which may become a baseline later
+	const auto& quantization = tickSettings.hostStateQuantization;
+	const float inversePositionStep = 1.0f / quantization.positionStep;
+	const float inverseOrientationStep = 1.0f / quantization.orientationStep;
+	const float inverseWheelSpeedStep = 1.0f / quantization.wheelSpeedStep;
+	
+	auto& current = hostStateHistory[tick % historySize];
+	current.tick = tick;
+	current.ids.resize(count);
+	current.states.resize(count);
+	for(size_t i=0; i<count; i++)
+	{
+		const auto index = hostStateOrder[i];
+		auto& fields = current.states[i].fields;
+		current.ids[i] = controllers.ids[index];
+		for(size_t j=0; j<3; j++) fields[j] = data::codec::quantize(controllers.desiredPosition[j][index], inversePositionStep);
+		for(size_t j=0; j<2; j++) fields[3 + j] = data::codec::quantize(controllers.desiredOrientation[j][index], inverseOrientationStep);
+		for(size_t j=0; j<2; j++) fields[5 + j] = data::codec::quantize(controllers.desiredWheelSpeed[j][index], inverseWheelSpeedStep);
+	}
+	
+	const data::codec::Snapshot* baseline = nullptr;
+	if(hostStateAcknowledged != 0 && tick - hostStateAcknowledged < historySize && hostStateHistory[hostStateAcknowledged % historySize].tick == hostStateAcknowledged)
+	{
+		baseline = &hostStateHistory[hostStateAcknowledged % historySize];
+	}
+	
+	Update::Header header;
+	header.worldId = id;
+	header.packetsCount = 0; // filled in once all datagrams are written
+	header.timepoint = tick;
+	header.baseline = baseline ? baseline->tick : 0;
+	header.tickRate = tickSettings.rate;
+	header.steps[0] = quantization.positionStep;
+	header.steps[1] = quantization.orientationStep;
+	header.steps[2] = quantization.wheelSpeedStep;
+	
+	// Datagrams are filled with entries while even the largest possible entry would still fit
+	const size_t datagramSize = std::max(tickSettings.hostStateDatagramSize, HeaderSize + MaxEntrySize);
+	hostStateDatagramEnds.clear();
+	size_t offset = 0;
+	size_t entry = 0;
+	size_t baselineEntry = 0;
+	do
+	{
+		hostStateBuffer.resize(offset + datagramSize);
+		data::codec::BitWriter writer(hostStateBuffer.data() + offset + HeaderSize, datagramSize - HeaderSize);
+		const size_t first = entry;
+		data::IdType previousId = 0;
+		for(; entry < count && writer.getBitsCount() + data::codec::MaxEntryBits <= writer.getCapacityBits(); entry++)
+		{
+			const auto controllerId = current.ids[entry];
+			const data::codec::QuantizedState* base = &Zero;
+			if(baseline)
+			{
+				// Both are sorted by id
+				const auto& baselineIds = baseline->ids;
+				while(baselineEntry < baselineIds.size() && baselineIds[baselineEntry] < controllerId)
+				{
+					baselineEntry++;
+				}
+				if(baselineEntry < baselineIds.size() && baselineIds[baselineEntry] == controllerId)
+				{
+					base = &baseline->states[baselineEntry];
+				}
+			}
+			data::codec::writeEntry(writer, controllerId - previousId, current.states[entry], *base);
+			previousId = controllerId;
+		}
+		
+		header.packetIndex = hostStateDatagramEnds.size();
+		header.controllersCount = entry - first;
+		header.bitsCount = writer.getBitsCount();
+		hostStateBuffer[offset] = Update::Code;
+		std::memcpy(hostStateBuffer.data() + offset + sizeof(Update::Code), &header, sizeof(header));
+		offset += HeaderSize + writer.flush();
+		hostStateDatagramEnds.push_back(offset);
+	}
+	while(entry < count && hostStateDatagramEnds.size() < UINT16_MAX);
+	hostStateBuffer.resize(offset);
+	
+	// Controllers that did not fit were not sent, so the host will not have them in this baseline either
+	current.ids.resize(entry);
+	current.states.resize(entry);
+	
+	const uint16_t packetsCount = hostStateDatagramEnds.size();
+	size_t begin = 0;
+	for(const auto end : hostStateDatagramEnds)
+	{
+		std::memcpy(hostStateBuffer.data() + begin + sizeof(Update::Code) + offsetof(Update::Header, packetsCount), &packetsCount, sizeof(packetsCount));
+		begin = end;
+	}
+}
+
+void World::sendHostState()
+{
+	size_t begin = 0;
+	for(const auto end : hostStateDatagramEnds)
+	{
+		Error err;
+		hostSocket.value().send_to(asio::buffer(hostStateBuffer.data() + begin, end - begin), mainHost.remoteEndpoint, 0, err);
+		if(err)
+		{
+			// Rest of the update would be useless without the dropped part
+			tickMetrics.droppedHostStates.fetch_add(1, std::memory_order_relaxed);
+			if(err != asio::error::would_block)
+			{
+				logger.error(Logger::Error::UdpTransmissionError);
+			}
+			return;
+		}
+		begin = end;
+	}
+}
+
+void World::acknowledgeHostState(const uint64_t tick)
+{
+	// Acknowledgements may come out of order, and only ticks still in the history can become baselines
+	const size_t historySize = hostStateHistory.size();
+	if(historySize == 0 || tick <= hostStateAcknowledged || hostStateHistory[tick % historySize].tick != tick)
+	{
+		return;
+	}
+	hostStateAcknowledged = tick;
+}
+
+/// Ticks ///
+
+// Moves every value of simulated the given fraction of the way towards desired.
+// Works on blocks of fixed width over non-aliasing arrays, which the compiler turns into SIMD instructions even at -O2
+static void integrateTowards(float* __restrict simulated, const float* __restrict desired, const size_t count, const float fraction)
+{
+	constexpr size_t Width = 8;
+	size_t i = 0;
+	for(; i + Width <= count; i += Width)
+	{
+		for(size_t j=0; j<Width; j++)
+		{
+			simulated[i + j] += (desired[i + j] - simulated[i + j]) * fraction;
+		}
+	}
+	for(; i<count; i++)
+	{
+		simulated[i] += (desired[i] - simulated[i]) * fraction;
+	}
+}
+
+void World::startTicking(const WorldTickSettings& settings)
+{
+	assert(hasStrand());
+	assert(settings.rate > 0);
+	
+	if(settings.interestRadius != interestGrid.getCellSize())
+	{
+		rebuildInterestGrid(settings.interestRadius);
+	}
+	tickSettings = settings;
+	if(!tickTimer.has_value())
+	{
+		tickTimer.emplace(getStrand().context());
+	}
+	if(!hostSocket.has_value())
+	{
+		openHostSocket();
+	}
+	ticking = true;
+	nextTick = std::chrono::steady_clock::now() + getTickPeriod();
+	scheduleTick();
+}
+
+void World::stopTicking()
+{
+	ticking = false;
+	tickEpoch.fetch_add(1, std::memory_order_relaxed);
+	if(tickTimer.has_value())
+	{
+		tickTimer.value().cancel();
+	}
+}
+
+void World::scheduleTick()
+{
+	tickTimer.value().expires_at(nextTick);
+	tickTimer.value().async_wait(asio::bind_executor(getStrand(), [self = shared_from_this(), epoch = tickEpoch.load(std::memory_order_relaxed)](const ::Error& err){
+		if(err || epoch != self->tickEpoch.load(std::memory_order_relaxed))
+			return;
+		self->runDueTicks();
+		self->scheduleTick();
+	}));
+}
+
+void World::runDueTicks()
+{
+	const auto period = getTickPeriod();
+	const auto now = std::chrono::steady_clock::now();
+	
+	// Timer never fires early, so at least the scheduled tick is due
+	const uint64_t due = 1 + std::max<int64_t>(0, (now - nextTick) / period);
+	const uint64_t run = tickSettings.policy == WorldTickPolicy::CatchUp ? std::min<uint64_t>(due, 1 + tickSettings.maxCatchUpTicks) : 1;
+	
+	for(uint64_t i=0; i<run; i++)
+	{
+		tick();
+	}
+	
+	nextTick += period * due;
+	if(const auto skipped = due - run)
+	{
+		tickMetrics.skippedTicks.fetch_add(skipped, std::memory_order_relaxed);
+		logger.log(Logger::Log::WorldSkippedTicks, skipped);
+	}
+}
+
+void World::tick()
+{
+	const auto start = std::chrono::steady_clock::now();
+	
+	// Ticks have a fixed length, so the simulation does not depend on how late the timer fires
+	const float dt = 1.0f / tickSettings.rate;
+	const float fraction = 1.0f - std::exp(-tickSettings.convergenceRate * dt);
+	
+	const size_t count = controllers.size();
+	for(size_t begin = 0; begin < count; begin += TickBatchSize)
+	{
+		const size_t batch = std::min(TickBatchSize, count - begin);
+		controllers.forEachIntegratedColumn([&](auto& simulated, auto& desired){
+			integrateTowards(simulated.data() + begin, desired.data() + begin, batch, fraction);
+		});
+	}
+	
+	// An empty world has nothing to tell its host, once it has sent it the state without any controllers
+	if(hostSocket.has_value() && (count > 0 || !hostStateEmptySent))
+	{
+		const uint64_t tickNumber = tickMetrics.ticks.load(std::memory_order_relaxed) + 1;
+		if(tickSettings.hostStateEncoding == HostStateEncoding::Delta)
+		{
+			serializeHostStateDelta(tickNumber);
+		}
+		else
+		{
+			serializeHostState(tickNumber);
+		}
+		sendHostState();
+		hostStateEmptySent = count == 0;
+	}
+	
+	const int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	tickMetrics.ticks.fetch_add(1, std::memory_order_relaxed);
+	tickMetrics.lastTickDuration.store(duration, std::memory_order_relaxed);
+	tickMetrics.totalTickDuration.fetch_add(duration, std::memory_order_relaxed);
+	if(duration > tickMetrics.maxTickDuration.load(std::memory_order_relaxed))
+	{
+		tickMetrics.maxTickDuration.store(duration, std::memory_order_relaxed);
+	}
+	if(duration > tickSettings.budget.count())
+	{
+		tickMetrics.overruns.fetch_add(1, std::memory_order_relaxed);
+		logger.log(Logger::Log::WorldTickOverruns);
+	}
+}
+
+void World::moveTo(asio::io_context& ioContext)
+{
+	const bool wasTicking = ticking;
+	stopTicking();
+	
+	// Handlers still queued on the old strand keep their own copy of it, and the cancelled tick is dropped by its epoch
+	strand.emplace(ioContext);
+	tickTimer.emplace(ioContext);
+	hostSocket.reset();
+	
+	if(wasTicking)
+	{
+		// Unless ticking is stopped again before it resumes
+		asio::post(getStrand(), [self = shared_from_this(), epoch = tickEpoch.load(std::memory_order_relaxed)]{
+			if(epoch == self->tickEpoch.load(std::memory_order_relaxed))
+				self->startTicking(self->tickSettings);
+		});
+	}
+}
+
+WorldTickMetrics World::getTickMetrics() const
+{
+	WorldTickMetrics res;
+	res.ticks = tickMetrics.ticks.load(std::memory_order_relaxed);
+	res.overruns = tickMetrics.overruns.load(std::memory_order_relaxed);
+	res.skippedTicks = tickMetrics.skippedTicks.load(std::memory_order_relaxed);
+	res.lastTickDuration = std::chrono::nanoseconds(tickMetrics.lastTickDuration.load(std::memory_order_relaxed));
+	res.maxTickDuration = std::chrono::nanoseconds(tickMetrics.maxTickDuration.load(std::memory_order_relaxed));
+	res.totalTickDuration = std::chrono::nanoseconds(tickMetrics.totalTickDuration.load(std::memory_order_relaxed));
+	res.droppedHostStates = tickMetrics.droppedHostStates.load(std::memory_order_relaxed);
+	return res;
+}
@@ -2,10 +2,31 @@
 
 #include "asio_lib.hpp"
 #include "Datagrams.hpp"
+#include "spatialGrid.hpp"
+#include "stateCodec.hpp"
+#include "worldTickSettings.hpp"
 #include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <cassert>
+#include <memory>
 
-class World
+struct WorldTickMetrics
 {
+	uint64_t ticks = 0;
+	uint64_t overruns = 0;
+	uint64_t skippedTicks = 0;
+	std::chrono::nanoseconds lastTickDuration{0};
+	std::chrono::nanoseconds maxTickDuration{0};
+	std::chrono::nanoseconds totalTickDuration{0}; // of all ticks, for measuring the cost of the world
+	uint64_t droppedHostStates = 0; // ticks, whose state was not sent fully to the main host
+};
+
+class World : public std::enable_shared_from_this<World>
+{
+	const data::IdType id;
 	std::optional<asio::io_context::strand> strand;
 	
 	struct Host
@@ -14,17 +35,119 @@ class World
 		asioudp::endpoint remoteEndpoint;
 	};
 	
-	struct Controller
+	// Controllers are stored as a struct of arrays, packed densely, so a tick streams through each column.
+	// Simulated state is what the world believes the controller is doing now, and it approaches the desired state every tick.
+	// Measured wheel speed, reported by the controller, overrides the simulated one
+	struct Controllers
 	{
-		data::IdType id = 0;
-		asioudp::endpoint remoteEndpoint;
+		std::vector<data::IdType> ids;
+		std::vector<asioudp::endpoint> remoteEndpoints;
+		
+		std::vector<float> desiredPosition[3];
+		std::vector<float> desiredOrientation[2];
+		std::vector<float> desiredWheelSpeed[2];
 		
-		data::Controller::DesiredState desiredState;
-		data::Controller::MeasuredState measuredState;
+		std::vector<float> position[3];
+		std::vector<float> orientation[2];
+		std::vector<float> wheelSpeed[2];
+		
+		size_t size() const { return ids.size(); }
+		
+		// Calls callback(simulated, desired) for every pair of columns integrated by the tick
+		template <typename Callback>
+		void forEachIntegratedColumn(Callback&& callback)
+		{
+			for(size_t i=0; i<3; i++) callback(position[i], desiredPosition[i]);
+			for(size_t i=0; i<2; i++) callback(orientation[i], desiredOrientation[i]);
+			for(size_t i=0; i<2; i++) callback(wheelSpeed[i], desiredWheelSpeed[i]);
+		}
+		
+		// Calls callback(column) for every column
+		template <typename Callback>
+		void forEachColumn(Callback&& callback)
+		{
+			callback(ids);
+			callback(remoteEndpoints);
+			forEachIntegratedColumn([&](auto& simulated, auto& desired){
+				callback(simulated);
+				callback(desired);
+			});
+		}
 	};
 	
 	Host mainHost;
-	std::vector<Controller> controllers;
+	Controllers controllers;
+	std::unordered_map<data::IdType, uint32_t> controllerIndices;
+	
+	// Controllers by desired position, with indices of controllers as handles. Cells are as big as the interest radius,
+	// so the controllers of interest are always within the 27 cells around the recipient.
+	// Positions are brought up to date by the first query after they change, so a world nobody queries does not pay for the grid
+	SpatialGrid interestGrid{WorldTickSettings().interestRadius};
+	bool interestGridStale = false;
+	
+	void rebuildInterestGrid(const float interestRadius);
+	void updateInterestGrid();
+	
+	/// Host state ///
+	
+	// State of all controllers is serialized once per tick, into datagrams laid out back to back, each ending at its offset
+	// in hostStateDatagramEnds. The buffers are kept between ticks, so they are allocated only as the world grows.
+	// Datagrams are sent with non-blocking sends, so a slow network drops the state of a tick, instead of stalling the shard
+	std::optional<asioudp::socket> hostSocket;
+	std::vector<char> hostStateBuffer;
+	std::vector<size_t> hostStateDatagramEnds;
+	
+	// Delta encoding keeps the quantized states sent during the last hostStateHistory ticks, in a ring indexed by the tick.
+	// Entries are sorted by id, through indices of controllers in order of their ids, sorted again only when controllers come or go
+	std::vector<data::codec::Snapshot> hostStateHistory;
+	std::vector<uint32_t> hostStateOrder;
+	bool hostStateOrderValid = false;
+	uint64_t hostStateAcknowledged = 0; // 0 if no state sent since the history was cleared was acknowledged
+	bool hostStateEmptySent = false; // no state is sent while the world stays empty
+	
+	void openHostSocket();
+	void serializeHostState(const uint64_t tick);
+	void serializeHostStateDelta(const uint64_t tick);
+	void sendHostState();
+	
+	/// Ticks ///
+	
+	// Controllers are integrated in batches of this many, so each batch stays in the L1 cache while all its columns are processed
+	static constexpr size_t TickBatchSize = 256;
+	
+	std::optional<asio::steady_timer> tickTimer;
+	WorldTickSettings tickSettings;
+	std::chrono::steady_clock::time_point nextTick;
+	bool ticking = false;
+	
+	// Incremented whenever ticking stops, so that a tick scheduled before is dropped,
+	// even if it already fired, or runs on the strand of another shard, after the world was moved
+	std::atomic<uint64_t> tickEpoch = 0;
+	
+	// Written on the strand, read from anywhere
+	struct
+	{
+		std::atomic<uint64_t> ticks = 0;
+		std::atomic<uint64_t> overruns = 0;
+		std::atomic<uint64_t> skippedTicks = 0;
+		std::atomic<int64_t> lastTickDuration = 0;
+		std::atomic<int64_t> maxTickDuration = 0;
+		std::atomic<int64_t> totalTickDuration = 0;
+		std::atomic<uint64_t> droppedHostStates = 0;
+	} tickMetrics;
+	
+	std::chrono::nanoseconds getTickPeriod() const { return std::chrono::nanoseconds(std::chrono::seconds(1)) / tickSettings.rate; }
+	
+	void scheduleTick();
+	void runDueTicks();
+	
+	std::optional<uint32_t> getControllerIndex(const data::IdType id)
+	{
+		const auto it = controllerIndices.find(id);
+		if(it == controllerIndices.end())
+			return std::nullopt;
+		return it->second;
+	}
 	
 public:
 	
@@ -49,4 +172,97 @@ public:
 		return senderEndpoint.address() == mainHost.remoteEndpoint.address();
 	}
 	
+	/// Controllers ///
+	// Have to be called on the strand of the world
+	
+	// Returns false if the controller is already in the world
+	bool addController(const data::IdType id, const asioudp::endpoint& remoteEndpoint);
+	bool removeController(const data::IdType id);
+	
+	bool setDesiredState(const data::IdType id, const data::Controller::DesiredState& state);
+	bool setMeasuredState(const data::IdType id, const data::Controller::MeasuredState& state);
+	
+	// Simulated state has the same fields as the desired one
+	bool getSimulatedState(const data::IdType id, data::Controller::DesiredState& state);
+	
+	size_t getControllersCount() const { return controllers.size(); }
+	
+	// Calls callback(data::IdType id, const data::Controller::DesiredState& state) for every controller,
+	// whose desired position is within radius of given position
+	template <typename Callback>
+	void forEachControllerWithin(const data::Vector3f position, const float radius, Callback&& callback);
+	
+	// Calls callback(data::IdType id, const data::Controller::DesiredState& state) for every other controller,
+	// within the interest radius of the recipient. Returns false if there is no such recipient
+	template <typename Callback>
+	bool forEachControllerOfInterest(const data::IdType recipient, Callback&& callback);
+	
+	// Called when the main host has received all packets of the state of given tick.
+	// The state of following ticks is encoded relative to it, while it stays in the history
+	void acknowledgeHostState(const uint64_t tick);
+	
+	/// Ticks ///
+	
+	// Starts advancing the world at a fixed rate, on its strand. The strand has to be created first,
+	// and the world has to be owned by a shared_ptr, which pending ticks keep alive
+	void startTicking(const WorldTickSettings& settings);
+	void stopTicking();
+	bool isTicking() const { return ticking; }
+	
+	// Moves the world, with its strand and ticks, to another io_context. Has to be called on the current strand,
+	// and nothing else may be run on it for this world afterwards. Ticking resumes on the new strand
+	void moveTo(asio::io_context& ioContext);
+	
+	// Can be called from any thread
+	WorldTickMetrics getTickMetrics() const;
+	
+	// Advances the world by a single tick. Called by the tick engine, on the strand
+	void tick();
+	
+	World(const data::IdType id_ = 0)
+		: id(id_)
+	{}
+	World(const World&) = delete;
+	
+	data::IdType getId() const { return id; }
 };
+
+template <typename Callback>
+void World::forEachControllerWithin(const data::Vector3f position, const float radius, Callback&& callback)
+{
+	updateInterestGrid();
+	
+	const float radiusSquared = radius * radius;
+	data::Controller::DesiredState state;
+	interestGrid.forEachNear(position[0], position[1], position[2], radius, [&](const SpatialGrid::Handle index){
+		float distanceSquared = 0;
+		for(size_t i=0; i<3; i++)
+		{
+			state.position[i] = controllers.desiredPosition[i][index];
+			distanceSquared += (state.position[i] - position[i]) * (state.position[i] - position[i]);
+		}
+		if(distanceSquared > radiusSquared)
+		{
+			return;
+		}
+		for(size_t i=0; i<2; i++) state.orientation[i] = controllers.desiredOrientation[i][index];
+		for(size_t i=0; i<2; i++) state.wheelSpeed[i] = controllers.desiredWheelSpeed[i][index];
+		callback(controllers.ids[index], static_cast<const data::Controller::DesiredState&>(state));
+	});
+}
+
+template <typename Callback>
+bool World::forEachControllerOfInterest(const data::IdType recipient, Callback&& callback)
+{
+	const auto index = getControllerIndex(recipient);
+	if(!index)
+	{
+		return false;
+	}
+	const data::Vector3f position = {controllers.desiredPosition[0][*index], controllers.desiredPosition[1][*index], controllers.desiredPosition[2][*index]};
+	forEachControllerWithin(position, tickSettings.interestRadius, [&](const data::IdType id, const data::Controller::DesiredState& state){
+		if(id != recipient)
+			callback(id, state);
+	});
+	return true;
+}
@@ -109,6 +109,9 @@ protected:
 	virtual void shutdown_impl() = 0;
 	virtual void startError_impl(const Error& err) = 0;
 	
+	// Called with every piece of data read from the socket, before it is handled
+	virtual void received_impl(const char* /*data*/, const size_t /*length*/) {}
+	
 	bool isShutdown = true;
 	
 public:
@@ -174,16 +177,44 @@ protected:
 					asio::steady_timer::duration timeoutDuration)
 	{
 		startTimeoutTimer(timeoutDuration);
+		const asio::const_buffer received(buffer);
 		return asio::async_read(
 						socket,
 						buffer,
 						this->errorBranch(
 							&SessionImpl::stopTimeoutTimer,
-							std::forward<SuccessHandler>(successHandler),
+							[this, received, successHandler = std::forward<SuccessHandler>(successHandler)]{
+								this->received_impl(static_cast<const char*>(received.data()), received.size());
+								this->execute(successHandler);
+							},
 							std::forward<ErrorHandler>(errorHandler)
 							)
 					);
 	}
+	// Completes as soon as any data is available. Success handler receives the number of bytes read
+	template <typename Buffer, typename SuccessHandler, typename ErrorHandler>
+	auto asyncReadSome( Buffer&& buffer,
+						SuccessHandler&& successHandler,
+						ErrorHandler&& errorHandler)
+	{
+		startTimeoutTimer(defaultTimeoutTimerDuration);
+		const asio::const_buffer received(buffer);
+		return socket.async_read_some(
+						buffer,
+						[=, me = this->sharedFromThis()](const Error& err, const size_t length){
+							this->stopTimeoutTimer();
+							if(err)
+							{
+								this->execute(errorHandler, err);
+							}
+							else
+							{
+								this->received_impl(static_cast<const char*>(received.data()), length);
+								this->execute(successHandler, length);
+							}
+						}
+					);
+	}
 	template <typename ...Ts, typename SuccessHandler, typename ErrorHandler>
 	auto asyncReadObjects(  SuccessHandler&& successHandler,
 							ErrorHandler&& errorHandler)
@@ -0,0 +1,531 @@
+#pragma once
+
+#include "asio_lib/asioWrapper.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <ostream>
+#include <type_traits>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+// Binary structured output log. Instead of the formatted line, each call of Logger::output writes the id of its format
+// and the raw values of its arguments. Text marked with _fmt among the arguments is the constant text of the format,
+// so a call site is identified by its text (by its addresses) and the types of the other arguments.
+// Each format is written to the file once, before it is first used, so that the file can be turned back into text by itself
+namespace binlog
+{
+
+/// File format ///
+
+// File is a sequence of sessions, one per run of the server, each being a FileHeader followed by records.
+// A record is a RecordTag byte followed by its fields. Integers are written as varints (7 bits per byte, least significant first).
+// The first byte of the header ('W') is not a valid tag, so a new session can be told from a record
+struct FileHeader
+{
+	static constexpr char Magic[8] = {'W', 'O', 'Z', 'E', 'K', 'L', 'O', 'G'};
+	static constexpr uint32_t CurrentVersion = 1;
+	
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved = 0;
+	uint64_t startTime; // of the session, in nanoseconds since the epoch of the system clock
+};
+static_assert(sizeof(FileHeader) == 24);
+
+enum class RecordTag : uint8_t
+{
+	Format = 1, // id, pieces count, pieces (each a SlotType, and for Text the length and the text)
+	Event = 2, // format id, microseconds since the start of the session, values of the slots of the format
+	Dropped = 3, // number of events dropped since the previous such record
+};
+
+// Kinds of pieces of a format. Text is constant, the others are slots for values of the arguments, written as:
+enum class SlotType : uint8_t
+{
+	Text = 0,
+	Signed = 1, // zigzag varint
+	Unsigned = 2, // varint
+	Double = 3, // 8 bytes
+	String = 4, // length varint and the bytes
+	Char = 5, // 1 byte
+	Bool = 6, // 1 byte
+	Endpoint = 7, // 1 byte 4 or 6 (version of the address), the address bytes, 2 bytes of port, big endian
+};
+
+inline void writeVarint(std::string& out, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		out.push_back(static_cast<char>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+inline bool readVarint(const char*& data, const char* end, uint64_t& value)
+{
+	value = 0;
+	for(uint32_t shift = 0; data < end && shift < 64; shift += 7)
+	{
+		const uint8_t byte = static_cast<uint8_t>(*data++);
+		value |= uint64_t(byte & 0x7F) << shift;
+		if((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+/// Encoding of arguments ///
+
+template <typename T>
+using Bare = std::remove_cv_t<std::remove_reference_t<T>>;
+
+// Constant text of a log line. Made only from string literals, by operator""_fmt, so that its address identifies the call site
+struct Text
+{
+	const char* data;
+	size_t size;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Text& text)
+{
+	return os.write(text.data, text.size);
+}
+
+template <typename T>
+constexpr bool IsText = std::is_same_v<Bare<T>, Text>;
+
+// Any other array of chars is a value, which does not have to end with a NUL
+template <typename T>
+constexpr bool IsCharArray = std::is_array_v<Bare<T>> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<Bare<T>>>, char>;
+
+template <typename T>
+constexpr SlotType getSlotType()
+{
+	using D = std::decay_t<T>;
+	if constexpr (IsText<T>)
+		return SlotType::Text;
+	else if constexpr (std::is_same_v<D, bool>)
+		return SlotType::Bool;
+	// operator<< writes all of these as characters
+	else if constexpr (std::is_same_v<D, char> || std::is_same_v<D, signed char> || std::is_same_v<D, unsigned char>)
+		return SlotType::Char;
+	else if constexpr (std::is_integral_v<D>)
+		return std::is_signed_v<D> ? SlotType::Signed : SlotType::Unsigned;
+	else if constexpr (std::is_floating_point_v<D>)
+		return SlotType::Double;
+	else if constexpr (std::is_same_v<D, asioudp::endpoint> || std::is_same_v<D, asiotcp::endpoint>)
+		return SlotType::Endpoint;
+	// Strings, and everything else, formatted with operator<<
+	else
+		return SlotType::String;
+}
+
+template <typename T>
+void writeArg(std::string& out, const T& arg)
+{
+	using D = std::decay_t<T>;
+	constexpr SlotType type = getSlotType<T>();
+	if constexpr (type == SlotType::Text)
+	{
+		return;
+	}
+	else if constexpr (type == SlotType::Bool || type == SlotType::Char)
+	{
+		out.push_back(static_cast<char>(arg));
+	}
+	else if constexpr (type == SlotType::Signed)
+	{
+		const int64_t value = arg;
+		writeVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+	}
+	else if constexpr (type == SlotType::Unsigned)
+	{
+		writeVarint(out, arg);
+	}
+	else if constexpr (type == SlotType::Double)
+	{
+		const double value = arg;
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+	else if constexpr (type == SlotType::Endpoint)
+	{
+		// Copied straight from the socket address, where both the address and the port are already big endian
+		if(arg.data()->sa_family == AF_INET)
+		{
+			const auto& address = *reinterpret_cast<const sockaddr_in*>(arg.data());
+			out.push_back(4);
+			out.append(reinterpret_cast<const char*>(&address.sin_addr), 4);
+			out.append(reinterpret_cast<const char*>(&address.sin_port), 2);
+		}
+		else
+		{
+			const auto& address = *reinterpret_cast<const sockaddr_in6*>(arg.data());
+			out.push_back(6);
+			out.append(reinterpret_cast<const char*>(&address.sin6_addr), 16);
+			out.append(reinterpret_cast<const char*>(&address.sin6_port), 2);
+		}
+	}
+	else if constexpr (IsCharArray<T>)
+	{
+		const size_t length = strnlen(arg, std::extent_v<Bare<T>>);
+		writeVarint(out, length);
+		out.append(arg, length);
+	}
+	else if constexpr (std::is_same_v<D, const char*> || std::is_same_v<D, char*>)
+	{
+		const size_t length = arg ? std::strlen(arg) : 0;
+		writeVarint(out, length);
+		out.append(arg ? arg : "", length);
+	}
+	else if constexpr (std::is_same_v<D, std::string> || std::is_same_v<D, std::string_view>)
+	{
+		writeVarint(out, arg.size());
+		out.append(arg.data(), arg.size());
+	}
+	else
+	{
+		std::ostringstream ss;
+		ss << arg;
+		const std::string str = ss.str();
+		writeVarint(out, str.size());
+		out.append(str);
+	}
+}
+
+// Writes the argument into a text line, the same way, as it is decoded from its slot
+template <typename T>
+void writeText(std::ostream& os, const T& arg)
+{
+	if constexpr (IsCharArray<T>)
+		os.write(arg, strnlen(arg, std::extent_v<Bare<T>>));
+	else
+		os << arg;
+}
+
+/// Formats ///
+
+struct Piece
+{
+	SlotType type;
+	std::string text; // only for Text
+};
+
+// Assigns ids to formats. Lookups of formats already seen by a call site do not lock, see getFormatId
+class FormatRegistry
+{
+	std::mutex mutex;
+	std::map<std::vector<const void*>, uint32_t> ids;
+	std::vector<std::vector<Piece>> formats;
+	
+public:
+	
+	// Key is the signature of the argument types, followed by addresses of the text
+	template <typename ...Args>
+	uint32_t getId(const std::vector<const void*>& key, const Args& ...args)
+	{
+		std::lock_guard lock{mutex};
+		const auto it = ids.find(key);
+		if(it != ids.end())
+			return it->second;
+		
+		std::vector<Piece> pieces;
+		pieces.reserve(sizeof...(Args));
+		([&]{
+			if constexpr (IsText<Args>)
+				pieces.push_back(Piece{SlotType::Text, std::string(args.data, args.size)});
+			else
+				pieces.push_back(Piece{getSlotType<Args>(), {}});
+		}(), ...);
+		
+		const uint32_t id = formats.size();
+		formats.push_back(std::move(pieces));
+		ids.emplace(key, id);
+		return id;
+	}
+	
+	// Appends Format records of formats from the given id onwards, returns the id after the last one
+	uint32_t writeFormats(std::string& out, const uint32_t fromId)
+	{
+		std::lock_guard lock{mutex};
+		for(uint32_t id = fromId; id < formats.size(); id++)
+		{
+			out.push_back(static_cast<char>(RecordTag::Format));
+			writeVarint(out, id);
+			writeVarint(out, formats[id].size());
+			for(const auto& piece : formats[id])
+			{
+				out.push_back(static_cast<char>(piece.type));
+				if(piece.type == SlotType::Text)
+				{
+					writeVarint(out, piece.text.size());
+					out.append(piece.text);
+				}
+			}
+		}
+		return formats.size();
+	}
+};
+
+extern FormatRegistry formatRegistry;
+
+// Returns the id of the format of a call with these arguments.
+// Every combination of argument types keeps a small cache of the formats of its call sites, keyed by addresses of their text.
+// Call sites that do not fit in the cache go to the registry every time
+template <typename ...Args>
+uint32_t getFormatId(const Args& ...args)
+{
+	constexpr size_t TextsCount = (size_t(0) + ... + size_t(IsText<Args>));
+	constexpr size_t CacheSize = 16;
+	
+	struct Cached
+	{
+		std::array<const char*, TextsCount> texts;
+		uint32_t id;
+	};
+	static std::array<std::atomic<const Cached*>, CacheSize> cache;
+	
+	std::array<const char*, TextsCount> texts = {};
+	size_t text = 0;
+	([&]{
+		if constexpr (IsText<Args>)
+			texts[text++] = args.data;
+	}(), ...);
+	
+	for(auto& slot : cache)
+	{
+		const Cached* cached = slot.load(std::memory_order_acquire);
+		if(!cached)
+			break;
+		if(cached->texts == texts)
+			return cached->id;
+	}
+	
+	// Address of the cache identifies the combination of types
+	std::vector<const void*> key;
+	key.reserve(TextsCount + 1);
+	key.push_back(&cache);
+	key.insert(key.end(), texts.begin(), texts.end());
+	const uint32_t id = formatRegistry.getId(key, args...);
+	
+	// Cached entries are never freed, there are only as many of them as call sites
+	for(auto& slot : cache)
+	{
+		const Cached* current = slot.load(std::memory_order_acquire);
+		if(!current)
+		{
+			const Cached* cached = new Cached{texts, id};
+			if(slot.compare_exchange_strong(current, cached, std::memory_order_acq_rel))
+				break;
+			delete cached;
+		}
+		if(current->texts == texts)
+			break;
+	}
+	return id;
+}
+
+/// Decoding ///
+
+// Turns a binary log back into text, session by session
+class Decoder
+{
+	const char* begin;
+	const char* data;
+	const char* end;
+	
+	std::vector<std::vector<Piece>> formats;
+	FileHeader header = {};
+	bool sessionStarted = false;
+	
+	bool readString(std::string& str)
+	{
+		uint64_t length;
+		if(!readVarint(data, end, length) || length > uint64_t(end - data))
+			return false;
+		str.assign(data, length);
+		data += length;
+		return true;
+	}
+	
+	bool readSlot(const SlotType type, std::ostream& os)
+	{
+		uint64_t value;
+		switch(type)
+		{
+		case SlotType::Text:
+			return true;
+		case SlotType::Signed:
+			if(!readVarint(data, end, value))
+				return false;
+			os << static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+			return true;
+		case SlotType::Unsigned:
+			if(!readVarint(data, end, value))
+				return false;
+			os << value;
+			return true;
+		case SlotType::Double:
+			{
+				double d;
+				if(end - data < static_cast<ptrdiff_t>(sizeof(d)))
+					return false;
+				std::memcpy(&d, data, sizeof(d));
+				data += sizeof(d);
+				os << d;
+				return true;
+			}
+		case SlotType::String:
+			{
+				std::string str;
+				if(!readString(str))
+					return false;
+				os << str;
+				return true;
+			}
+		case SlotType::Char:
+		case SlotType::Bool:
+			if(data == end)
+				return false;
+			if(type == SlotType::Char)
+				os << *data;
+			else
+				os << bool(*data);
+			data++;
+			return true;
+		case SlotType::Endpoint:
+			{
+				if(data == end)
+					return false;
+				const char version = *data++;
+				asio::ip::address address;
+				if(version == 4 && end - data >= 4 + 2)
+				{
+					asio::ip::address_v4::bytes_type bytes;
+					std::memcpy(bytes.data(), data, bytes.size());
+					address = asio::ip::address_v4(bytes);
+					data += bytes.size();
+				}
+				else if(version == 6 && end - data >= 16 + 2)
+				{
+					asio::ip::address_v6::bytes_type bytes;
+					std::memcpy(bytes.data(), data, bytes.size());
+					address = asio::ip::address_v6(bytes);
+					data += bytes.size();
+				}
+				else
+				{
+					return false;
+				}
+				const uint16_t port = (uint16_t(uint8_t(data[0])) << 8) | uint8_t(data[1]);
+				data += 2;
+				os << asioudp::endpoint(address, port);
+				return true;
+			}
+		}
+		return false;
+	}
+	
+public:
+	
+	Decoder(const char* data_, const size_t size)
+		: begin(data_), data(data_), end(data_ + size)
+	{}
+	
+	// Writes the next record as a line of text, as it would be written by the text log, if it has any.
+	// Events are prefixed by their time (seconds since the start of the session), if timestamps is set.
+	// Returns false at the end of the data, or if the data is invalid (check with isAtEnd)
+	bool next(std::ostream& os, const bool timestamps)
+	{
+		if(data == end)
+			return false;
+		
+		if(*data == FileHeader::Magic[0])
+		{
+			if(end - data < static_cast<ptrdiff_t>(sizeof(FileHeader)))
+				return false;
+			std::memcpy(&header, data, sizeof(header));
+			if(std::memcmp(header.magic, FileHeader::Magic, sizeof(header.magic)) != 0 || header.version != FileHeader::CurrentVersion)
+				return false;
+			data += sizeof(header);
+			formats.clear();
+			sessionStarted = true;
+			os << "# New Session: " << header.startTime / 1000000000 << '\n';
+			return true;
+		}
+		if(!sessionStarted)
+			return false;
+		
+		const RecordTag tag = static_cast<RecordTag>(*data++);
+		uint64_t id;
+		switch(tag)
+		{
+		case RecordTag::Format:
+			{
+				uint64_t count;
+				if(!readVarint(data, end, id) || !readVarint(data, end, count) || id != formats.size())
+					return false;
+				std::vector<Piece> pieces;
+				for(uint64_t i = 0; i < count; i++)
+				{
+					if(data == end)
+						return false;
+					Piece piece{static_cast<SlotType>(*data++), {}};
+					if(piece.type == SlotType::Text && !readString(piece.text))
+						return false;
+					pieces.push_back(std::move(piece));
+				}
+				formats.push_back(std::move(pieces));
+				return true;
+			}
+		case RecordTag::Event:
+			{
+				uint64_t time;
+				if(!readVarint(data, end, id) || !readVarint(data, end, time) || id >= formats.size())
+					return false;
+				if(timestamps)
+				{
+					char buffer[32];
+					std::snprintf(buffer, sizeof(buffer), "[%.6f] ", time / 1e6);
+					os << buffer;
+				}
+				for(const auto& piece : formats[id])
+				{
+					if(piece.type == SlotType::Text)
+						os << piece.text;
+					else if(!readSlot(piece.type, os))
+						return false;
+				}
+				os << '\n';
+				return true;
+			}
+		case RecordTag::Dropped:
+			{
+				uint64_t count;
+				if(!readVarint(data, end, count))
+					return false;
+				os << "# Dropped " << count << " lines of output, as they were logged faster than they could be written\n";
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	bool isAtEnd() const { return data == end; }
+	size_t getPosition() const { return data - begin; }
+};
+
+}
+
+// Marks a string literal passed to Logger::output as constant text of the line
+constexpr binlog::Text operator""_fmt(const char* text, const size_t size)
+{
+	return binlog::Text{text, size};
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <new>
+#include <cstddef>
+
+// Heap buffer aligned to the page size, suitable for direct (unbuffered) file I/O
+class AlignedBuffer
+{
+public:
+	
+	static constexpr size_t Alignment = 4096;
+	
+private:
+	
+	struct Deleter
+	{
+		void operator()(char* ptr) { ::operator delete[](ptr, std::align_val_t(Alignment)); }
+	};
+	
+	std::unique_ptr<char[], Deleter> memory;
+	size_t length = 0;
+	
+public:
+	
+	AlignedBuffer() {}
+	AlignedBuffer(const size_t size) { resize(size); }
+	
+	// Contents are not preserved
+	void resize(const size_t size)
+	{
+		if(size == length)
+			return;
+		memory.reset(size > 0 ? static_cast<char*>(::operator new[](size, std::align_val_t(Alignment))) : nullptr);
+		length = size;
+	}
+	
+	char* data() { return memory.get(); }
+	const char* data() const { return memory.get(); }
+	size_t size() const { return length; }
+};
+
+// Keeps the big transfer buffers around between transfers, instead of allocating them anew each time
+class BufferPool
+{
+	std::mutex mutex;
+	std::vector<AlignedBuffer> buffers;
+	size_t maxPooledBuffers;
+	
+	void release(AlignedBuffer&& buffer)
+	{
+		std::lock_guard lock(mutex);
+		if(buffers.size() < maxPooledBuffers)
+		{
+			buffers.push_back(std::move(buffer));
+		}
+	}
+	
+public:
+	
+	// Buffer, that is returned to its pool when destroyed
+	class Handle
+	{
+		friend class BufferPool;
+		
+		BufferPool* pool = nullptr;
+		AlignedBuffer buffer;
+		
+		Handle(BufferPool* pool_, AlignedBuffer&& buffer_)
+			: pool(pool_), buffer(std::move(buffer_))
+		{}
+		
+		void release()
+		{
+			if(pool != nullptr && buffer.size() > 0)
+			{
+				pool->release(std::move(buffer));
+			}
+			pool = nullptr;
+		}
+		
+	public:
+		
+		Handle() {}
+		Handle(Handle&& other)
+			: pool(other.pool), buffer(std::move(other.buffer))
+		{
+			other.pool = nullptr;
+		}
+		Handle& operator=(Handle&& other)
+		{
+			release();
+			pool = other.pool;
+			buffer = std::move(other.buffer);
+			other.pool = nullptr;
+			return *this;
+		}
+		~Handle() { release(); }
+		
+		// Detaches the buffer from its pool. Contents are not preserved
+		void resize(const size_t size)
+		{
+			pool = nullptr;
+			buffer.resize(size);
+		}
+		
+		char* data() { return buffer.data(); }
+		size_t size() const { return buffer.size(); }
+	};
+	
+	BufferPool(const size_t maxPooledBuffers_ = 8)
+		: maxPooledBuffers(maxPooledBuffers_)
+	{}
+	
+	Handle acquire(const size_t size)
+	{
+		{
+			std::lock_guard lock(mutex);
+			for(auto it = buffers.begin(); it != buffers.end(); ++it)
+			{
+				if(it->size() == size)
+				{
+					Handle res(this, std::move(*it));
+					buffers.erase(it);
+					return res;
+				}
+			}
+		}
+		return Handle(this, AlignedBuffer(size));
+	}
+	
+	// Buffers waiting in the pool for reuse, and their total size
+	size_t getPooledCount()
+	{
+		std::lock_guard lock(mutex);
+		return buffers.size();
+	}
+	size_t getPooledSize()
+	{
+		std::lock_guard lock(mutex);
+		size_t res = 0;
+		for(const auto& buffer : buffers)
+		{
+			res += buffer.size();
+		}
+		return res;
+	}
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "asio_lib.hpp"
+#include "worldTickSettings.hpp"
 #include <filesystem>
 #include <iostream>
 #include <fstream>
@@ -17,11 +18,45 @@ public:
 	static constexpr size_t SessionBufferSize = 4096;
 	
 	fs::path allowedIpv4FilePath;
+	fs::path allowedHostsIpv4FilePath; // addresses allowed to start worlds, a subset of the allowed ones
 	std::chrono::seconds updateIpv4TimerDuration;
 	
-	bool init(const fs::path& allowedIpv4FilePath, const std::chrono::seconds& updateTimerDuration)
+	// Bounds for the negotiated segment length and window of segmented file transfers
+	size_t segmentLengthMin = 1024 * 64;
+	size_t segmentLengthMax = 1024 * 1024 * 16;
+	uint32_t segmentWindowMax = 64;
+	
+	// Uploads bigger than this are refused
+	size_t maxUploadSize = size_t(1024) * 1024 * 1024;
+	
+	// Uploads at least this big are preallocated, and written with direct I/O (bypassing the page cache) if enabled
+	size_t largeUploadSize = 1024 * 1024 * 4;
+	bool directIoForLargeUploads = true;
+	
+	// How often the controller database is saved, 0 disables snapshots
+	std::chrono::seconds databaseSnapshotInterval = std::chrono::seconds(30);
+	
+	// Controllers not seen for this long are erased, and their ids are reused. Checked every controllerSweepInterval, 0 disables expiry
+	std::chrono::seconds controllerExpiryTime = std::chrono::seconds(60 * 10);
+	std::chrono::seconds controllerSweepInterval = std::chrono::seconds(10);
+	
+	// Fixed rate simulation of worlds
+	WorldTickSettings worldTickSettings;
+	
+	// Worlds are spread over this many threads, and moved between them by their tick cost every worldRebalanceInterval, 0 disables rebalancing
+	size_t worldShards = 2;
+	std::chrono::seconds worldRebalanceInterval = std::chrono::seconds(5);
+	
+	// Output log is written in the binary format of binaryLog.hpp, instead of text
+	bool binaryOutputLog = false;
+	
+	// Traffic capture, enabled by the optional [capture_file] parameter, stops once the file grows to this size
+	uint64_t trafficCaptureMaxSize = uint64_t(1024) * 1024 * 1024 * 4;
+	
+	bool init(const fs::path& allowedIpv4FilePath, const fs::path& allowedHostsIpv4FilePath, const std::chrono::seconds& updateTimerDuration)
 	{
 		this->allowedIpv4FilePath = allowedIpv4FilePath;
+		this->allowedHostsIpv4FilePath = allowedHostsIpv4FilePath;
 		updateIpv4TimerDuration = updateTimerDuration;
 		
 		return true;
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace fs = std::filesystem;
+
+// File written with unbuffered writes, that can be explicitly flushed all the way to the disk.
+// Used for the database files, which have to survive a crash of the server or of the whole machine.
+class DurableFile
+{
+#ifdef _WIN32
+	std::FILE* file = nullptr;
+#else
+	int fd = -1;
+#endif // _WIN32
+	
+	uint64_t length = 0;
+	
+public:
+	
+	DurableFile() {}
+	DurableFile(const DurableFile&) = delete;
+	~DurableFile() { close(); }
+	
+	// Without truncate, writes are appended to the existing contents
+	bool open(const fs::path& path, const bool truncate)
+	{
+		close();
+		std::error_code ignored;
+		length = truncate ? 0 : fs::exists(path, ignored) ? fs::file_size(path, ignored) : 0;
+		
+#ifdef _WIN32
+		file = std::fopen(path.string().c_str(), truncate ? "wb" : "ab");
+		return file != nullptr;
+#else
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND), 0644);
+		return fd >= 0;
+#endif // _WIN32
+	}
+	
+	bool isOpen() const
+	{
+#ifdef _WIN32
+		return file != nullptr;
+#else
+		return fd >= 0;
+#endif // _WIN32
+	}
+	
+	uint64_t size() const { return length; }
+	
+	bool write(const char* data, const size_t size)
+	{
+#ifdef _WIN32
+		if(std::fwrite(data, 1, size, file) != size)
+			return false;
+#else
+		size_t done = 0;
+		while(done < size)
+		{
+			const auto res = ::write(fd, data + done, size - done);
+			if(res <= 0)
+			{
+				return false;
+			}
+			done += res;
+		}
+#endif // _WIN32
+		length += size;
+		return true;
+	}
+	
+	// Returns once everything written so far is on the disk
+	bool sync()
+	{
+#ifdef _WIN32
+		return std::fflush(file) == 0 && _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+		return ::fdatasync(fd) == 0;
+#else
+		return ::fsync(fd) == 0;
+#endif // _WIN32
+	}
+	
+	bool close()
+	{
+#ifdef _WIN32
+		if(file == nullptr)
+			return true;
+		const bool res = std::fclose(file) == 0;
+		file = nullptr;
+		return res;
+#else
+		if(fd < 0)
+			return true;
+		const bool res = ::close(fd) == 0;
+		fd = -1;
+		return res;
+#endif // _WIN32
+	}
+	
+	// Makes creation, removal and renaming of files in the directory durable
+	static bool syncDirectory(const fs::path& directory)
+	{
+#ifdef _WIN32
+		return true;
+#else
+		const int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+		if(dirFd < 0)
+		{
+			return false;
+		}
+		const bool res = ::fsync(dirFd) == 0;
+		::close(dirFd);
+		return res;
+#endif // _WIN32
+	}
+	
+	// Replaces the contents of the file, so that after a crash it holds either the old or the new contents, never a mix.
+	// The data is written to a temporary file first, synced, and then renamed over the destination.
+	static bool replaceAtomically(const fs::path& path, const char* data, const size_t size)
+	{
+		auto temporaryPath = path;
+		temporaryPath += ".tmp";
+		
+		{
+			DurableFile file;
+			if(!file.open(temporaryPath, true) || !file.write(data, size) || !file.sync() || !file.close())
+			{
+				return false;
+			}
+		}
+		
+		std::error_code err;
+		fs::rename(temporaryPath, path, err);
+		if(err)
+		{
+			return false;
+		}
+		return syncDirectory(path.parent_path());
+	}
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <cstring>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace fs = std::filesystem;
+namespace bip = boost::interprocess;
+
+// Read-only view of a whole file, mapped into memory.
+// Reads are served straight from the page cache, without any seeks or copies into stream buffers.
+class MappedFile
+{
+	bip::file_mapping mapping;
+	bip::mapped_region region;
+	
+public:
+	
+	// Throws bip::interprocess_exception, if the file cannot be mapped
+	MappedFile(const fs::path& path)
+	{
+		// Empty files cannot be mapped
+		if(fs::file_size(path) == 0)
+			return;
+		
+		mapping = bip::file_mapping(path.string().c_str(), bip::read_only);
+		region = bip::mapped_region(mapping, bip::read_only);
+		region.advise(bip::mapped_region::advice_sequential);
+	}
+	
+	const char* data() const { return static_cast<const char*>(region.get_address()); }
+	size_t size() const { return region.get_size(); }
+	
+	bool read(const size_t offset, char* dest, const size_t length) const
+	{
+		if(offset > size() || size() - offset < length)
+		{
+			return false;
+		}
+		std::memcpy(dest, data() + offset, length);
+		return true;
+	}
+};
+
+// LRU cache of mapped files, shared by all sessions.
+// Entries are handed out as shared pointers, so evicting or invalidating an entry
+// never unmaps a region, that is still being read by some download.
+class FileCache
+{
+public:
+	
+	using MappedFilePtr = std::shared_ptr<const MappedFile>;
+	
+	static constexpr size_t DefaultSizeLimit = 1024 * 1024 * 256;
+	
+private:
+	
+	struct Entry
+	{
+		std::string key;
+		MappedFilePtr file;
+	};
+	
+	using LruList = std::list<Entry>;
+	
+	std::mutex mutex;
+	
+	LruList lru; // most recently used at the front
+	std::unordered_map<std::string, LruList::iterator> entries;
+	
+	size_t sizeLimit = DefaultSizeLimit;
+	size_t totalSize = 0;
+	
+	static std::string getKey(const fs::path& path)
+	{
+		return path.lexically_normal().string();
+	}
+	
+	void erase(std::unordered_map<std::string, LruList::iterator>::iterator it)
+	{
+		totalSize -= it->second->file->size();
+		lru.erase(it->second);
+		entries.erase(it);
+	}
+	
+	void evict()
+	{
+		while(totalSize > sizeLimit && !lru.empty())
+		{
+			erase(entries.find(lru.back().key));
+		}
+	}
+	
+public:
+	
+	void setSizeLimit(const size_t newSizeLimit)
+	{
+		std::lock_guard lock(mutex);
+		sizeLimit = newSizeLimit;
+		evict();
+	}
+	
+	// Returns the mapping of given file, or nullptr if the file dosen't exist or cannot be mapped
+	MappedFilePtr get(const fs::path& path)
+	{
+		auto key = getKey(path);
+		
+		std::lock_guard lock(mutex);
+		
+		auto it = entries.find(key);
+		if(it != entries.end())
+		{
+			lru.splice(lru.begin(), lru, it->second);
+			return it->second->file;
+		}
+		
+		std::error_code ignored;
+		if(!fs::is_regular_file(path, ignored))
+		{
+			return nullptr;
+		}
+		
+		MappedFilePtr file;
+		try
+		{
+			file = std::make_shared<const MappedFile>(path);
+		}
+		catch(std::exception&)
+		{
+			return nullptr;
+		}
+		
+		// Files bigger than the whole cache are served, but never cached
+		if(file->size() > sizeLimit)
+		{
+			return file;
+		}
+		
+		lru.push_front({key, file});
+		entries.emplace(std::move(key), lru.begin());
+		totalSize += file->size();
+		evict();
+		
+		return file;
+	}
+	
+	// Has to be called whenever the file is modified or replaced
+	void invalidate(const fs::path& path)
+	{
+		std::lock_guard lock(mutex);
+		auto it = entries.find(getKey(path));
+		if(it != entries.end())
+		{
+			erase(it);
+		}
+	}
+	
+	void clear()
+	{
+		std::lock_guard lock(mutex);
+		lru.clear();
+		entries.clear();
+		totalSize = 0;
+	}
+	
+	size_t getTotalSize()
+	{
+		std::lock_guard lock(mutex);
+		return totalSize;
+	}
+	size_t getFilesCount()
+	{
+		std::lock_guard lock(mutex);
+		return entries.size();
+	}
+	size_t getSizeLimit()
+	{
+		std::lock_guard lock(mutex);
+		return sizeLimit;
+	}
+};
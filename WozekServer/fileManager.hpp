@@ -3,72 +3,143 @@
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <atomic>
 #include "Datagrams.hpp"
+#include "fileCache.hpp"
+#include "bufferPool.hpp"
 #include "asio_lib.hpp"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
 namespace fs = std::filesystem;
 
-class FileStream
+// Destination file of an upload with known total size.
+// The whole size is allocated up front, to avoid fragmentation and repeated growing of the file.
+// With direct I/O the writes bypass the page cache, so large uploads do not evict other cached files,
+// but then all writes have to come from AlignedBuffer's, at offsets aligned to AlignedBuffer::Alignment.
+class UploadFile
 {
-	asio::io_context& ioContext;
-	asio::io_context::strand strand;
-	
-	std::atomic<int> enqueuedWrites = 0;
+#ifdef _WIN32
+	std::ofstream stream;
+#else
+	int fd = -1;
+#endif // _WIN32
 	
-	bool isFlushed = true;
+	bool direct = false;
+	uint64_t totalSize = 0;
+	uint64_t written = 0;
 	
 public:
 	
-	std::fstream stream;
+	UploadFile() {}
+	UploadFile(const UploadFile&) = delete;
+	~UploadFile() { close(); }
 	
-	FileStream(asio::io_context& ioContext_, const fs::path& path, const std::ios::openmode mode)
-		: ioContext(ioContext_), strand(ioContext_), stream(path, mode)
+	bool open(const fs::path& path, const uint64_t totalSize_, const bool preallocate, const bool tryDirect)
 	{
-	}
-	
-	template <typename T>
-	bool writeBufferAsync(const char* source, const size_t length, T&& callback)
-	{
-		if(!stream.is_open())
+		close();
+		totalSize = totalSize_;
+		written = 0;
+		direct = false;
+		
+#ifdef _WIN32
+		stream.open(path, std::ios::trunc | std::ios::out | std::ios::binary);
+		return stream.is_open();
+#else
+		const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	#ifdef O_DIRECT
+		if(tryDirect)
+		{
+			fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+			direct = fd >= 0;
+		}
+	#endif // O_DIRECT
+		// Not every filesystem supports direct I/O
+		if(fd < 0)
+		{
+			fd = ::open(path.c_str(), flags, 0644);
+		}
+		if(fd < 0)
 		{
 			return false;
 		}
-		isFlushed = false;
-		enqueuedWrites++;
-		asio::post(strand, [=](){
-			stream.write(source, length);
-			callback(!stream.fail());
-			enqueuedWrites--;
-		});
+		
+		if(preallocate && totalSize > 0)
+		{
+	#if defined(__linux__)
+			// Failure is not fatal, the file will just grow with each write
+			::posix_fallocate(fd, 0, totalSize);
+	#endif // __linux__
+		}
 		return true;
+#endif // _WIN32
 	}
 	
-	template <typename T>
-	bool readFileAsync(char* dest, const size_t length, T&& callback)
+	bool isOpen() const
 	{
-		if(!stream.is_open())
-		{
-			return false;
-		}
-		asio::post(strand, [=](){
-			stream.read(dest, length);
-			callback(!stream.fail());
-		});
-		return true;
+#ifdef _WIN32
+		return stream.is_open();
+#else
+		return fd >= 0;
+#endif // _WIN32
 	}
+	bool isDirect() const { return direct; }
 	
-	void flushSync()
+	// capacity - size of the buffer starting at data. With direct I/O the last, partial write is padded up to the alignment
+	bool write(const char* data, const size_t length, const size_t capacity)
 	{
-		stream.flush();
-		isFlushed = true;
+#ifdef _WIN32
+		stream.write(data, length);
+		written += length;
+		return !stream.fail();
+#else
+		size_t toWrite = length;
+		if(direct && toWrite % AlignedBuffer::Alignment != 0)
+		{
+			toWrite += AlignedBuffer::Alignment - toWrite % AlignedBuffer::Alignment;
+			if(toWrite > capacity || written + length != totalSize)
+			{
+				return false;
+			}
+		}
+		
+		size_t done = 0;
+		while(done < toWrite)
+		{
+			const auto res = ::pwrite(fd, data + done, toWrite - done, written + done);
+			if(res <= 0)
+			{
+				return false;
+			}
+			done += res;
+		}
+		written += length;
+		return true;
+#endif // _WIN32
 	}
 	
-	void closeSync()
+	// Cuts off any padding and unused preallocated space
+	bool close()
 	{
+#ifdef _WIN32
+		if(!stream.is_open())
+			return true;
 		stream.close();
+		return !stream.fail();
+#else
+		if(fd < 0)
+			return true;
+		bool res = ::ftruncate(fd, written) == 0;
+		res = ::close(fd) == 0 && res;
+		fd = -1;
+		return res;
+#endif // _WIN32
 	}
-	
 };
 
 class FileManager
@@ -80,6 +151,11 @@ class FileManager
 	
 	asio::io_context* ioContextPtr;
 	
+	FileCache cache;
+	BufferPool bufferPool;
+	
+	std::atomic<uint64_t> lastTemporaryFile = 0;
+	
 	void initDirectories()
 	{
 		fs::create_directory(workingDirectory / mapFilesFolder);
@@ -103,56 +179,45 @@ public:
 		return true;
 	}
 	
-	auto getFileStream(const fs::path& path, std::ios::openmode mode)
+	// Mapping stays valid for as long as the pointer is held, even if the file gets replaced in the meantime
+	auto getMappedFile(const fs::path& path)
 	{
-		return FileStream(getContext(), path, mode);
+		return cache.get(path);
 	}
-		
-	bool writeBufferToFile(const fs::path& path, std::ios::openmode mode, const char* buffer, size_t length)
+	
+	auto& getCache() {return cache;}
+	auto& getBufferPool() {return bufferPool;}
+	
+	// Files are received into a temporary file first, and replace the target only when complete.
+	// Replacing (instead of truncating) the target keeps the old contents intact for any ongoing downloads.
+	// Every call returns another path, so concurrent uploads of the same file never write to the same temporary file
+	fs::path getTemporaryPath(const fs::path& path)
 	{
-		std::ofstream file(path, mode | std::ios::binary);
-		if(!file.is_open())
-		{
-			return false;
-		}
-		
-		file.write(buffer, length);
-		if(file.fail())
-		{
-			return false;
-		}
-		file.close();
-		return true;
+		fs::path res = path;
+		res += "." + std::to_string(++lastTemporaryFile) + ".part";
+		return res;
 	}
 	
-	bool appendBufferToFile(const fs::path& path, const char* buffer, size_t length)
+	// The cached mapping is dropped first, as a mapped file cannot be replaced on Windows.
+	// There, replacing still fails while a download holds the old mapping
+	bool commitTemporaryFile(const fs::path& temporaryPath, const fs::path& path)
 	{
-		return writeBufferToFile(path, std::ios::app, buffer, length);
+		cache.invalidate(path);
+		std::error_code err;
+		fs::rename(temporaryPath, path, err);
+		return !err;
 	}
 	
-	bool writeFileToBuffer(const fs::path& path, size_t offset, char* buffer, size_t length)
+	// Names of files sent over the network may have only letters, digits, '.' and '_', and may not start with a '.'
+	static bool isValidFileName(const std::string_view name)
 	{
-		std::ifstream file(path, std::ios::binary);
-		if(!file.is_open())
-		{
-			return false;
-		}
-		file.seekg(0, std::ios::end);
-		size_t end = file.tellg();
-		file.seekg(offset, std::ios::beg);
-		
-		if((size_t)file.tellg() > end || end - (size_t)file.tellg() < length)
+		if(name.empty() || name.front() == '.')
 		{
 			return false;
 		}
-		
-		file.read(buffer, length);
-		if(file.fail())
-		{
-			return false;
-		}
-		file.close();
-		return true;
+		return std::all_of(name.begin(), name.end(), [](const char c){
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '_';
+		});
 	}
 	
 	// Any Files
@@ -173,6 +238,7 @@ public:
 	
 	void deleteFile(const fs::path& path)
 	{
+		cache.invalidate(path);
 		fs::remove(path);
 	}
 	
@@ -190,6 +256,7 @@ public:
 	void deleteMapFile(data::IdType id)
 	{
 		auto path = getPathToMapFile(id);
+		cache.invalidate(path);
 		fs::remove(path);
 	}
 	
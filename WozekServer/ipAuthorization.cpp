@@ -1,3 +1,4 @@
 #include "ipAuthorization.hpp"
 
 IpAuthorizer ipAuthorizer;
+IpAuthorizer hostAuthorizer;
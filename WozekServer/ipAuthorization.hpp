@@ -7,6 +7,7 @@
 
 namespace fs = std::filesystem;
 
+// Addresses allowed by a file with a line per subnet, e.g. 127.0.0.0/8. The file is reloaded once it changes
 class IpAuthorizer
 {
 	struct Ipv4Address
@@ -15,6 +16,7 @@ class IpAuthorizer
 		uint32_t netmask;
 	};
 	
+	fs::path filePath;
 	fs::file_time_type lastUpdatedIpv4;
 	std::vector<Ipv4Address> allowedIpv4;
 	std::optional<asio::steady_timer> updateIpv4Timer;
@@ -69,7 +71,7 @@ class IpAuthorizer
 		std::vector<Ipv4Address> newAllowed;
 		
 		std::string line;
-		std::ifstream file(config.allowedIpv4FilePath);
+		std::ifstream file(filePath);
 		
 		if(!file.is_open())
 		{
@@ -101,28 +103,31 @@ class IpAuthorizer
 		updateIpv4Timer.value().async_wait([this](const Error& err){
 			if(err)
 				return;
-			const auto newLastUpdatedIpv4 = fs::last_write_time(config.allowedIpv4FilePath);
+			std::error_code ignored;
+			const auto newLastUpdatedIpv4 = fs::last_write_time(filePath, ignored);
 			if(lastUpdatedIpv4 != newLastUpdatedIpv4)
 			{
 				lastUpdatedIpv4 = newLastUpdatedIpv4;
 				updateIpv4();
-				startUpdateIpv4Timer();
 			}
+			startUpdateIpv4Timer();
 		});
 	}
 	
 public:
 	
-	void init(asio::io_context& ioContext)
+	// The file is created empty, allowing nothing, if it dosen't exist
+	void init(asio::io_context& ioContext, const fs::path& filePath_)
 	{
+		filePath = filePath_;
 		updateIpv4Timer.emplace(ioContext);
 		
-		std::fstream file(config.allowedIpv4FilePath, std::ios::app);
+		std::fstream file(filePath, std::ios::app);
 		file.close();
 		
 		updateIpv4();
 		startUpdateIpv4Timer();
-		lastUpdatedIpv4 = fs::last_write_time(config.allowedIpv4FilePath);
+		lastUpdatedIpv4 = fs::last_write_time(filePath);
 	}
 	
 	bool checkIfIpv4IsAllowed(const uint32_t address)
@@ -150,4 +155,7 @@ public:
 #endif // RELEASE
 };
 
+// Addresses allowed to connect
 extern IpAuthorizer ipAuthorizer;
+// Addresses allowed to host worlds
+extern IpAuthorizer hostAuthorizer;
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Histogram of latencies in the manner of HdrHistogram: buckets are linear within each power of 2,
+// with SubBuckets of them per power, so that every value is recorded with relative error below 1 / SubBuckets.
+// Values are nanoseconds, and values past the last bucket (about 18 minutes) go into it
+class LatencyHistogram
+{
+public:
+	
+	static constexpr uint32_t SubBucketBits = 4;
+	static constexpr uint64_t SubBuckets = uint64_t(1) << SubBucketBits;
+	static constexpr uint32_t MaxValueBits = 40;
+	static constexpr size_t BucketsCount = (MaxValueBits - SubBucketBits + 1) * SubBuckets;
+	
+	using Counts = std::array<uint64_t, BucketsCount>;
+	
+	static size_t getBucket(const uint64_t value)
+	{
+		if(value < SubBuckets)
+			return value;
+		uint32_t top = 63;
+		while((value >> top) == 0)
+		{
+			top--;
+		}
+		if(top >= MaxValueBits)
+			return BucketsCount - 1;
+		const uint32_t shift = top - SubBucketBits;
+		return (shift + 1) * SubBuckets + ((value >> shift) - SubBuckets);
+	}
+	
+	// Smallest and largest values, that go into the bucket
+	static uint64_t getBucketLow(const size_t bucket)
+	{
+		if(bucket < SubBuckets)
+			return bucket;
+		const uint32_t shift = bucket / SubBuckets - 1;
+		return (SubBuckets + bucket % SubBuckets) << shift;
+	}
+	static uint64_t getBucketHigh(const size_t bucket)
+	{
+		if(bucket < SubBuckets)
+			return bucket;
+		const uint32_t shift = bucket / SubBuckets - 1;
+		return getBucketLow(bucket) + (uint64_t(1) << shift) - 1;
+	}
+	
+	// Value below which the given fraction of the recorded values are, as the highest value of its bucket. 0 if there are none
+	static uint64_t getPercentile(const Counts& counts, const double fraction)
+	{
+		uint64_t total = 0;
+		for(const auto count : counts)
+		{
+			total += count;
+		}
+		if(total == 0)
+			return 0;
+		
+		const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * total + 0.5));
+		uint64_t seen = 0;
+		for(size_t i=0; i<BucketsCount; i++)
+		{
+			seen += counts[i];
+			if(seen >= rank)
+				return getBucketHigh(i);
+		}
+		return getBucketHigh(BucketsCount - 1);
+	}
+	static uint64_t getMax(const Counts& counts)
+	{
+		for(size_t i=BucketsCount; i>0; i--)
+		{
+			if(counts[i - 1] > 0)
+				return getBucketHigh(i - 1);
+		}
+		return 0;
+	}
+	static uint64_t getTotal(const Counts& counts)
+	{
+		uint64_t total = 0;
+		for(const auto count : counts)
+		{
+			total += count;
+		}
+		return total;
+	}
+	
+private:
+	
+	std::array<std::atomic<uint64_t>, BucketsCount> buckets = {};
+	
+public:
+	
+	// Only one thread records into a histogram, so this is a plain relaxed increment, but it can be read from other threads at any time
+	void record(const std::chrono::steady_clock::duration duration)
+	{
+		const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		auto& bucket = buckets[getBucket(nanoseconds > 0 ? nanoseconds : 0)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	
+	// Adds counts of this histogram to the given ones
+	void addTo(Counts& counts) const
+	{
+		for(size_t i=0; i<BucketsCount; i++)
+		{
+			counts[i] += buckets[i].load(std::memory_order_relaxed);
+		}
+	}
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <ostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Single producer, single consumer ring of log entries, each being a callable that formats the line, with its arguments,
+// or raw bytes that are written out as they are.
+// The producer only copies the callable into the ring, and formatting is left to the consumer, so that logging is cheap for the thread that logs.
+// Entries are contiguous. One that does not fit before the end of the ring is preceded by a padding entry, and starts at the beginning.
+// When the ring is full, entries are dropped, and counted
+class LogRing
+{
+public:
+	
+	static constexpr size_t Alignment = 16;
+	
+private:
+	
+	// Formats the entry into os and destroys it. With os == nullptr it is only destroyed
+	using Formatter = void (*)(void* entry, std::ostream* os);
+	
+	struct alignas(Alignment) EntryHeader
+	{
+		Formatter format; // nullptr for padding
+		size_t size; // of the whole entry, with the header
+	};
+	
+	template <typename Entry>
+	static void formatEntry(void* entry, std::ostream* os)
+	{
+		Entry& e = *static_cast<Entry*>(entry);
+		if(os)
+			e(*os);
+		e.~Entry();
+	}
+	
+	// Raw entry is its length, followed by the bytes
+	static void formatRaw(void* entry, std::ostream* os)
+	{
+		if(os)
+			os->write(static_cast<const char*>(entry) + sizeof(size_t), *static_cast<const size_t*>(entry));
+	}
+	
+	static constexpr size_t roundUp(const size_t size) { return (size + Alignment - 1) / Alignment * Alignment; }
+	
+	std::unique_ptr<EntryHeader[]> storage;
+	char* data;
+	size_t capacity; // in bytes, power of 2
+	
+	// Total bytes ever written and read. Their difference is the number of bytes in the ring
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+	
+	alignas(64) std::atomic<uint64_t> dropped = 0;
+	std::atomic<bool> abandoned = false;
+	
+	// Head after the entry being pushed
+	size_t reservedHead = 0;
+	
+	// Returns where the entry of given size goes, or nullptr if it does not fit
+	char* reserve(const Formatter format, const size_t entrySize)
+	{
+		const size_t size = roundUp(sizeof(EntryHeader) + entrySize);
+		const size_t position = head.load(std::memory_order_relaxed);
+		const size_t offset = position & (capacity - 1);
+		const size_t padding = offset + size > capacity ? capacity - offset : 0;
+		
+		if(size > capacity || position + padding + size - tail.load(std::memory_order_acquire) > capacity)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		
+		if(padding > 0)
+		{
+			new (data + offset) EntryHeader{nullptr, padding};
+		}
+		char* const entryData = data + ((position + padding) & (capacity - 1));
+		new (entryData) EntryHeader{format, size};
+		reservedHead = position + padding + size;
+		return entryData + sizeof(EntryHeader);
+	}
+	void commit()
+	{
+		head.store(reservedHead, std::memory_order_release);
+	}
+	
+public:
+	
+	// Capacity is rounded up to a power of 2
+	LogRing(const size_t minCapacity)
+		: capacity(Alignment)
+	{
+		while(capacity < minCapacity)
+		{
+			capacity *= 2;
+		}
+		storage.reset(new EntryHeader[capacity / sizeof(EntryHeader)]);
+		data = reinterpret_cast<char*>(storage.get());
+	}
+	LogRing(const LogRing&) = delete;
+	~LogRing()
+	{
+		drain(nullptr);
+	}
+	
+	/// Producer
+	
+	// Entry is a callable taking std::ostream&. Returns false if it was dropped, as the ring is full
+	template <typename Entry>
+	bool push(Entry&& entry)
+	{
+		using EntryType = std::decay_t<Entry>;
+		static_assert(alignof(EntryType) <= Alignment, "Over-aligned log entry");
+		
+		char* const entryData = reserve(&formatEntry<EntryType>, sizeof(EntryType));
+		if(!entryData)
+			return false;
+		new (entryData) EntryType(std::forward<Entry>(entry));
+		commit();
+		return true;
+	}
+	
+	// Bytes are written out as they are. Returns false if they were dropped, as the ring is full
+	bool pushRaw(const char* bytes, const size_t length)
+	{
+		char* const entryData = reserve(&formatRaw, sizeof(size_t) + length);
+		if(!entryData)
+			return false;
+		new (entryData) size_t(length);
+		std::memcpy(entryData + sizeof(size_t), bytes, length);
+		commit();
+		return true;
+	}
+	
+	// Marks the ring as no longer used by its producer. It is removed once it is drained
+	void abandon() { abandoned.store(true, std::memory_order_release); }
+	
+	/// Consumer
+	
+	// Formats all entries currently in the ring into os, and removes them. Returns the number of entries
+	size_t drain(std::ostream* os)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		const size_t end = head.load(std::memory_order_acquire);
+		size_t count = 0;
+		while(position != end)
+		{
+			EntryHeader* const header = reinterpret_cast<EntryHeader*>(data + (position & (capacity - 1)));
+			const size_t size = header->size;
+			if(header->format)
+			{
+				header->format(header + 1, os);
+				count++;
+			}
+			position += size;
+		}
+		tail.store(position, std::memory_order_release);
+		return count;
+	}
+	
+	// Number of entries dropped since the last call
+	uint64_t takeDropped() { return dropped.exchange(0, std::memory_order_relaxed); }
+	
+	bool isAbandoned() const { return abandoned.load(std::memory_order_acquire); }
+	
+	/// Any thread
+	
+	// Bytes waiting in the ring. Tail is read first, so that it is never past the head read after it
+	size_t getUsedBytes() const
+	{
+		const size_t position = tail.load(std::memory_order_acquire);
+		return head.load(std::memory_order_acquire) - position;
+	}
+};
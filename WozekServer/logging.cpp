@@ -1,3 +1,283 @@
 #include "logging.hpp"
+#include <streambuf>
+#include <array>
 
 Logger logger;
+binlog::FormatRegistry binlog::formatRegistry;
+
+namespace
+{
+
+// Appends everything written to the stream to a string, through a small buffer, so that formatting does not go character by character
+class StringAppendBuffer : public std::streambuf
+{
+	std::string& str;
+	std::array<char, 4096> area;
+	
+	void moveArea()
+	{
+		str.append(pbase(), pptr() - pbase());
+		setp(area.data(), area.data() + area.size());
+	}
+	
+protected:
+	
+	int_type overflow(int_type c) override
+	{
+		moveArea();
+		if(!traits_type::eq_int_type(c, traits_type::eof()))
+		{
+			sputc(traits_type::to_char_type(c));
+		}
+		return traits_type::not_eof(c);
+	}
+	int sync() override
+	{
+		moveArea();
+		return 0;
+	}
+	
+public:
+	
+	StringAppendBuffer(std::string& str_)
+		: str(str_)
+	{
+		setp(area.data(), area.data() + area.size());
+	}
+};
+
+}
+
+LogRing& Logger::getOutputRing()
+{
+	// Ring stays registered after its thread ends, until the writer drains it
+	struct Registration
+	{
+		std::shared_ptr<LogRing> ring;
+		
+		Registration(Logger& logger)
+			: ring(std::make_shared<LogRing>(OutputRingCapacity))
+		{
+			std::lock_guard lock{logger.outputRingsMutex};
+			logger.outputRings.push_back(ring);
+		}
+		~Registration()
+		{
+			ring->abandon();
+		}
+	};
+	thread_local Registration registration(*this);
+	return *registration.ring;
+}
+
+std::string& Logger::getRecordBuffer()
+{
+	thread_local std::string buffer;
+	return buffer;
+}
+
+Logger::CounterShard& Logger::getCounterShard()
+{
+	// Shard stays after its thread ends, so that its counts are still summed
+	thread_local CounterShard* shard = [this]{
+		std::lock_guard lock{counterShardsMutex};
+		counterShards.push_back(std::make_unique<CounterShard>());
+		return counterShards.back().get();
+	}();
+	return *shard;
+}
+
+void Logger::getErrors(ErrorCounts& res)
+{
+	res.fill(0);
+	std::lock_guard lock{counterShardsMutex};
+	for(const auto& shard : counterShards)
+	{
+		for(size_t i=0; i<ErrorSize; i++)
+		{
+			res[i] += shard->errors[i].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void Logger::getLogs(LogCounts& res)
+{
+	res.fill(0);
+	std::lock_guard lock{counterShardsMutex};
+	for(const auto& shard : counterShards)
+	{
+		for(size_t i=0; i<LogSize; i++)
+		{
+			res[i] += shard->logs[i].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+std::array<LatencyHistogram, Logger::LatencySize>& Logger::getLatencyHistograms()
+{
+	// Histograms stay after their thread ends, so that its latencies are still counted
+	thread_local std::array<LatencyHistogram, LatencySize>* histograms = [this]{
+		std::lock_guard lock{latencyHistogramsMutex};
+		latencyHistograms.push_back(std::make_unique<std::array<LatencyHistogram, LatencySize>>());
+		return latencyHistograms.back().get();
+	}();
+	return *histograms;
+}
+
+void Logger::getLatencies(LatencyCounts& res)
+{
+	for(auto& counts : res)
+	{
+		counts.fill(0);
+	}
+	std::lock_guard lock{latencyHistogramsMutex};
+	for(const auto& histograms : latencyHistograms)
+	{
+		for(size_t i=0; i<LatencySize; i++)
+		{
+			(*histograms)[i].addTo(res[i]);
+		}
+	}
+}
+
+void Logger::getOutputQueueDepths(std::vector<size_t>& res)
+{
+	res.clear();
+	std::lock_guard lock{outputRingsMutex};
+	for(const auto& ring : outputRings)
+	{
+		res.push_back(ring->getUsedBytes());
+	}
+}
+
+void Logger::saveLatencyRecord(const long long now)
+{
+	if(!latencyFile.is_open() || latencyFile.fail())
+		return;
+	
+	auto latencies = std::make_unique<LatencyCounts>();
+	getLatencies(*latencies);
+	
+	bool written = false;
+	for(size_t i=0; i<LatencySize; i++)
+	{
+		// Counts of this interval only
+		LatencyHistogram::Counts interval;
+		for(size_t bucket=0; bucket<LatencyHistogram::BucketsCount; bucket++)
+		{
+			interval[bucket] = (*latencies)[i][bucket] - savedLatencies[i][bucket];
+		}
+		const uint64_t count = LatencyHistogram::getTotal(interval);
+		if(count == 0)
+			continue;
+		
+		latencyFile << now << '\t' << LatencyGetName(i) << '\t' << count
+					<< '\t' << LatencyHistogram::getPercentile(interval, 0.5)
+					<< '\t' << LatencyHistogram::getPercentile(interval, 0.9)
+					<< '\t' << LatencyHistogram::getPercentile(interval, 0.99)
+					<< '\t' << LatencyHistogram::getMax(interval) << '\n';
+		written = true;
+	}
+	if(written)
+	{
+		latencyFile.flush();
+	}
+	savedLatencies = *latencies;
+}
+
+void Logger::outputWriterLoop()
+{
+	// Binary mode only. Formats registered since the last batch, which go into the file before it
+	std::string formats;
+	uint32_t formatsWritten = 0;
+	
+	std::string batch;
+	batch.reserve(OutputBatchSize * 2);
+	StringAppendBuffer buffer(batch);
+	std::ostream os(&buffer);
+	
+	auto batchStart = std::chrono::steady_clock::now();
+	while(true)
+	{
+		// Rings are drained once more after stopping, so that nothing logged before is lost
+		const bool stopping = !outputWriterRunning.load(std::memory_order_acquire);
+		const bool wasEmpty = batch.empty();
+		
+		size_t lines = 0;
+		uint64_t dropped = 0;
+		{
+			std::lock_guard lock{outputRingsMutex};
+			for(auto it = outputRings.begin(); it != outputRings.end(); )
+			{
+				// Abandoned flag has to be read first, the ring could get its last entries right before being abandoned
+				const bool abandoned = (*it)->isAbandoned();
+				lines += (*it)->drain(&os);
+				dropped += (*it)->takeDropped();
+				if(abandoned)
+					it = outputRings.erase(it);
+				else
+					++it;
+			}
+		}
+		os.flush();
+		if(dropped > 0)
+		{
+			if(binaryOutput)
+			{
+				batch.push_back(static_cast<char>(binlog::RecordTag::Dropped));
+				binlog::writeVarint(batch, dropped);
+			}
+			else
+			{
+				os << "# Dropped " << dropped << " lines of output, as they were logged faster than they could be written\n";
+				os.flush();
+			}
+			log(Log::OutputLinesDropped, dropped);
+		}
+		// Every format used by the records drained is registered by now
+		if(binaryOutput && lines > 0)
+		{
+			formatsWritten = binlog::formatRegistry.writeFormats(formats, formatsWritten);
+		}
+		
+		const auto now = std::chrono::steady_clock::now();
+		if(wasEmpty)
+		{
+			batchStart = now;
+		}
+		if(batch.size() >= OutputBatchSize || (!batch.empty() && (stopping || now - batchStart >= OutputFlushInterval)))
+		{
+			writeOutputBatch(formats, batch);
+			formats.clear();
+			batch.clear();
+		}
+		
+		if(stopping)
+			break;
+		if(lines == 0)
+			std::this_thread::sleep_for(OutputIdleInterval);
+	}
+}
+
+void Logger::writeOutputBatch(const std::string& formats, const std::string& batch)
+{
+	if(outputFile.is_open() && !outputFile.fail())
+	{
+		outputFile.write(formats.data(), formats.size());
+		outputFile.write(batch.data(), batch.size());
+		outputFile.flush();
+	}
+	if(writeOutputToStdout && !binaryOutput)
+	{
+		std::cout.write(batch.data(), batch.size());
+		std::cout.flush();
+	}
+}
+
+void Logger::stop()
+{
+	if(!outputWriter.joinable())
+		return;
+	outputWriterRunning.store(false, std::memory_order_release);
+	outputWriter.join();
+}
@@ -5,8 +5,17 @@
 #include <fstream>
 #include <chrono>
 #include <string>
+#include <optional>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include "enum.hpp"
+#include "logRing.hpp"
+#include "binaryLog.hpp"
+#include "latencyHistogram.hpp"
 
 namespace fs = std::filesystem;
 
@@ -18,9 +27,12 @@ public:
 			UnknownError,
 			TcpTimeout, TcpInvalidRequests, TcpForbidden,
 			TcpEchoTooLong,
-			TcpInvalidNameSizeForLookup,
-			TcpRegisterAsControllerInvalidName,
-			FileSystemError, TcpSegFileTransferError,
+			TcpInvalidNameSizeForLookup, TcpInvalidBulkLookup, TcpInvalidPrefixScan,
+			TcpRegisterAsControllerInvalidName, TcpRegisterAsControllerTableFull,
+			TcpStartTheWorldFailed, TcpJoinWorldFailed,
+			FileSystemError, TcpSegFileTransferError, TcpInvalidFileName,
+			DatabaseSnapshotError, DatabaseLogError,
+			TrafficCaptureError,
 			TcpUnexpectedConnectionClosed,
 			TcpConnectionBroken, TcpUnknownError,
 			UdpConnectionError, UdpResolutionError, UdpTransmissionError,
@@ -28,10 +40,21 @@ public:
 			UdpUnknownError)
 	
 	SMARTENUM( Log, 
-			TcpActiveConnections, TcpTotalConnections)
+			TcpActiveConnections, TcpTotalConnections,
+			WorldTickOverruns, WorldSkippedTicks,
+			OutputLinesDropped)
 	
-	bool logChanged = true;
-	bool errorChanged = true;
+	// Requests, whose latencies are recorded. TCP ones from receiving the request code until the session awaits the next request,
+	// UDP ones from receiving the datagram until handling of it ends
+	SMARTENUM( Latency,
+			TcpEcho, TcpRegisterAsController, TcpLookupIdForName, TcpBulkLookupIdForName,
+			TcpScanNamesByPrefix, TcpControllerChangesSince, TcpStartTheWorld,
+			TcpMetricsSnapshot, TcpJoinWorld, TcpLeaveWorld, TcpUploadFile, TcpDownloadFile,
+			UdpEcho, UdpFetchState, UdpUpdateState, UdpAckHostState, UdpUpdateControllerState)
+	
+	using ErrorCounts = std::array<unsigned long long, ErrorSize>;
+	using LogCounts = std::array<unsigned long long, LogSize>;
+	using LatencyCounts = std::array<LatencyHistogram::Counts, LatencySize>;
 	
 private:
 	
@@ -40,39 +63,112 @@ private:
 	std::ofstream outputFile;
 	std::ofstream errorFile;
 	std::ofstream logFile;
+	std::ofstream latencyFile;
 	
 	
-	std::array< unsigned long long, ErrorSize> errorArr;
-	std::array< unsigned long long, LogSize> logArr;
-	
 	std::optional<asio::io_context::strand> strand;
 	
 	std::chrono::seconds saveLogsTimerDuration;
 	std::optional<asio::steady_timer> saveLogsTimer;
 	
+	/// Counters
+	// Each thread adds to its own shard, the only thread writing to it, so a plain relaxed store is enough.
+	// Shards are summed only when saving, showing or taking a snapshot
+	
+	struct alignas(64) CounterShard // on its own cache lines
+	{
+		std::array<std::atomic<unsigned long long>, ErrorSize> errors = {};
+		std::array<std::atomic<unsigned long long>, LogSize> logs = {};
+	};
+	
+	std::mutex counterShardsMutex;
+	std::vector<std::unique_ptr<CounterShard>> counterShards;
+	
+	// Sums as of the previous save, rows are written only if they changed
+	ErrorCounts savedErrors = {};
+	LogCounts savedLogs = {};
+	bool errorChanged = true;
+	bool logChanged = true;
+	
+	// Shard of the calling thread, created on first use
+	CounterShard& getCounterShard();
+	
+	static void add(std::atomic<unsigned long long>& counter, const long long n)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	
+	/// Latencies
+	// Each thread records into its own histograms. They are merged when saving, and written for the interval since the previous save
+	
+	std::mutex latencyHistogramsMutex;
+	std::vector<std::unique_ptr<std::array<LatencyHistogram, LatencySize>>> latencyHistograms;
+	
+	// Merged counts as of the previous save
+	LatencyCounts savedLatencies = {};
+	
+	// Histograms of the calling thread, created on first use
+	std::array<LatencyHistogram, LatencySize>& getLatencyHistograms();
+	
+	void saveLatencyRecord(const long long now);
+	
+	/// Output
+	// Each thread puts its lines, still unformatted, into its own ring. A single writer thread drains the rings,
+	// formats the lines in batches, and writes each batch to the output file (and stdout) at once
+	
+	static constexpr size_t OutputRingCapacity = 256 * 1024;
+	static constexpr size_t OutputBatchSize = 64 * 1024; // bytes, batch is written once it grows to that size
+	static constexpr auto OutputFlushInterval = std::chrono::milliseconds(100); // or once its oldest line waits that long
+	static constexpr auto OutputIdleInterval = std::chrono::milliseconds(2); // writer sleeps that long, when rings are empty
+	
+	std::mutex outputRingsMutex;
+	std::vector<std::shared_ptr<LogRing>> outputRings;
+	
+	std::atomic<bool> outputWriterRunning = false;
+	std::thread outputWriter;
+	
+	// In binary mode, lines are records of binlog. Time of records is counted from outputStart
+	std::chrono::steady_clock::time_point outputStart;
+	
+	// Ring of the calling thread, created on first use
+	LogRing& getOutputRing();
+	// Buffer of the calling thread, for encoding binary records
+	static std::string& getRecordBuffer();
+	
+	void outputWriterLoop();
+	void writeOutputBatch(const std::string& formats, const std::string& batch);
+	
 	template <typename ...Args>
-	bool writeToFile(std::ofstream& os, Args&& ...args)
+	bool outputBinary(const Args& ...args)
 	{
-		if(!os.is_open() || os.fail())
-		{
-			return false;
-		}
-		asio::post(getStrand(), [&os, args...]{ 
-			(os << ... << args) << '\n';
-			os.flush(); // Possibly delete
-		});
-		return true;
+		const uint32_t id = binlog::getFormatId(args...);
+		const uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - outputStart).count();
+		
+		std::string& record = getRecordBuffer();
+		record.clear();
+		record.push_back(static_cast<char>(binlog::RecordTag::Event));
+		binlog::writeVarint(record, id);
+		binlog::writeVarint(record, time);
+		(binlog::writeArg(record, args), ...);
+		return getOutputRing().pushRaw(record.data(), record.size());
 	}
 	
 	void saveLogsRecord()
 	{
 		auto now = getTimestamp();
+		ErrorCounts errors;
+		LogCounts logs;
+		getErrors(errors);
+		getLogs(logs);
+		errorChanged = errorChanged || errors != savedErrors;
+		logChanged = logChanged || logs != savedLogs;
+		
 		if(errorChanged && errorFile.is_open() && !errorFile.fail())
 		{
 			errorFile << now;
 			for(size_t i=0; i<ErrorSize; i++)
 			{
-				errorFile << '\t' << errorArr[i];
+				errorFile << '\t' << errors[i];
 			}
 			errorFile << '\n';
 			errorFile.flush();
@@ -83,12 +179,15 @@ private:
 			logFile << now;
 			for(size_t i=0; i<LogSize; i++)
 			{
-				logFile << '\t' << logArr[i];
+				logFile << '\t' << logs[i];
 			}
 			logFile << '\n';
 			logFile.flush();
 			logChanged = false;
 		}
+		savedErrors = errors;
+		savedLogs = logs;
+		saveLatencyRecord(now);
 	}
 	
 	void saveLogsTimerStart(const std::chrono::seconds& duration)
@@ -112,28 +211,49 @@ private:
 public:
 	
 	Logger()
-		: errorArr{}, logArr{}
 	{
 	}
+	~Logger()
+	{
+		stop();
+	}
 	
-	bool init(const fs::path& outputPath, const fs::path& errorPath, const fs::path& logPath, const std::chrono::seconds& saveLogsTimerDuration )
+	bool init(const fs::path& outputPath, const fs::path& errorPath, const fs::path& logPath, const fs::path& latencyPath, const std::chrono::seconds& saveLogsTimerDuration )
 	{
 		if(!strand.has_value())
 			return false;
 		
-		outputFile.open(outputPath, std::ios::app);
+		if(binaryOutput)
+		{
+			outputFile.open(fs::path(outputPath).replace_extension(".bin"), std::ios::app | std::ios::binary);
+		}
+		else
+		{
+			outputFile.open(outputPath, std::ios::app);
+		}
 		errorFile.open(errorPath, std::ios::app);
 		logFile.open(logPath, std::ios::app);
+		latencyFile.open(latencyPath, std::ios::app);
 		
 		std::string header = "# New Session: ";
 		header += std::to_string(getTimestamp());
 		header += '\n';
 		
-		if(outputFile.is_open())
+		if(outputFile.is_open() && binaryOutput)
+		{
+			binlog::FileHeader fileHeader;
+			std::memcpy(fileHeader.magic, binlog::FileHeader::Magic, sizeof(fileHeader.magic));
+			fileHeader.version = binlog::FileHeader::CurrentVersion;
+			fileHeader.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			outputFile.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+			outputFile.flush();
+		}
+		else if(outputFile.is_open())
 		{
 			outputFile << header;
 			outputFile.flush();
 		}
+		outputStart = std::chrono::steady_clock::now();
 		if(errorFile.is_open())
 		{
 			errorFile << header << "#Timestamp";
@@ -154,15 +274,27 @@ public:
 			logFile << '\n';
 			logFile.flush();
 		}
+		if(latencyFile.is_open())
+		{
+			latencyFile << header << "#Timestamp\tRequest\tCount\tP50\tP90\tP99\tMax (nanoseconds, for requests handled since the previous record)\n";
+			latencyFile.flush();
+		}
 		
 		saveLogsTimerStart(saveLogsTimerDuration);
 		
+		outputWriterRunning.store(true, std::memory_order_release);
+		outputWriter = std::thread([this]{ outputWriterLoop(); });
+		
 		return true;
 	}
 	
+	// Writes out the remaining output and stops the writer
+	void stop();
+	
 	bool isOutputFileOpen() { return outputFile.is_open(); }
 	bool isErrorFileOpen() { return errorFile.is_open(); }
 	bool isLogFileOpen() { return logFile.is_open(); }
+	bool isLatencyFileOpen() { return latencyFile.is_open(); }
 	auto& getStrand() { return strand.value(); }
 	
 	void setStrand(asio::io_context& ioContext)
@@ -172,51 +304,77 @@ public:
 	}
 	
 	
+	// Set before init
 	bool writeOutputToStdout = true;
+	// Output is written to a binary file (the output path with extension .bin), to be decoded by WozekLogDecoder, and not to stdout
+	bool binaryOutput = false;
 	
+	// Arguments are copied, and written with operator<< later, on the writer thread.
+	// Pointers are copied as they are, so a C string that may not outlive the call has to be passed as std::string.
+	// Constant text of the line is passed as "..."_fmt. In binary mode it is written once, as the format of the call site,
+	// and only the values of the other arguments are encoded. Arrays of chars are values, written up to the first NUL.
+	// Returns false if the line was dropped, as the writer cannot keep up
 	template <typename ...Args>
 	bool output(Args&& ...args)
 	{
-		if(writeOutputToStdout)
+		if(binaryOutput)
 		{
-			(std::cout << ... << args) << '\n';
+			return outputBinary(args...);
 		}
-		
-		return writeToFile(outputFile, std::forward<Args>(args)... );
+		return getOutputRing().push([args...](std::ostream& os){
+			(binlog::writeText(os, args), ...);
+			os << '\n';
+		});
 	}
 	
+	// Never blocks, apart from the first call on each thread
 	void log(const Log name, const long long n = 1)
 	{
-		asio::post(getStrand(), [=]{ 
-			logChanged = true;
-			logArr[static_cast<int>(name)] += n;
-		});
+		add(getCounterShard().logs[static_cast<int>(name)], n);
 	}
 	
 	void error(const Error name, const long long n = 1)
 	{
-		asio::post(getStrand(), [=]{ 
-			errorChanged = true;
-			errorArr[static_cast<int>(name)] += n;
-		});
+		add(getCounterShard().errors[static_cast<int>(name)], n);
+	}
+	
+	// Never blocks, apart from the first call on each thread
+	void latency(const Latency name, const std::chrono::steady_clock::duration duration)
+	{
+		getLatencyHistograms()[static_cast<int>(name)].record(duration);
 	}
 	
+	// Merged histograms of all threads, since the start
+	void getLatencies(LatencyCounts& res);
+	
+	// Summed counters of all threads, since the start
+	void getErrors(ErrorCounts& res);
+	void getLogs(LogCounts& res);
+	
+	// Bytes waiting to be written, in the output ring of each thread, and the capacity of a ring
+	void getOutputQueueDepths(std::vector<size_t>& res);
+	static constexpr size_t getOutputRingCapacity() { return OutputRingCapacity; }
+	
 	void showErrors(std::ostream& os)
 	{
+		ErrorCounts errors;
+		getErrors(errors);
 		os << "Errors as of " << getTimestamp() << ":\n";
 		for(size_t i=0; i<ErrorSize; i++)
 		{
-			os << ErrorGetName(i) << ": " << errorArr[i] << '\n';
+			os << ErrorGetName(i) << ": " << errors[i] << '\n';
 		}
 	}
 	
 	
 	void showLogs(std::ostream& os)
 	{
+		LogCounts logs;
+		getLogs(logs);
 		os << "Logs as of " << getTimestamp() << ":\n";
 		for(size_t i=0; i<LogSize; i++)
 		{
-			os << LogGetName(i) << ": " << logArr[i] << '\n';
+			os << LogGetName(i) << ": " << logs[i] << '\n';
 		}
 	}
 	
@@ -10,19 +10,21 @@ int main(int argc, char** argv)
 	
 	if(argc < 4)
 	{
-		std::cout << "Use the parameters [port] [additional_threads] [directory]";
+		std::cout << "Use the parameters [port] [additional_threads] [directory] [capture_file (optional)]";
 		return 0;
 	}
 	
 	short port = std::atoi(argv[1]);
 	short threads = std::atoi(argv[2]);
 	std::string dir = argv[3];
+	std::string captureFile = argc > 4 ? argv[4] : "";
 	
 	#else
 	
 	short port = 8081;
 	short threads = 5;
 	std::string dir = "ServerFiles";
+	std::string captureFile = "";
 	
 	#endif // RELEASE
 	
@@ -33,6 +35,7 @@ int main(int argc, char** argv)
 	
 	const fs::path logsPath = fs::path(dir) / "logs";
 	const fs::path configPath = fs::path(dir) / "config";
+	const fs::path databasePath = fs::path(dir) / "database";
 	
 	tcp::WozekServer server(ioContext);
 	udp::WozekUDPServer wozekUdpServer(ioContext);
@@ -57,30 +60,51 @@ int main(int argc, char** argv)
 			}
 		}
 		
+		if(!fs::exists(databasePath))
+		{
+			if(!fs::create_directory(databasePath))
+			{
+				std::cout << "Cannot create directory for database\n";
+				return 0;
+			}
+		}
+		
 		logger.setStrand(ioContext);
-		if(!logger.init(logsPath / "output.txt", logsPath / "error.txt", logsPath / "log.txt", std::chrono::seconds(30)))
+		logger.binaryOutput = config.binaryOutputLog;
+		if(!logger.init(logsPath / "output.txt", logsPath / "error.txt", logsPath / "log.txt", logsPath / "latency.txt", std::chrono::seconds(30)))
 		{
 			std::cout << "Cannot initialize logger\n";
 			return 0;
 		}
 		
-		if(!logger.isErrorFileOpen() || !logger.isLogFileOpen() || !logger.isOutputFileOpen())
+		if(!logger.isErrorFileOpen() || !logger.isLogFileOpen() || !logger.isOutputFileOpen() || !logger.isLatencyFileOpen())
 		{
 			std::cout << "Cannot create/open files required for logging\n";
 			return 0;
 		}
 		
-		if(!config.init(configPath / "allowedips4.txt", std::chrono::seconds(5)))
+		if(!config.init(configPath / "allowedips4.txt", configPath / "allowedhosts4.txt", std::chrono::seconds(5)))
 		{
 			std::cout << "Cannot inicialize config\n";
 			return 0;
 		}
-		ipAuthorizer.init(ioContext);
+		ipAuthorizer.init(ioContext, config.allowedIpv4FilePath);
+		hostAuthorizer.init(ioContext, config.allowedHostsIpv4FilePath);
 		
 		//db::Database database;
 		//db::databaseManager.setDatabase(database);
 		db::databaseManager.setContext(ioContext);
 		
+		if(!db::databaseManager.open(databasePath))
+		{
+			std::cout << "Cannot load database from " << databasePath << '\n';
+			return 0;
+		}
+		db::databaseManager.startSnapshots(config.databaseSnapshotInterval);
+		db::databaseManager.startSweeps(config.controllerExpiryTime, config.controllerSweepInterval);
+		
+		worldManager.start(ioContext, config.worldShards, config.worldRebalanceInterval);
+		
 		if( !fileManager.setWorkingDirectory(dir) )
 		{
 			std::cout << "Working directory of \"" << dir << "\" (" << fs::absolute(fs::path(dir)) << ") dosent exist\n";
@@ -88,6 +112,16 @@ int main(int argc, char** argv)
 		}
 		fileManager.setContext(ioContext);
 		
+		if(!captureFile.empty())
+		{
+			if(!trafficCapture.start(ioContext, captureFile, config.trafficCaptureMaxSize))
+			{
+				std::cout << "Cannot create traffic capture file " << captureFile << '\n';
+				return 0;
+			}
+			std::cout << "Capturing traffic to " << captureFile << '\n';
+		}
+		
 		if(server.start(port))
 		{
 			std::cout << "TCP Server started on port " << port << '\n';
@@ -139,6 +173,11 @@ int main(int argc, char** argv)
 			t.join();
 		}
 		
+		db::databaseManager.stopSnapshots();
+		worldManager.stop();
+		trafficCapture.stop();
+		logger.stop();
+		
 	}
 	catch(std::exception& e)
 	{
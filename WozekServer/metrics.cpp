@@ -0,0 +1,92 @@
+#include "metrics.hpp"
+#include "logging.hpp"
+#include "fileManager.hpp"
+#include "worldManager.hpp"
+#include <memory>
+#include <vector>
+
+namespace metrics
+{
+
+void writeSnapshot(std::ostream& os)
+{
+	os << "wozek_timestamp_seconds " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() << '\n';
+	
+	/// Counters
+	
+	Logger::ErrorCounts errors;
+	logger.getErrors(errors);
+	for(size_t i=0; i<Logger::ErrorSize; i++)
+	{
+		os << "wozek_error{name=\"" << Logger::ErrorGetName(i) << "\"} " << errors[i] << '\n';
+	}
+	Logger::LogCounts logs;
+	logger.getLogs(logs);
+	for(size_t i=0; i<Logger::LogSize; i++)
+	{
+		os << "wozek_log{name=\"" << Logger::LogGetName(i) << "\"} " << logs[i] << '\n';
+	}
+	
+	/// Latencies, in nanoseconds
+	
+	auto latencies = std::make_unique<Logger::LatencyCounts>();
+	logger.getLatencies(*latencies);
+	for(size_t i=0; i<Logger::LatencySize; i++)
+	{
+		const auto& counts = (*latencies)[i];
+		const auto name = Logger::LatencyGetName(i);
+		os << "wozek_latency_count{request=\"" << name << "\"} " << LatencyHistogram::getTotal(counts) << '\n';
+		for(const auto& [quantile, fraction] : {std::pair{"0.5", 0.5}, std::pair{"0.9", 0.9}, std::pair{"0.99", 0.99}})
+		{
+			os << "wozek_latency_nanoseconds{request=\"" << name << "\",quantile=\"" << quantile << "\"} " << LatencyHistogram::getPercentile(counts, fraction) << '\n';
+		}
+		os << "wozek_latency_max_nanoseconds{request=\"" << name << "\"} " << LatencyHistogram::getMax(counts) << '\n';
+	}
+	
+	/// Pools
+	
+	auto& bufferPool = fileManager.getBufferPool();
+	os << "wozek_buffer_pool_buffers " << bufferPool.getPooledCount() << '\n';
+	os << "wozek_buffer_pool_bytes " << bufferPool.getPooledSize() << '\n';
+	
+	auto& cache = fileManager.getCache();
+	os << "wozek_file_cache_files " << cache.getFilesCount() << '\n';
+	os << "wozek_file_cache_bytes " << cache.getTotalSize() << '\n';
+	os << "wozek_file_cache_limit_bytes " << cache.getSizeLimit() << '\n';
+	
+	/// Queues
+	
+	std::vector<size_t> outputQueues;
+	logger.getOutputQueueDepths(outputQueues);
+	os << "wozek_output_ring_capacity_bytes " << Logger::getOutputRingCapacity() << '\n';
+	for(size_t i=0; i<outputQueues.size(); i++)
+	{
+		os << "wozek_output_ring_bytes{ring=\"" << i << "\"} " << outputQueues[i] << '\n';
+	}
+	
+	/// Load of the shards and worlds
+	
+	std::vector<WorldManager::ShardStats> shards;
+	std::vector<WorldManager::WorldStats> worlds;
+	worldManager.getStats(shards, worlds);
+	for(size_t i=0; i<shards.size(); i++)
+	{
+		os << "wozek_shard_worlds{shard=\"" << i << "\"} " << shards[i].worldsCount << '\n';
+		os << "wozek_shard_tick_nanoseconds_total{shard=\"" << i << "\"} " << shards[i].totalTickDuration.count() << '\n';
+		os << "wozek_shard_rebalance_cost_nanoseconds{shard=\"" << i << "\"} " << shards[i].cost.count() << '\n';
+	}
+	for(const auto& world : worlds)
+	{
+		const auto& metrics = world.tickMetrics;
+		const auto labels = "{world=\"" + std::to_string(world.id) + "\",shard=\"" + std::to_string(world.shard) + "\"} ";
+		os << "wozek_world_ticks_total" << labels << metrics.ticks << '\n';
+		os << "wozek_world_overruns_total" << labels << metrics.overruns << '\n';
+		os << "wozek_world_skipped_ticks_total" << labels << metrics.skippedTicks << '\n';
+		os << "wozek_world_dropped_host_states_total" << labels << metrics.droppedHostStates << '\n';
+		os << "wozek_world_tick_nanoseconds_total" << labels << metrics.totalTickDuration.count() << '\n';
+		os << "wozek_world_last_tick_nanoseconds" << labels << metrics.lastTickDuration.count() << '\n';
+		os << "wozek_world_max_tick_nanoseconds" << labels << metrics.maxTickDuration.count() << '\n';
+	}
+}
+
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <ostream>
+
+// Snapshot of the server state for monitoring, served by the MetricsSnapshot TCP request (see Datagrams.hpp).
+// Every counter of the logger, latency percentiles of every request, pools, queues, and the load of every shard and world.
+// Counters, latencies and tick durations are totals since the start, so that a scraper can take their rates between snapshots.
+// Nothing is read from the disk, and no lock taken by request handling is held for longer than copying a list
+namespace metrics
+{
+	void writeSnapshot(std::ostream& os);
+}
@@ -1,6 +1,11 @@
+#pragma once
+
 #include "asio_lib.hpp"
 #include "Datagrams.hpp"
 
+#include <chrono>
+#include <algorithm>
+
 
 
 namespace segFileTransfer
@@ -77,4 +82,119 @@ namespace segFileTransfer
 		});
 	}
 	
+	
+	
+	// Chooses the segment length and window (number of segments sent without awaiting a Negotiation)
+	// for the receiving side, based on the measured round trip time and throughput.
+	// The bytes sent per round are grown exponentially as long as the throughput keeps up,
+	// and then kept at a few bandwidth-delay products, so that the stall at each negotiation stays small.
+	class Negotiator
+	{
+	public:
+		
+		using Clock = std::chrono::steady_clock;
+		using Negotiation = data::SegmentedFileTransfer::Negotiation;
+		
+		static constexpr double GrowthThreshold = 1.25;
+		static constexpr double BdpMultiplier = 4;
+		static constexpr double RttSmoothing = 1.0 / 8;
+		
+	private:
+		
+		uint64_t minSegmentLength = 1;
+		uint64_t maxSegmentLength = 1;
+		uint32_t maxWindow = 1;
+		
+		uint64_t bytesPerRound = 0;
+		bool growing = true;
+		
+		double smoothedRtt = 0; // seconds
+		double bestThroughput = 0; // bytes per second
+		
+		Clock::time_point roundStart;
+		Clock::time_point firstDataTime;
+		bool hasFirstData = false;
+		uint64_t roundBytes = 0;
+		uint64_t firstDataBytes = 0;
+		
+		uint64_t getMaxBytesPerRound() const { return maxSegmentLength * maxWindow; }
+		
+		void addThroughputSample(const double throughput)
+		{
+			if(growing && throughput < bestThroughput * GrowthThreshold)
+			{
+				growing = false;
+			}
+			bestThroughput = std::max(bestThroughput, throughput);
+			
+			if(growing)
+			{
+				bytesPerRound = std::min(bytesPerRound * 2, getMaxBytesPerRound());
+				return;
+			}
+			
+			const double target = BdpMultiplier * bestThroughput * smoothedRtt;
+			bytesPerRound = std::clamp<uint64_t>( (bytesPerRound * 3 + uint64_t(target)) / 4, minSegmentLength, getMaxBytesPerRound() );
+		}
+		
+	public:
+		
+		void setBounds(const uint64_t minSegmentLength_, const uint64_t maxSegmentLength_, const uint32_t maxWindow_)
+		{
+			maxSegmentLength = std::max<uint64_t>(maxSegmentLength_, 1);
+			minSegmentLength = std::clamp<uint64_t>(minSegmentLength_, 1, maxSegmentLength);
+			maxWindow = std::max<uint32_t>(maxWindow_, 1);
+			bytesPerRound = minSegmentLength;
+		}
+		
+		uint64_t getMaxSegmentLength() const { return maxSegmentLength; }
+		double getSmoothedRtt() const { return smoothedRtt; }
+		double getBestThroughput() const { return bestThroughput; }
+		
+		// Called after the Negotiation is sent
+		void startRound()
+		{
+			roundStart = Clock::now();
+			hasFirstData = false;
+			roundBytes = 0;
+			firstDataBytes = 0;
+		}
+		
+		// Called after every portion of segment data is received
+		void addReceivedBytes(const uint64_t bytes)
+		{
+			if(!hasFirstData)
+			{
+				hasFirstData = true;
+				firstDataTime = Clock::now();
+				firstDataBytes = bytes;
+				
+				const double rtt = std::chrono::duration<double>(firstDataTime - roundStart).count();
+				smoothedRtt = smoothedRtt == 0 ? rtt : smoothedRtt + (rtt - smoothedRtt) * RttSmoothing;
+			}
+			roundBytes += bytes;
+		}
+		
+		bool isAwaitingFirstData() const { return !hasFirstData; }
+		
+		// Called when the next Negotiation is due
+		Negotiation negotiate()
+		{
+			if(hasFirstData && roundBytes > firstDataBytes)
+			{
+				const double duration = std::chrono::duration<double>(Clock::now() - firstDataTime).count();
+				if(duration > 0)
+				{
+					addThroughputSample( (roundBytes - firstDataBytes) / duration );
+				}
+			}
+			
+			Negotiation res;
+			res.code = data::SegmentedFileTransfer::Good;
+			res.segmentLength = std::clamp<uint64_t>(bytesPerRound / 2, minSegmentLength, maxSegmentLength);
+			res.window = std::clamp<uint64_t>( (bytesPerRound + res.segmentLength - 1) / res.segmentLength, 1, maxWindow );
+			return res;
+		}
+	};
+	
 }
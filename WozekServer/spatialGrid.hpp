@@ -0,0 +1,208 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cassert>
+
+// Uniform grid of cubic cells, holding handles (small integers, like dense indices) of entities by their positions.
+// Only the occupied cells exist, in a hash map keyed by cell coordinates, so the grid is unbounded and its memory
+// follows the number of entities. Updating an entity which stays in its cell is just a key comparison,
+// and moving it between cells is O(1), as every handle remembers its place in the cell.
+class SpatialGrid
+{
+public:
+	
+	using Handle = uint32_t;
+	using CellKey = uint64_t;
+	
+private:
+	
+	static constexpr CellKey NoCell = ~CellKey(0);
+	
+	// Cell coordinates are packed by 21 bits each. Positions further than 2^20 cells from the origin are clamped to the outermost cells
+	static constexpr int32_t CoordinateBits = 21;
+	static constexpr int32_t CoordinateMask = (1 << CoordinateBits) - 1;
+	static constexpr int32_t MinCoordinate = -(1 << (CoordinateBits - 1));
+	static constexpr int32_t MaxCoordinate = (1 << (CoordinateBits - 1)) - 1;
+	
+	float cellSize;
+	float inverseCellSize;
+	
+	std::unordered_map<CellKey, std::vector<Handle>> cells;
+	
+	// By handle
+	std::vector<CellKey> handleCells;
+	std::vector<uint32_t> handleSlots; // index of the handle in its cell
+	
+	static CellKey packCell(const int32_t x, const int32_t y, const int32_t z)
+	{
+		return (CellKey(x & CoordinateMask) << (2 * CoordinateBits)) | (CellKey(y & CoordinateMask) << CoordinateBits) | CellKey(z & CoordinateMask);
+	}
+	
+	static int32_t unpackCoordinate(const CellKey key, const int32_t shift)
+	{
+		// Sign extension of the 21 bit value
+		const int32_t value = static_cast<int32_t>((key >> shift) & CoordinateMask);
+		return value > MaxCoordinate ? value - (1 << CoordinateBits) : value;
+	}
+	
+	// Clamped before the conversion, as converting NaN or a float out of the range of int32_t is undefined. NaN goes to the cell 0
+	int32_t getCellCoordinate(const float value) const
+	{
+		const float cell = std::floor(value * inverseCellSize);
+		if(std::isnan(cell))
+			return 0;
+		if(cell <= MinCoordinate)
+			return MinCoordinate;
+		if(cell >= MaxCoordinate)
+			return MaxCoordinate;
+		return static_cast<int32_t>(cell);
+	}
+	
+	void addToCell(const Handle handle, const CellKey key)
+	{
+		auto& cell = cells[key];
+		handleCells[handle] = key;
+		handleSlots[handle] = cell.size();
+		cell.push_back(handle);
+	}
+	
+	void removeFromCell(const Handle handle)
+	{
+		auto it = cells.find(handleCells[handle]);
+		assert(it != cells.end());
+		auto& cell = it->second;
+		
+		// Last handle of the cell takes the place of the removed one
+		const auto slot = handleSlots[handle];
+		cell[slot] = cell.back();
+		handleSlots[cell[slot]] = slot;
+		cell.pop_back();
+		if(cell.empty())
+		{
+			cells.erase(it);
+		}
+		handleCells[handle] = NoCell;
+	}
+	
+public:
+	
+	explicit SpatialGrid(const float cellSize_)
+	{
+		setCellSize(cellSize_);
+	}
+	
+	// Can be changed only while the grid is empty
+	void setCellSize(const float cellSize_)
+	{
+		assert(cells.empty() && cellSize_ > 0);
+		cellSize = cellSize_;
+		inverseCellSize = 1.0f / cellSize_;
+	}
+	
+	float getCellSize() const { return cellSize; }
+	size_t getCellsCount() const { return cells.size(); }
+	
+	CellKey getCellKey(const float x, const float y, const float z) const
+	{
+		return packCell(getCellCoordinate(x), getCellCoordinate(y), getCellCoordinate(z));
+	}
+	
+	void insert(const Handle handle, const float x, const float y, const float z)
+	{
+		if(handle >= handleCells.size())
+		{
+			handleCells.resize(handle + 1, NoCell);
+			handleSlots.resize(handle + 1, 0);
+		}
+		assert(handleCells[handle] == NoCell);
+		addToCell(handle, getCellKey(x, y, z));
+	}
+	
+	// Returns true if the handle moved to another cell
+	bool update(const Handle handle, const float x, const float y, const float z)
+	{
+		const auto key = getCellKey(x, y, z);
+		if(key == handleCells[handle])
+		{
+			return false;
+		}
+		removeFromCell(handle);
+		addToCell(handle, key);
+		return true;
+	}
+	
+	void remove(const Handle handle)
+	{
+		removeFromCell(handle);
+	}
+	
+	// Gives the entity of handle from, the handle to, which has to be unused (for keeping handles dense after a removal)
+	void renumber(const Handle from, const Handle to)
+	{
+		assert(handleCells[to] == NoCell);
+		const auto key = handleCells[from];
+		const auto slot = handleSlots[from];
+		cells[key][slot] = to;
+		handleCells[to] = key;
+		handleSlots[to] = slot;
+		handleCells[from] = NoCell;
+	}
+	
+	// Calls callback(Handle) for every handle in the cells overlapping the cube of given radius around the center.
+	// These include all handles within the radius, and some further away, so the caller filters them by exact distance.
+	// A cube spanning more cells than there are occupied ones is not walked cell by cell, the occupied cells are scanned instead
+	template <typename Callback>
+	void forEachNear(const float x, const float y, const float z, const float radius, Callback&& callback) const
+	{
+		const int32_t minX = getCellCoordinate(x - radius), maxX = getCellCoordinate(x + radius);
+		const int32_t minY = getCellCoordinate(y - radius), maxY = getCellCoordinate(y + radius);
+		const int32_t minZ = getCellCoordinate(z - radius), maxZ = getCellCoordinate(z + radius);
+		if(minX > maxX || minY > maxY || minZ > maxZ)
+		{
+			return;
+		}
+		
+		// At most 2^21 cells along each axis, so the product fits
+		const uint64_t span = uint64_t(maxX - minX + 1) * uint64_t(maxY - minY + 1) * uint64_t(maxZ - minZ + 1);
+		if(span > cells.size())
+		{
+			for(const auto& [key, cell] : cells)
+			{
+				const int32_t cellX = unpackCoordinate(key, 2 * CoordinateBits);
+				const int32_t cellY = unpackCoordinate(key, CoordinateBits);
+				const int32_t cellZ = unpackCoordinate(key, 0);
+				if(cellX < minX || cellX > maxX || cellY < minY || cellY > maxY || cellZ < minZ || cellZ > maxZ)
+				{
+					continue;
+				}
+				for(const auto handle : cell)
+				{
+					callback(handle);
+				}
+			}
+			return;
+		}
+		
+		for(int32_t cellX = minX; cellX <= maxX; cellX++)
+		{
+			for(int32_t cellY = minY; cellY <= maxY; cellY++)
+			{
+				for(int32_t cellZ = minZ; cellZ <= maxZ; cellZ++)
+				{
+					const auto it = cells.find(packCell(cellX, cellY, cellZ));
+					if(it == cells.end())
+					{
+						continue;
+					}
+					for(const auto handle : it->second)
+					{
+						callback(handle);
+					}
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "Datagrams.hpp"
+#include "stateQuantization.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+namespace data
+{
+
+namespace codec
+{
+
+// Compact encoding of Controller::DesiredState. Fields are quantized to steps of configurable precision,
+// and sent as differences from a baseline state, which the recipient already has, packed into as few bits as they need.
+// Fields that did not change cost a single bit, and small changes take a few bits instead of a whole float
+
+/// Bit packing ///
+
+// Writes values of up to 32 bits, least significant bits first, into a buffer of given capacity.
+// The caller makes sure that everything written fits
+class BitWriter
+{
+	char* data;
+	size_t capacity;
+	size_t bytes = 0;
+	uint64_t accumulator = 0;
+	uint32_t accumulated = 0; // bits in the accumulator
+	
+public:
+	
+	BitWriter(char* data_, const size_t capacity_)
+		: data(data_), capacity(capacity_)
+	{}
+	
+	void write(const uint32_t value, const uint32_t bits)
+	{
+		const uint64_t mask = (uint64_t(1) << bits) - 1;
+		accumulator |= (value & mask) << accumulated;
+		accumulated += bits;
+		while(accumulated >= 8)
+		{
+			assert(bytes < capacity);
+			data[bytes++] = static_cast<char>(accumulator);
+			accumulator >>= 8;
+			accumulated -= 8;
+		}
+	}
+	
+	size_t getBitsCount() const { return bytes * 8 + accumulated; }
+	size_t getCapacityBits() const { return capacity * 8; }
+	
+	// Writes out the last, partial byte. Returns the number of bytes written
+	size_t flush()
+	{
+		if(accumulated > 0)
+		{
+			assert(bytes < capacity);
+			data[bytes++] = static_cast<char>(accumulator);
+			accumulator = 0;
+			accumulated = 0;
+		}
+		return bytes;
+	}
+};
+
+// Reads values written by a BitWriter. Reading past bitsCount fails
+class BitReader
+{
+	const char* data;
+	size_t bitsCount;
+	size_t position = 0;
+	
+public:
+	
+	BitReader(const char* data_, const size_t bitsCount_)
+		: data(data_), bitsCount(bitsCount_)
+	{}
+	
+	bool read(uint32_t& value, const uint32_t bits)
+	{
+		if(position + bits > bitsCount)
+		{
+			return false;
+		}
+		uint64_t result = 0;
+		for(uint32_t done = 0; done < bits; )
+		{
+			const size_t byte = position / 8;
+			const uint32_t offset = position % 8;
+			const uint32_t take = std::min<uint32_t>(8 - offset, bits - done);
+			const uint64_t chunk = (static_cast<uint8_t>(data[byte]) >> offset) & ((1u << take) - 1);
+			result |= chunk << done;
+			done += take;
+			position += take;
+		}
+		value = static_cast<uint32_t>(result);
+		return true;
+	}
+	
+	size_t getRemainingBits() const { return bitsCount - position; }
+};
+
+// Unsigned values are written with a 2 bit class, selecting one of these widths
+constexpr uint32_t VarUintWidths[4] = {4, 8, 16, 32};
+constexpr uint32_t MaxVarUintBits = 2 + 32;
+
+inline void writeVarUint(BitWriter& writer, const uint32_t value)
+{
+	uint32_t widthClass = 0;
+	while(widthClass < 3 && (value >> VarUintWidths[widthClass]) != 0)
+	{
+		widthClass++;
+	}
+	writer.write(widthClass, 2);
+	writer.write(value, VarUintWidths[widthClass]);
+}
+
+inline bool readVarUint(BitReader& reader, uint32_t& value)
+{
+	uint32_t widthClass;
+	return reader.read(widthClass, 2) && reader.read(value, VarUintWidths[widthClass]);
+}
+
+// Maps signed values to unsigned ones, so that values close to 0 stay small: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+inline uint32_t zigzag(const int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+inline int32_t unzigzag(const uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+/// Quantization ///
+
+// Fields of Controller::DesiredState, in order position, orientation, wheelSpeed, as numbers of steps
+struct QuantizedState
+{
+	static constexpr size_t FieldsCount = 7;
+	
+	int32_t fields[FieldsCount] = {};
+	
+	bool operator==(const QuantizedState& other) const { return std::equal(fields, fields + FieldsCount, other.fields); }
+};
+
+// Quantized values are kept within +-2^30 steps, so that a difference of any two fits in 32 bits
+constexpr float MaxQuantizedValue = float(1 << 30);
+
+inline int32_t quantize(const float value, const float inverseStep)
+{
+	const float steps = std::round(value * inverseStep);
+	if(std::isnan(steps))
+		return 0;
+	return static_cast<int32_t>(std::clamp(steps, -MaxQuantizedValue, MaxQuantizedValue));
+}
+
+inline QuantizedState quantize(const Controller::DesiredState& state, const Quantization& quantization)
+{
+	QuantizedState res;
+	for(size_t i=0; i<3; i++) res.fields[i] = quantize(state.position[i], 1.0f / quantization.positionStep);
+	for(size_t i=0; i<2; i++) res.fields[3 + i] = quantize(state.orientation[i], 1.0f / quantization.orientationStep);
+	for(size_t i=0; i<2; i++) res.fields[5 + i] = quantize(state.wheelSpeed[i], 1.0f / quantization.wheelSpeedStep);
+	return res;
+}
+
+inline Controller::DesiredState dequantize(const QuantizedState& state, const Quantization& quantization)
+{
+	Controller::DesiredState res;
+	for(size_t i=0; i<3; i++) res.position[i] = state.fields[i] * quantization.positionStep;
+	for(size_t i=0; i<2; i++) res.orientation[i] = state.fields[3 + i] * quantization.orientationStep;
+	for(size_t i=0; i<2; i++) res.wheelSpeed[i] = state.fields[5 + i] * quantization.wheelSpeedStep;
+	return res;
+}
+
+/// Snapshots ///
+
+// Quantized states of all controllers at some tick, sorted by id.
+// Both sides keep the snapshots of recent ticks, so that they can be used as baselines
+struct Snapshot
+{
+	uint64_t tick = 0;
+	std::vector<IdType> ids;
+	std::vector<QuantizedState> states;
+	
+	void clear()
+	{
+		tick = 0;
+		ids.clear();
+		states.clear();
+	}
+	
+	// Returns nullptr if there is no such controller
+	const QuantizedState* find(const IdType id) const
+	{
+		const auto it = std::lower_bound(ids.begin(), ids.end(), id);
+		if(it == ids.end() || *it != id)
+			return nullptr;
+		return &states[it - ids.begin()];
+	}
+};
+
+/// Entries ///
+
+// Entry is the difference of id from the id of the previous entry (or from 0, for the first entry of a datagram),
+// a mask of fields that differ from the baseline, and the zigzagged difference of each of these fields.
+// Controllers missing from the baseline are encoded relative to all zero fields
+constexpr size_t MaxEntryBits = MaxVarUintBits + QuantizedState::FieldsCount + QuantizedState::FieldsCount * MaxVarUintBits;
+
+inline void writeEntry(BitWriter& writer, const IdType idDifference, const QuantizedState& state, const QuantizedState& baseline)
+{
+	writeVarUint(writer, idDifference);
+	uint32_t mask = 0;
+	for(size_t i=0; i<QuantizedState::FieldsCount; i++)
+	{
+		mask |= uint32_t(state.fields[i] != baseline.fields[i]) << i;
+	}
+	writer.write(mask, QuantizedState::FieldsCount);
+	for(size_t i=0; i<QuantizedState::FieldsCount; i++)
+	{
+		if(mask & (1u << i))
+		{
+			writeVarUint(writer, zigzag(static_cast<int32_t>(static_cast<uint32_t>(state.fields[i]) - static_cast<uint32_t>(baseline.fields[i]))));
+		}
+	}
+}
+
+// Decodes count entries of a datagram, relative to given baseline (nullptr if there is none),
+// calling callback(IdType id, const QuantizedState& state) for each. Returns false if the data is invalid or truncated
+template <typename Callback>
+bool readEntries(BitReader& reader, const size_t count, const Snapshot* baseline, Callback&& callback)
+{
+	static const QuantizedState Zero;
+	IdType id = 0;
+	for(size_t entry = 0; entry < count; entry++)
+	{
+		uint32_t idDifference, mask;
+		if(!readVarUint(reader, idDifference) || !reader.read(mask, QuantizedState::FieldsCount))
+		{
+			return false;
+		}
+		// Ids within a datagram are strictly increasing
+		if(idDifference == 0)
+		{
+			return false;
+		}
+		id += idDifference;
+		
+		const QuantizedState* base = baseline ? baseline->find(id) : nullptr;
+		QuantizedState state = base ? *base : Zero;
+		for(size_t i=0; i<QuantizedState::FieldsCount; i++)
+		{
+			uint32_t difference;
+			if((mask & (1u << i)) == 0)
+				continue;
+			if(!readVarUint(reader, difference))
+				return false;
+			state.fields[i] = static_cast<int32_t>(static_cast<uint32_t>(state.fields[i]) + static_cast<uint32_t>(unzigzag(difference)));
+		}
+		callback(id, static_cast<const QuantizedState&>(state));
+	}
+	return true;
+}
+
+}
+
+}
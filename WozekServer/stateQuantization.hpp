@@ -0,0 +1,20 @@
+#pragma once
+
+namespace data
+{
+
+namespace codec
+{
+
+// Size of a single quantization step of each kind of field of Controller::DesiredState, see stateCodec.hpp.
+// Values are rounded to the nearest step
+struct Quantization
+{
+	float positionStep = 1.0f / 256;
+	float orientationStep = 1.0f / 1024;
+	float wheelSpeedStep = 1.0f / 256;
+};
+
+}
+
+}
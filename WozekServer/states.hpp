@@ -2,11 +2,14 @@
 
 #include "asio_lib.hpp"
 #include "fileManager.hpp"
+#include "segmentedFileTransfer.hpp"
 
 #include <variant>
+#include <optional>
 #include <fstream>
 #include <filesystem>
 #include <iostream>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -20,15 +23,63 @@ namespace States
 	};
 	
 	
+	struct BulkLookup
+	{
+		std::vector<char> names;
+		std::vector<char> response;
+	};
+	
+	struct ControllerChanges
+	{
+		std::vector<char> response;
+	};
+	
+	struct MetricsSnapshot
+	{
+		std::string response;
+	};
+	
+	struct PrefixScan
+	{
+		std::vector<char> request;
+		std::vector<std::pair<data::IdType, std::string>> entries;
+		std::vector<char> batch;
+		size_t sent = 0;
+		bool more = false;
+	};
+	
 	struct SegmentedFileTransfer
 	{
-		std::vector<char> bigBuffer;
+		BufferPool::Handle bigBuffer;
 		size_t bufferFilled = 0;
-		std::optional<FileStream> fileStream;
+		fs::path path;
+		fs::path temporaryPath; // removed with the state, unless it was committed
+		UploadFile uploadFile; // receiving side
+		FileCache::MappedFilePtr sourceFile; // sending side
 		size_t bytesRemaining = 0;
 		size_t fileSegmentLengthLeft = 0;
 		
+		segFileTransfer::Negotiator negotiator;
+		data::SegmentedFileTransfer::Negotiation negotiation = {};
+		uint32_t segmentsUntilNegotiation = 0;
+		
 		bool internalFileError = false;
+		
+		~SegmentedFileTransfer()
+		{
+			uploadFile.close();
+			if(!temporaryPath.empty())
+			{
+				std::error_code ignored;
+				fs::remove(temporaryPath, ignored);
+			}
+		}
+	};
+	
+	struct FileDownload
+	{
+		FileCache::MappedFilePtr file; // held until the whole file is sent, even if it gets replaced meanwhile
+		size_t sent = 0;
 	};
 	
 	/*
@@ -90,7 +141,7 @@ namespace States
 	*/
 	
 	
-	using Type = std::variant<Empty, EchoMessageBuffer, SegmentedFileTransfer>;
+	using Type = std::variant<Empty, EchoMessageBuffer, BulkLookup, PrefixScan, ControllerChanges, MetricsSnapshot, SegmentedFileTransfer, FileDownload>;
 }
 
 
@@ -1,67 +1,85 @@
 #ifdef TESTRUN
 #include "Everything.hpp"
+#include <random>
 
 
-void testDatabase()
+// Fan-out of controller state to controllers within the interest radius, against sending everything to everyone
+void benchmarkWorldInterest()
 {
-	using namespace db;
+	using Clock = std::chrono::steady_clock;
+	auto microseconds = [](const auto duration){ return std::chrono::duration_cast<std::chrono::microseconds>(duration).count(); };
 	
-	asio::io_context ioContext;
+	WorldTickSettings settings;
+	settings.interestRadius = 16;
 	
-	Database database;
-	databaseManager.setDatabase(database);
-	databaseManager.createStrand(ioContext);
+	// Density is the same for every size, about 20 controllers within the interest radius of each one
+	const float density = 20 / (3.14159f * settings.interestRadius * settings.interestRadius);
 	
-	databaseManager.post([&database]
+	for(const size_t count : {1000, 10000, 50000})
 	{
-		std::cout << "Inside1:\n";
-		std::cout << databaseManager.removeRecord<db::Database::Table::Host>(3) << '\n';
-		showDatabase(database);
-	});
-	databaseManager.post([&database]
-	{
-		std::cout << "Inside2:\n";
-		std::cout << databaseManager.removeRecord<db::Database::Table::Host>(3) << '\n';
-		showDatabase(database);
-	});
-	
-	
-	assert( databaseManager.addRecord<db::Database::Table::Host>(Host::Header{1, "Host nr 1"}) );
-	assert( databaseManager.addRecord<db::Database::Table::Host>(Host::Header{3, "Host nr 3"}) );
-	assert( databaseManager.addRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2"}) );
-	assert( !databaseManager.addRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2"}) );
-	assert( databaseManager.createAndAddRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2 new"}) );
-	assert( databaseManager.createAndAddRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2 new"}) );
-	assert( databaseManager.createAndAddRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2 new"}) );
-	assert( databaseManager.createAndAddRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2 new"}) );
-	assert( databaseManager.createAndAddRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2 new"}) );
-	assert( databaseManager.createAndAddRecord<db::Database::Table::Host>(Host::Header{2, "Host nr 2 new"}) );
-	assert( !databaseManager.removeRecord<db::Database::Table::Host>(2424) );
-	
-	std::cout << '\n';
-	showDatabase(database);
-	
-	assert( databaseManager.addRecord<db::Database::Table::Controller>(Controller::Header{2}) );
-	assert( databaseManager.addRecord<db::Database::Table::Controller>(Controller::Header{3}) );
-	assert( databaseManager.addRecord<db::Database::Table::Controller>(Controller::Header{1}) );
-	
-	std::cout << '\n';
-	showDatabase(database);
-	
-	assert( databaseManager.removeRecord<db::Database::Table::Host>(1) );
-	assert( !databaseManager.removeRecord<db::Database::Table::Host>(2424) );
-	
-	std::cout << '\n';
-	showDatabase(database);
-	
-	std::cin.get();
-	
-	ioContext.run();
+		auto world = std::make_shared<World>();
+		std::mt19937 random(count);
+		const float side = std::sqrt(count / density);
+		std::uniform_real_distribution<float> coordinate(0, side);
+		std::uniform_real_distribution<float> step(-1, 1);
+		
+		std::vector<data::Controller::DesiredState> states(count);
+		for(size_t i=0; i<count; i++)
+		{
+			world->addController(i + 1, {});
+			states[i] = {{coordinate(random), 0, coordinate(random)}, {0, 0}, {0, 0}};
+			world->setDesiredState(i + 1, states[i]);
+		}
+		world->tick();
+		
+		// Every tick a tenth of the controllers moves a bit
+		const size_t ticks = 100;
+		Clock::duration tickTime{0};
+		for(size_t t=0; t<ticks; t++)
+		{
+			for(size_t i=t % 10; i<count; i+=10)
+			{
+				states[i].position[0] += step(random);
+				states[i].position[2] += step(random);
+				world->setDesiredState(i + 1, states[i]);
+			}
+			const auto start = Clock::now();
+			world->tick();
+			tickTime += Clock::now() - start;
+		}
+		
+		size_t interestPairs = 0;
+		auto start = Clock::now();
+		for(size_t i=0; i<count; i++)
+		{
+			world->forEachControllerOfInterest(i + 1, [&](const data::IdType id, const data::Controller::DesiredState& state){
+				interestPairs += state.position[0] != 0 || id != 0;
+			});
+		}
+		const auto interestTime = Clock::now() - start;
+		
+		// What fanning out every state to every controller has to go through
+		size_t allPairs = 0;
+		start = Clock::now();
+		for(size_t i=0; i<count; i++)
+		{
+			for(size_t j=0; j<count; j++)
+			{
+				allPairs += i != j && states[j].position[0] != 0;
+			}
+		}
+		const auto allTime = Clock::now() - start;
+		
+		std::cout << count << " controllers:\n"
+				  << "\ttick: " << microseconds(tickTime) / ticks << " us\n"
+				  << "\tinterest fan-out, with grid update: " << interestPairs << " states in " << microseconds(interestTime) << " us\n"
+				  << "\tfan-out to everyone: " << allPairs << " states in " << microseconds(allTime) << " us\n";
+	}
 }
 
 int main()
 {
-	testDatabase();
+	benchmarkWorldInterest();
 }
 
 #endif // TESTRUN
@@ -0,0 +1,140 @@
+#include "trafficCapture.hpp"
+#include "logging.hpp"
+
+TrafficCapture trafficCapture;
+
+bool TrafficCapture::start(asio::io_context& ioContext, const fs::path& path, const uint64_t maxSize_)
+{
+	stop();
+	
+	std::lock_guard lock{mutex};
+	file = std::fopen(path.string().c_str(), "wb");
+	if(!file)
+	{
+		return false;
+	}
+	std::setvbuf(file, nullptr, _IOFBF, FileBufferSize);
+	
+	capture::FileHeader header;
+	std::memcpy(header.magic, capture::FileHeader::Magic, sizeof(header.magic));
+	header.version = capture::FileHeader::CurrentVersion;
+	header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	if(std::fwrite(&header, sizeof(header), 1, file) != 1)
+	{
+		std::fclose(file);
+		file = nullptr;
+		return false;
+	}
+	
+	startTime = std::chrono::steady_clock::now();
+	size = sizeof(header);
+	maxSize = maxSize_;
+	udpSources.clear();
+	lastTcpConnection = 0;
+	running.store(true, std::memory_order_relaxed);
+	
+	flushTimer.emplace(ioContext);
+	flushTimerStart();
+	return true;
+}
+
+void TrafficCapture::flushTimerStart()
+{
+	flushTimer.value().expires_after(FlushInterval);
+	flushTimer.value().async_wait([this](const ::Error& err){
+		if(err)
+			return;
+		std::lock_guard lock{mutex};
+		if(!file)
+			return;
+		std::fflush(file);
+		flushTimerStart();
+	});
+}
+
+void TrafficCapture::stop()
+{
+	std::lock_guard lock{mutex};
+	running.store(false, std::memory_order_relaxed);
+	flushTimer.reset();
+	if(file)
+	{
+		std::fclose(file);
+		file = nullptr;
+	}
+}
+
+void TrafficCapture::write(const capture::RecordType type, const uint32_t source, const char* data, const size_t length)
+{
+	capture::RecordHeader record;
+	record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+	record.source = source;
+	record.length = length;
+	record.type = type;
+	
+	if(size + sizeof(record) + length > maxSize)
+	{
+		logger.output("Traffic capture stopped, after reaching "_fmt, size, " bytes"_fmt);
+		running.store(false, std::memory_order_relaxed);
+		std::fclose(file);
+		file = nullptr;
+		return;
+	}
+	
+	size += sizeof(record) + length;
+	if(std::fwrite(&record, sizeof(record), 1, file) != 1 || (length > 0 && std::fwrite(data, length, 1, file) != 1))
+	{
+		logger.output("Traffic capture stopped, writing to the file failed"_fmt);
+		logger.error(Logger::Error::TrafficCaptureError);
+		running.store(false, std::memory_order_relaxed);
+		std::fclose(file);
+		file = nullptr;
+	}
+}
+
+void TrafficCapture::recordDatagram(const asioudp::endpoint& sender, const char* data, const size_t length)
+{
+	if(!isRunning())
+		return;
+	
+	std::lock_guard lock{mutex};
+	if(!file)
+		return;
+	const auto source = udpSources.try_emplace(sender, udpSources.size() + 1).first->second;
+	write(capture::RecordType::UdpDatagram, source, data, length);
+}
+
+uint32_t TrafficCapture::recordTcpOpened()
+{
+	if(!isRunning())
+		return 0;
+	
+	std::lock_guard lock{mutex};
+	if(!file)
+		return 0;
+	const auto connection = ++lastTcpConnection;
+	write(capture::RecordType::TcpOpened, connection, nullptr, 0);
+	return connection;
+}
+
+void TrafficCapture::recordTcpData(const uint32_t connection, const char* data, const size_t length)
+{
+	if(connection == 0 || !isRunning())
+		return;
+	
+	std::lock_guard lock{mutex};
+	if(!file)
+		return;
+	write(capture::RecordType::TcpData, connection, data, length);
+}
+
+void TrafficCapture::recordTcpClosed(const uint32_t connection)
+{
+	if(connection == 0 || !isRunning())
+		return;
+	
+	std::lock_guard lock{mutex};
+	if(!file)
+		return;
+	write(capture::RecordType::TcpClosed, connection, nullptr, 0);
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "asio_lib/asioWrapper.hpp"
+#include <filesystem>
+#include <optional>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+namespace capture
+{
+
+// Capture file is a FileHeader, followed by records in order of their timestamps, each being a RecordHeader and length bytes of data.
+// Sources number UDP senders (by endpoint) and TCP connections separately, both from 1
+struct FileHeader
+{
+	static constexpr char Magic[8] = {'W', 'O', 'Z', 'E', 'K', 'C', 'A', 'P'};
+	static constexpr uint32_t CurrentVersion = 1;
+	
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved = 0;
+	uint64_t startTime; // of the capture, in nanoseconds since the epoch of the system clock
+};
+static_assert(sizeof(FileHeader) == 24);
+
+enum class RecordType : uint8_t
+{
+	UdpDatagram = 1,
+	TcpOpened = 2,
+	TcpData = 3, // bytes read from the connection, in the pieces they were read by the server
+	TcpClosed = 4,
+};
+
+struct RecordHeader
+{
+	uint64_t timestamp; // nanoseconds since the start of the capture
+	uint32_t source;
+	uint32_t length; // of the data following the header
+	RecordType type;
+	uint8_t reserved[7] = {};
+};
+static_assert(sizeof(RecordHeader) == 24);
+
+// Reads the records of a capture file, one by one
+class Reader
+{
+	std::FILE* file = nullptr;
+	FileHeader header;
+	
+public:
+	
+	// Returns false if the file cannot be opened, or is not a capture
+	bool open(const fs::path& path)
+	{
+		close();
+		file = std::fopen(path.string().c_str(), "rb");
+		if(!file)
+		{
+			return false;
+		}
+		if(std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, FileHeader::Magic, sizeof(header.magic)) != 0 || header.version != FileHeader::CurrentVersion)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	
+	void close()
+	{
+		if(file)
+		{
+			std::fclose(file);
+			file = nullptr;
+		}
+	}
+	
+	const FileHeader& getHeader() const { return header; }
+	
+	// Returns false at the end of the file. A record truncated by a crash of the server counts as the end
+	bool next(RecordHeader& record, std::vector<char>& data)
+	{
+		if(!file || std::fread(&record, sizeof(record), 1, file) != 1)
+		{
+			return false;
+		}
+		data.resize(record.length);
+		return record.length == 0 || std::fread(data.data(), record.length, 1, file) == 1;
+	}
+	
+	Reader() {}
+	Reader(const Reader&) = delete;
+	~Reader() { close(); }
+};
+
+}
+
+// Records all incoming UDP datagrams and TCP data of the server, with their timestamps, so that the traffic can be replayed later.
+// Recording only copies the data into the buffer of the file, under a mutex, and does nothing at all while the capture is not running
+class TrafficCapture
+{
+	static constexpr size_t FileBufferSize = 1024 * 1024;
+	
+	// Server is usually stopped by killing it, so the buffer is flushed that often, to lose only the last moments of the capture
+	static constexpr auto FlushInterval = std::chrono::seconds(1);
+	
+	std::atomic<bool> running = false;
+	
+	std::mutex mutex;
+	std::FILE* file = nullptr;
+	std::chrono::steady_clock::time_point startTime;
+	std::optional<asio::steady_timer> flushTimer;
+	uint64_t size = 0;
+	uint64_t maxSize = 0;
+	
+	std::map<asioudp::endpoint, uint32_t> udpSources;
+	uint32_t lastTcpConnection = 0;
+	
+	void write(const capture::RecordType type, const uint32_t source, const char* data, const size_t length);
+	void flushTimerStart();
+	
+public:
+	
+	// Starts capturing into a new file. Capture stops by itself, once the file grows to maxSize
+	bool start(asio::io_context& ioContext, const fs::path& path, const uint64_t maxSize);
+	void stop();
+	
+	bool isRunning() const { return running.load(std::memory_order_relaxed); }
+	
+	void recordDatagram(const asioudp::endpoint& sender, const char* data, const size_t length);
+	
+	// Returns the number of the connection, to be passed with its data, or 0 if nothing is captured
+	uint32_t recordTcpOpened();
+	void recordTcpData(const uint32_t connection, const char* data, const size_t length);
+	void recordTcpClosed(const uint32_t connection);
+	
+	TrafficCapture() {}
+	TrafficCapture(const TrafficCapture&) = delete;
+	~TrafficCapture() { stop(); }
+};
+
+extern TrafficCapture trafficCapture;
@@ -0,0 +1,260 @@
+#include "worldManager.hpp"
+#include "logging.hpp"
+#include <algorithm>
+
+WorldManager worldManager;
+
+void WorldManager::start(asio::io_context& ioContext, const size_t shardsCount, const std::chrono::seconds& rebalanceDuration)
+{
+	assert(shards.empty());
+	
+	for(size_t i=0; i<std::max<size_t>(shardsCount, 1); i++)
+	{
+		auto& shard = *shards.emplace_back(std::make_unique<Shard>());
+		shard.workGuard.emplace(shard.ioContext.get_executor());
+		shard.thread = std::thread([&shard]{
+			try
+			{
+				shard.ioContext.run();
+			}
+			catch(std::exception& e)
+			{
+				logger.output("Cought exception in world shard thread: "_fmt, std::string(e.what()));
+			}
+		});
+	}
+	
+	rebalanceTimerDuration = rebalanceDuration;
+	if(rebalanceDuration == std::chrono::seconds(0))
+		return;
+	rebalanceTimer.emplace(ioContext);
+	rebalanceTimerStart();
+}
+
+void WorldManager::stop()
+{
+	if(rebalanceTimer.has_value())
+	{
+		rebalanceTimer.value().cancel();
+	}
+	
+	std::vector<data::IdType> ids;
+	{
+		std::lock_guard lock{mutex};
+		for(auto& [id, hosted] : worlds)
+		{
+			ids.push_back(id);
+		}
+	}
+	for(const auto id : ids)
+	{
+		destroyWorld(id);
+	}
+	
+	for(auto& shard : shards)
+	{
+		shard->workGuard.reset();
+	}
+	for(auto& shard : shards)
+	{
+		if(shard->thread.joinable())
+		{
+			shard->thread.join();
+		}
+	}
+	shards.clear();
+}
+
+void WorldManager::rebalanceTimerStart()
+{
+	rebalanceTimer.value().expires_after(rebalanceTimerDuration);
+	rebalanceTimer.value().async_wait([this](const ::Error& err){
+		if(err)
+			return;
+		rebalance();
+		rebalanceTimerStart();
+	});
+}
+
+data::IdType WorldManager::createWorld(const asioudp::endpoint& mainHostEndpoint, const WorldTickSettings& tickSettings)
+{
+	std::lock_guard lock{mutex};
+	if(worlds.size() >= MaxWorlds || shards.empty())
+	{
+		return 0;
+	}
+	
+	// Least busy shard, and out of equally busy ones, the one with fewest worlds
+	std::vector<size_t> worldsCount(shards.size(), 0);
+	for(auto& [id, hosted] : worlds)
+	{
+		++worldsCount[hosted->shard.load(std::memory_order_relaxed)];
+	}
+	size_t target = 0;
+	for(size_t i=1; i<shards.size(); i++)
+	{
+		if(std::tie(shards[i]->cost, worldsCount[i]) < std::tie(shards[target]->cost, worldsCount[target]))
+		{
+			target = i;
+		}
+	}
+	
+	auto hosted = std::make_shared<HostedWorld>();
+	const auto worldId = ++lastWorldId;
+	hosted->world = std::make_shared<World>(worldId);
+	hosted->shard.store(target, std::memory_order_relaxed);
+	
+	// Nothing runs on the world, until it is posted to its shard
+	auto& world = *hosted->world;
+	world.createStrand(shards[target]->ioContext);
+	world.setMainHost(0, mainHostEndpoint);
+	
+	worlds.emplace(worldId, hosted);
+	postToShard(hosted, [tickSettings](World& world){
+		world.startTicking(tickSettings);
+	});
+	return worldId;
+}
+
+bool WorldManager::destroyWorld(const data::IdType worldId)
+{
+	std::shared_ptr<HostedWorld> hosted;
+	{
+		std::lock_guard lock{mutex};
+		auto it = worlds.find(worldId);
+		if(it == worlds.end())
+		{
+			return false;
+		}
+		hosted = std::move(it->second);
+		worlds.erase(it);
+	}
+	
+	// The world is released, once the last queued handler is done with it
+	postToShard(hosted, [](World& world){
+		world.stopTicking();
+	});
+	return true;
+}
+
+bool WorldManager::post(const data::IdType worldId, std::function<void(World&)> callback)
+{
+	std::shared_ptr<HostedWorld> hosted;
+	{
+		std::lock_guard lock{mutex};
+		auto it = worlds.find(worldId);
+		if(it == worlds.end())
+		{
+			return false;
+		}
+		hosted = it->second;
+	}
+	postToShard(std::move(hosted), std::move(callback));
+	return true;
+}
+
+void WorldManager::postToShard(std::shared_ptr<HostedWorld> hosted, std::function<void(World&)> callback)
+{
+	const auto shard = hosted->shard.load(std::memory_order_acquire);
+	asio::post(shards[shard]->ioContext, [this, hosted = std::move(hosted), shard, callback = std::move(callback)]() mutable {
+		// Migration changes the shard as its last step on the old shard, so anything queued there after it has to follow the world
+		if(hosted->shard.load(std::memory_order_acquire) != shard)
+		{
+			postToShard(std::move(hosted), std::move(callback));
+			return;
+		}
+		callback(*hosted->world);
+	});
+}
+
+void WorldManager::migrate(std::shared_ptr<HostedWorld> hosted, const size_t targetShard)
+{
+	hosted->migrating = true;
+	postToShard(hosted, [this, hosted, targetShard](World& world){
+		world.moveTo(shards[targetShard]->ioContext);
+		hosted->shard.store(targetShard, std::memory_order_release);
+		
+		std::lock_guard lock{mutex};
+		hosted->migrating = false;
+	});
+}
+
+void WorldManager::getStats(std::vector<ShardStats>& shardsStats, std::vector<WorldStats>& worldsStats)
+{
+	shardsStats.assign(shards.size(), ShardStats{});
+	worldsStats.clear();
+	
+	std::vector<std::pair<data::IdType, std::shared_ptr<HostedWorld>>> hostedWorlds;
+	{
+		std::lock_guard lock{mutex};
+		for(size_t i=0; i<shards.size(); i++)
+		{
+			shardsStats[i].cost = shards[i]->cost;
+		}
+		hostedWorlds.assign(worlds.begin(), worlds.end());
+	}
+	
+	for(auto& [id, hosted] : hostedWorlds)
+	{
+		auto& stats = worldsStats.emplace_back(WorldStats{id, hosted->shard.load(std::memory_order_relaxed), hosted->world->getTickMetrics()});
+		auto& shard = shardsStats[stats.shard];
+		shard.worldsCount++;
+		shard.totalTickDuration += stats.tickMetrics.totalTickDuration;
+	}
+	std::sort(worldsStats.begin(), worldsStats.end(), [](auto& a, auto& b){ return a.id < b.id; });
+}
+
+void WorldManager::rebalance()
+{
+	std::lock_guard lock{mutex};
+	if(shards.size() < 2)
+	{
+		return;
+	}
+	
+	for(auto& shard : shards)
+	{
+		shard->cost = std::chrono::nanoseconds(0);
+	}
+	for(auto& [id, hosted] : worlds)
+	{
+		const auto total = hosted->world->getTickMetrics().totalTickDuration;
+		hosted->cost = total - hosted->lastTotalTickDuration;
+		hosted->lastTotalTickDuration = total;
+		shards[hosted->shard.load(std::memory_order_relaxed)]->cost += hosted->cost;
+	}
+	
+	const auto [cheapest, costliest] = std::minmax_element(shards.begin(), shards.end(), [](auto& a, auto& b){ return a->cost < b->cost; });
+	const auto gap = (*costliest)->cost - (*cheapest)->cost;
+	
+	// Small differences are not worth losing the caches of the moved world
+	if(gap < MinRebalanceGap || gap * 4 < (*costliest)->cost)
+	{
+		return;
+	}
+	
+	// Moving a world of cost c leaves the shards |gap - 2c| apart, so the best one costs closest to half of the gap
+	const size_t from = costliest - shards.begin();
+	const size_t to = cheapest - shards.begin();
+	std::optional<std::pair<data::IdType, std::shared_ptr<HostedWorld>>> best;
+	for(auto& [id, hosted] : worlds)
+	{
+		if(hosted->shard.load(std::memory_order_relaxed) != from || hosted->migrating || hosted->cost <= std::chrono::nanoseconds(0) || hosted->cost >= gap)
+		{
+			continue;
+		}
+		if(!best || std::chrono::abs(gap - hosted->cost * 2) < std::chrono::abs(gap - best->second->cost * 2))
+		{
+			best.emplace(id, hosted);
+		}
+	}
+	if(!best)
+	{
+		return;
+	}
+	
+	logger.output("Moving world "_fmt, best->first, " from shard "_fmt, from, " to "_fmt, to, " (shard tick costs: "_fmt, (*costliest)->cost.count(), "ns, "_fmt, (*cheapest)->cost.count(), "ns)"_fmt);
+	shards[from]->cost -= best->second->cost;
+	shards[to]->cost += best->second->cost;
+	migrate(best->second, to);
+}
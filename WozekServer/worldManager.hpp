@@ -0,0 +1,111 @@
+#pragma once
+
+#include "asio_lib.hpp"
+#include "World.hpp"
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <chrono>
+
+// Hosts all running worlds. Each world is owned by one shard, a thread running its own io_context,
+// so the state of a world stays in the caches of a single core, and worlds on different shards tick in parallel.
+// Tick cost of every world is measured, and the costliest shards periodically hand a world over to the cheapest ones,
+// so a single busy world cannot starve the others.
+class WorldManager
+{
+public:
+	
+	static constexpr size_t MaxWorlds = 1024;
+	
+	// Shards closer in tick cost than that, over a rebalance interval, are not rebalanced
+	static constexpr std::chrono::nanoseconds MinRebalanceGap = std::chrono::milliseconds(10);
+	
+	struct ShardStats
+	{
+		size_t worldsCount = 0;
+		std::chrono::nanoseconds cost{0}; // over the last rebalance interval
+		std::chrono::nanoseconds totalTickDuration{0}; // of the worlds currently on the shard, since they were created
+	};
+	
+	struct WorldStats
+	{
+		data::IdType id;
+		size_t shard;
+		WorldTickMetrics tickMetrics;
+	};
+	
+private:
+	
+	struct Shard
+	{
+		asio::io_context ioContext;
+		std::optional<asio::executor_work_guard<asio::io_context::executor_type>> workGuard;
+		std::thread thread;
+		
+		// Tick cost of the worlds of the shard, measured over the last rebalance interval
+		std::chrono::nanoseconds cost{0};
+	};
+	
+	struct HostedWorld
+	{
+		std::shared_ptr<World> world;
+		
+		// Shard owning the world. Changed only by the owning shard, as the last step of a migration
+		std::atomic<size_t> shard = 0;
+		
+		// Guarded by the mutex of the manager
+		std::chrono::nanoseconds lastTotalTickDuration{0};
+		std::chrono::nanoseconds cost{0};
+		bool migrating = false;
+	};
+	
+	std::vector<std::unique_ptr<Shard>> shards;
+	
+	std::mutex mutex;
+	std::unordered_map<data::IdType, std::shared_ptr<HostedWorld>> worlds;
+	data::IdType lastWorldId = 0;
+	
+	std::chrono::seconds rebalanceTimerDuration;
+	std::optional<asio::steady_timer> rebalanceTimer;
+	
+	void rebalanceTimerStart();
+	
+	// Runs callback(World&) on the shard owning the world. If the world moves away meanwhile, the callback follows it
+	void postToShard(std::shared_ptr<HostedWorld> hosted, std::function<void(World&)> callback);
+	
+	void migrate(std::shared_ptr<HostedWorld> hosted, const size_t targetShard);
+	
+public:
+	
+	// Starts the shard threads. Rebalancing runs on the given io_context, 0 duration disables it
+	void start(asio::io_context& ioContext, const size_t shardsCount, const std::chrono::seconds& rebalanceDuration);
+	
+	// Stops all worlds, and joins the shard threads
+	void stop();
+	
+	size_t getShardsCount() const { return shards.size(); }
+	
+	// Holds the mutex only for copying the list of worlds, tick metrics are read after releasing it
+	void getStats(std::vector<ShardStats>& shardsStats, std::vector<WorldStats>& worldsStats);
+	
+	// Creates a ticking world, on the least busy shard. Returns its id, or 0 if there are too many worlds
+	data::IdType createWorld(const asioudp::endpoint& mainHostEndpoint, const WorldTickSettings& tickSettings);
+	bool destroyWorld(const data::IdType worldId);
+	
+	// Runs callback(World&) on the shard owning the world. Returns false if there is no such world
+	bool post(const data::IdType worldId, std::function<void(World&)> callback);
+	
+	// Moves at most one world from the costliest shard to the cheapest one, if that evens out their tick costs
+	void rebalance();
+	
+	WorldManager() {}
+	WorldManager(const WorldManager&) = delete;
+	~WorldManager() { stop(); }
+};
+
+extern WorldManager worldManager;
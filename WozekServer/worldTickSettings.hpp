@@ -0,0 +1,34 @@
+#pragma once
+
+#include "stateQuantization.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// What a world does, when its ticks fall behind the schedule
+enum class WorldTickPolicy
+{
+	CatchUp, // missed ticks are run back to back (up to maxCatchUpTicks), so the simulated time keeps up with the real time
+	Skip, // missed ticks are dropped, so the simulated time falls behind
+};
+
+// How the state of controllers is sent to the main host
+enum class HostStateEncoding
+{
+	Raw, // UpdateHostState, with whole floats
+	Delta, // UpdateHostStateDelta, quantized and bit-packed relative to the last state acknowledged by the host
+};
+
+struct WorldTickSettings
+{
+	uint32_t rate = 60; // ticks per second
+	std::chrono::nanoseconds budget = std::chrono::milliseconds(8); // ticks taking longer are counted as overruns
+	WorldTickPolicy policy = WorldTickPolicy::CatchUp;
+	uint32_t maxCatchUpTicks = 4; // missed ticks beyond that are skipped, even when catching up
+	float convergenceRate = 10; // per second, how fast the simulated state approaches the desired state
+	float interestRadius = 16; // state of controllers is fanned out only to controllers within this distance
+	size_t hostStateDatagramSize = 1200; // state sent to the main host every tick is split into datagrams of at most this size
+	HostStateEncoding hostStateEncoding = HostStateEncoding::Delta;
+	data::codec::Quantization hostStateQuantization;
+	uint32_t hostStateHistory = 32; // ticks, for which the sent state is kept as a possible baseline. Older acknowledgements are ignored
+};